@@ -2,27 +2,85 @@
 
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
+#include "boost/range/iterator_range.hpp"
+
+#include "include/tokenizer.h"
+
 struct Document {
+  // end of the segment containing token at position, the document if it has one segment
+  int get_segment_end(int position) const {
+    auto iter = std::upper_bound(segment_starts.begin(), segment_starts.end(), position);
+    return iter == segment_starts.end() ? static_cast<int>(tokens.size()) : *iter;
+  }
+
   long id;
   std::vector<std::string> tokens;
+  // positions of the first tokens of segments after the first one in increasing order,
+  // collocations never cross segments
+  std::vector<int> segment_starts;
 };
 
+// Documents of a batch own their tokens. clear() keeps all storage of the batch: documents
+// with their token arrays stay allocated and token strings are moved into the free list,
+// so a recycled batch (see BatchPool) is refilled without memory allocations.
+// Boundary chars separate tokens as delimiters and also split documents into segments.
 class Batch {
  public:
-  explicit Batch(const std::string& delimiters) : delimiters(delimiters) { }
+  typedef boost::iterator_range<std::vector<Document>::const_iterator> Documents;
 
+  explicit Batch(const std::string& delimiters, const std::string& boundaries = "")
+      : delimiters(delimiters)
+      , documents_()
+      , num_documents_(0)
+      , sequence_number_(0)
+      , free_tokens_()
+      , tokenizer_(delimiters + boundaries)
+      , token_spans_()
+      , has_boundaries_(!boundaries.empty())
+  {
+    std::fill(is_boundary_, is_boundary_ + 256, false);
+    for (const auto& c : boundaries) {
+      is_boundary_[static_cast<unsigned char>(c)] = true;
+    }
+  }
+
+  // segments of document are split by boundary chars between its tokens
   void add_document(const std::string& src_document);
   void add_document(long id, const std::vector<std::string>& tokens);
 
-  const std::vector<Document>& get_documents() const { return documents_; }
+  // appends document without tokens, they are added to the last document by add_token()
+  void start_document(long id);
+  void add_token(const char* data, size_t size);
+
+  Documents get_documents() const {
+    return Documents(documents_.begin(), documents_.begin() + num_documents_);
+  }
+
+  int size() const { return num_documents_; }
+
+  // position of the batch in input order on the pass through collection, set by the reading stage
+  long get_sequence_number() const { return sequence_number_; }
+
+  void set_sequence_number(long sequence_number) { sequence_number_ = sequence_number; }
+
+  // estimation of memory used by the batch, including the kept storage of cleared documents
+  size_t get_memory_usage() const;
 
-  int size() const { return documents_.size(); }
+  void clear();
 
   const std::string delimiters;
 
  private:
   std::vector<Document> documents_;
+  int num_documents_;
+  long sequence_number_;
+  std::vector<std::string> free_tokens_;
+  Tokenizer tokenizer_;
+  std::vector<TokenSpan> token_spans_;
+  bool has_boundaries_;
+  bool is_boundary_[256];
 };
@@ -0,0 +1,41 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "boost/utility.hpp"
+
+#include "include/batch.h"
+#include "include/bounded_queue.h"
+
+// Batches recycled between the reading stages and the workers on all passes through
+// collection. Released batches are cleared with their storage kept, acquire() returns
+// a recycled batch if there is one, so steady state reading doesn't allocate memory.
+class BatchPool : boost::noncopyable {
+ public:
+  BatchPool(const std::string& delimiters, const std::string& boundaries, size_t capacity)
+      : delimiters_(delimiters)
+      , boundaries_(boundaries)
+      , free_batches_(capacity) { }
+
+  std::shared_ptr<Batch> acquire() {
+    std::shared_ptr<Batch> batch;
+    if (!free_batches_.try_pop(&batch)) {
+      batch = std::make_shared<Batch>(delimiters_, boundaries_);
+    }
+    return batch;
+  }
+
+  // batch shouldn't be used by anyone else, it is dropped if the pool is full
+  void release(std::shared_ptr<Batch> batch) {
+    batch->clear();
+    free_batches_.try_push(&batch);
+  }
+
+ private:
+  std::string delimiters_;
+  std::string boundaries_;
+  BoundedQueue<std::shared_ptr<Batch>> free_batches_;
+};
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 #include "include/batch.h"
 
@@ -10,5 +11,9 @@ class BatchProcessor {
  public:
   virtual std::shared_ptr<Batch> process(const Batch& batch) = 0;
 
+  // documents of the last processed batch already serialized in output format,
+  // nullptr if the processor returns them as a batch
+  virtual const std::string* get_serialized_output() const { return nullptr; }
+
   virtual ~BatchProcessor() { }
 };
@@ -0,0 +1,209 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "boost/thread/thread.hpp"
+#include "boost/utility.hpp"
+
+struct QueueStats {
+  size_t capacity;
+  size_t max_depth;
+  double mean_depth;
+  long num_full_waits;
+  long num_empty_waits;
+};
+
+// Bounded lock-free MPMC FIFO (D. Vyukov's ring buffer with per-cell sequence numbers),
+// used to pass data between pipeline stages. push() waits while the queue is full, pop()
+// waits while it is empty, which gives backpressure from slow stages to fast ones.
+// close() is called by producers after the last push (or to abort): waiting calls return,
+// push() rejects new items and pop() drains the rest.
+template <typename T>
+class BoundedQueue : boost::noncopyable {
+ public:
+  explicit BoundedQueue(size_t capacity)
+      : capacity_(capacity > 0 ? capacity : 1)
+      , mask_(round_up_to_power_of_two(capacity_) - 1)
+      , cells_(new Cell[mask_ + 1])
+      , enqueue_position_(0)
+      , dequeue_position_(0)
+      , is_closed_(false)
+      , max_depth_(0)
+      , total_depth_(0)
+      , num_pushes_(0)
+      , num_full_waits_(0)
+      , num_empty_waits_(0)
+  {
+    for (size_t i = 0; i <= mask_; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool push(T item) {
+    if (is_closed_.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    for (int num_attempts = 0; !try_push(&item); ++num_attempts) {
+      if (is_closed_.load(std::memory_order_acquire)) {
+        return false;
+      }
+
+      if (num_attempts == 0) {
+        num_full_waits_.fetch_add(1, std::memory_order_relaxed);
+      }
+      back_off(num_attempts);
+    }
+
+    return true;
+  }
+
+  bool pop(T* item) {
+    for (int num_attempts = 0; !try_pop(item); ++num_attempts) {
+      if (is_closed_.load(std::memory_order_acquire)) {
+        // items pushed before close() are still returned
+        return try_pop(item);
+      }
+
+      if (num_attempts == 0) {
+        num_empty_waits_.fetch_add(1, std::memory_order_relaxed);
+      }
+      back_off(num_attempts);
+    }
+
+    return true;
+  }
+
+  bool try_push(T* item) {
+    Cell* cell = nullptr;
+    size_t position = enqueue_position_.load(std::memory_order_relaxed);
+
+    while (true) {
+      cell = &cells_[position & mask_];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+      if (difference == 0) {
+        if (position - dequeue_position_.load(std::memory_order_relaxed) >= capacity_) {
+          return false;
+        }
+
+        if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = enqueue_position_.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->data = std::move(*item);
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    update_stats(position + 1 - dequeue_position_.load(std::memory_order_relaxed));
+    return true;
+  }
+
+  bool try_pop(T* item) {
+    Cell* cell = nullptr;
+    size_t position = dequeue_position_.load(std::memory_order_relaxed);
+
+    while (true) {
+      cell = &cells_[position & mask_];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+
+      if (difference == 0) {
+        if (dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = dequeue_position_.load(std::memory_order_relaxed);
+      }
+    }
+
+    *item = std::move(cell->data);
+    cell->data = T();
+    cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  void close() {
+    is_closed_.store(true, std::memory_order_release);
+  }
+
+  bool is_closed() const {
+    return is_closed_.load(std::memory_order_acquire);
+  }
+
+  size_t size() const {
+    size_t enqueue_position = enqueue_position_.load(std::memory_order_relaxed);
+    size_t dequeue_position = dequeue_position_.load(std::memory_order_relaxed);
+    return enqueue_position > dequeue_position ? enqueue_position - dequeue_position : 0;
+  }
+
+  QueueStats get_stats() const {
+    long num_pushes = num_pushes_.load(std::memory_order_relaxed);
+    return { capacity_,
+             max_depth_.load(std::memory_order_relaxed),
+             num_pushes > 0 ? static_cast<double>(total_depth_.load(std::memory_order_relaxed)) / num_pushes : 0.0,
+             num_full_waits_.load(std::memory_order_relaxed),
+             num_empty_waits_.load(std::memory_order_relaxed) };
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  static size_t round_up_to_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  static void back_off(int num_attempts) {
+    if (num_attempts < 64) {
+      boost::this_thread::yield();
+    } else {
+      usleep(100);
+    }
+  }
+
+  void update_stats(size_t depth) {
+    total_depth_.fetch_add(depth, std::memory_order_relaxed);
+    num_pushes_.fetch_add(1, std::memory_order_relaxed);
+
+    size_t max_depth = max_depth_.load(std::memory_order_relaxed);
+    while (depth > max_depth && !max_depth_.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {
+      /* retry */
+    }
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+
+  std::atomic<size_t> enqueue_position_;
+  std::atomic<size_t> dequeue_position_;
+  std::atomic<bool> is_closed_;
+
+  std::atomic<size_t> max_depth_;
+  std::atomic<size_t> total_depth_;
+  std::atomic<long> num_pushes_;
+  std::atomic<long> num_full_waits_;
+  std::atomic<long> num_empty_waits_;
+};
@@ -0,0 +1,67 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "include/document_deduplicator.h"
+#include "include/thread_safe_collocation_start_indices.h"
+#include "include/thread_safe_counters.h"
+#include "include/thread_safe_dictionary.h"
+#include "include/token_mask.h"
+
+struct CheckpointHeader {
+  // number of finished counting stages: tokens counting and then counting of each
+  // group of collocation sizes
+  int num_finished_stages;
+  long total_collection_size;
+
+  // parameters defining the stages, a run can be resumed only with the same ones
+  int collocation_max_size;
+  int collocation_sizes_per_pass;
+  int heavy_hitters_memory_mb;
+  bool heavy_hitters_verify;
+  long threshold;
+  bool dedup;
+  bool token_filter;
+  std::string stop_words_path;
+  int min_unigram_df;
+  float max_unigram_ratio;
+
+  // total size of input files, the collection can't be replaced by another one on resume
+  long input_size;
+
+  // parameters of reading and joining tokens, counts made with other ones can't be mixed
+  std::string delimiters;
+  char esc_character;
+  bool deterministic;
+  std::string boundaries;
+};
+
+// State of the counting stages of full mode, so an interrupted run can be resumed after
+// the last finished stage. Binary file contains the header, tokens of dictionary in order of
+// indices, counters, start indices of documents, repeated documents of deduplicator and indices
+// of masked tokens. It is written sequentially into a temporary file, which then replaces the
+// previous checkpoint, and loaded from memory mapping.
+class Checkpoint {
+ public:
+  // deduplicator and token mask may be nullptr
+  static void store(const std::string& path,
+                    const CheckpointHeader& header,
+                    const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                    const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                    const std::shared_ptr<ThreadSafeCollocationStartIndices>& collocation_start_indices,
+                    const std::shared_ptr<DocumentDeduplicator>& deduplicator,
+                    const std::shared_ptr<TokenMask>& token_mask);
+
+  // fills empty dictionary, counters, start indices, deduplicator and token mask (if not nullptr)
+  static CheckpointHeader load(const std::string& path,
+                               const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                               const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                               const std::shared_ptr<ThreadSafeCollocationStartIndices>& collocation_start_indices,
+                               const std::shared_ptr<DocumentDeduplicator>& deduplicator,
+                               const std::shared_ptr<TokenMask>& token_mask);
+
+  static const char* const kSignature;
+};
@@ -0,0 +1,63 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/thread.hpp"
+#include "boost/utility.hpp"
+
+#include "include/batch.h"
+#include "include/batch_pool.h"
+#include "include/bounded_queue.h"
+#include "include/spinlock.h"
+
+// Read and parse stages of the collection processing for a single plain text file.
+// The reader thread splits the file into portions of batch_size raw lines, the pool of
+// num_parser_threads parsers turns them into batches and sends them to the workers via
+// batch_queue. Stages are connected by bounded queues, so a slow stage stops the previous ones.
+class CollectionPipeline : boost::noncopyable {
+ public:
+  CollectionPipeline(const std::string& input_path,
+                     const std::string& delimiters,
+                     int batch_size,
+                     int num_parser_threads,
+                     BoundedQueue<std::shared_ptr<Batch>>* batch_queue,
+                     BatchPool* batch_pool);
+
+  // waits for the end of reading and parsing, throws if any stage failed
+  void join();
+
+  QueueStats get_lines_queue_stats() const {
+    return lines_queue_.get_stats();
+  }
+
+  ~CollectionPipeline();
+
+ private:
+  // raw lines of one batch with its position in input order
+  struct Lines {
+    long sequence_number;
+    std::vector<std::string> lines;
+  };
+
+  void reader_function();
+  void parser_function();
+  void abort(const std::string& error_message);
+
+  std::string input_path_;
+  std::string delimiters_;
+  int batch_size_;
+  BoundedQueue<std::shared_ptr<Batch>>* batch_queue_;
+  BatchPool* batch_pool_;
+  BoundedQueue<std::shared_ptr<Lines>> lines_queue_;
+
+  std::atomic<int> num_active_parsers_;
+  mutable SpinLock error_lock_;
+  std::string error_message_;
+
+  boost::thread_group threads_;
+};
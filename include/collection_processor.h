@@ -4,38 +4,84 @@
 
 #include <atomic>
 #include <fstream>
+#include <istream>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "boost/thread.hpp"
 #include "boost/utility.hpp"
 
+#include "include/batch_pool.h"
 #include "include/batch_processor.h"
+#include "include/bounded_queue.h"
+#include "include/numa_topology.h"
 #include "include/spinlock.h"
 
+// Input files processed in sharded mode. Each shard is read by one thread only, the
+// thread claims the next shard via next_index after the end of the current one. Sequential
+// shards are read one after another by all threads under the read access lock via the
+// shared stream, so batches follow input order.
+struct InputShards : boost::noncopyable {
+  InputShards() : paths(), num_documents(), next_index(0), is_sequential(false), stream(), stream_index(0) { }
+
+  std::vector<std::string> paths;
+  std::vector<long> num_documents;
+  std::atomic<size_t> next_index;
+
+  bool is_sequential;
+  std::shared_ptr<std::istream> stream;
+  size_t stream_index;
+};
+
+// Outputs of batches which wait for the outputs of the previous batches in input order,
+// guarded by the write access lock. Workers don't wait for the previous batches: the next
+// batch may still be in the reading stages, which would stop if all workers waited.
+struct PendingOutputs : boost::noncopyable {
+  PendingOutputs() : next_sequence_number(0), outputs() { }
+
+  long next_sequence_number;
+  std::map<long, std::string> outputs;
+};
+
 class CollectionProcessorThread : boost::noncopyable {
  public:
   CollectionProcessorThread(BatchProcessor* batch_processor,
                             std::ifstream* input_stream,
+                            BoundedQueue<std::shared_ptr<Batch>>* batch_queue,
+                            InputShards* input_shards,
+                            BatchPool* batch_pool,
                             std::ofstream* output_stream,
+                            PendingOutputs* pending_outputs,
                             SpinLock* read_access_lock,
                             SpinLock* write_access_lock,
                             std::vector<std::shared_ptr<Batch>>* data_cache,
                             long* cache_top_index,
+                            long* num_read_batches,
                             const std::string& delimiters,
                             int batch_size,
-                            bool use_cache)
+                            bool use_cache,
+                            int cpu)
       : batch_processor_(batch_processor)
       , input_stream_(input_stream)
+      , batch_queue_(batch_queue)
+      , input_shards_(input_shards)
+      , batch_pool_(batch_pool)
       , output_stream_(output_stream)
+      , pending_outputs_(pending_outputs)
       , read_access_lock_(read_access_lock)
       , write_access_lock_(write_access_lock)
       , data_cache_(data_cache)
       , cache_top_index_(cache_top_index)
+      , num_read_batches_(num_read_batches)
       , delimiters_(delimiters)
       , batch_size_(batch_size)
       , use_cache_(use_cache)
+      , cpu_(cpu)
+      , shard_stream_()
+      , shard_index_(0)
       , is_stopping_(false)
       , thread_()
   {
@@ -57,16 +103,38 @@ class CollectionProcessorThread : boost::noncopyable {
  private:
   void thread_function();
 
+  std::shared_ptr<Batch> read_shards_batch(std::shared_ptr<std::istream>* shard_stream, size_t* shard_index);
+
+  // writes output of the batch, in input order if pending outputs are set
+  void write_output(long sequence_number,
+                    const std::shared_ptr<Batch>& processed_batch,
+                    const std::string* serialized_output);
+
+  // writes pending outputs of the batches following the written ones, under the write access lock
+  void write_pending_outputs();
+
   BatchProcessor* batch_processor_;
   std::ifstream* input_stream_;
+  BoundedQueue<std::shared_ptr<Batch>>* batch_queue_;
+  InputShards* input_shards_;
+  BatchPool* batch_pool_;
   std::ofstream* output_stream_;
+  // nullptr if outputs are written in the order of processing
+  PendingOutputs* pending_outputs_;
   SpinLock* read_access_lock_;
   SpinLock* write_access_lock_;
   std::vector<std::shared_ptr<Batch>>* data_cache_;
   long* cache_top_index_;
+  // batches read from the input stream or sequential shards, guarded by the read access lock
+  long* num_read_batches_;
   const std::string& delimiters_;
   int batch_size_;
   bool use_cache_;
+  // CPU to pin the thread to, -1 if the thread isn't pinned
+  int cpu_;
+
+  std::shared_ptr<std::istream> shard_stream_;
+  size_t shard_index_;
 
   mutable std::atomic<bool> is_stopping_;
   boost::thread thread_;
@@ -77,25 +145,84 @@ class CollectionProcessor {
   CollectionProcessor(const std::string& input_path,
                       const std::shared_ptr<std::string>& output_path,
                       const std::string& delimiters,
+                      const std::string& boundaries,
                       int batch_size,
-                      bool use_cache)
+                      bool use_cache,
+                      int num_decompression_threads,
+                      int num_parser_threads,
+                      bool pin_threads,
+                      bool deterministic)
       : input_path_(input_path)
       , output_path_(output_path)
       , delimiters_(delimiters)
+      , boundaries_(boundaries)
       , batch_size_(batch_size)
       , use_cache_(use_cache)
+      , num_decompression_threads_(num_decompression_threads)
+      , num_parser_threads_(num_parser_threads)
+      , pin_threads_(pin_threads)
+      , deterministic_(deterministic)
+      , numa_topology_()
+      , input_shards_()
+      , batch_pools_()
+      , queue_stats_()
       , data_cache_()
       , read_access_lock_()
       , write_access_lock_() { }
 
   void process(const std::vector<BatchProcessor*>& batch_processors);
 
+  // documents are taken from the batches on every pass as from the data cache, input_path isn't read
+  void set_batches(const std::vector<std::shared_ptr<Batch>>& batches) {
+    data_cache_ = batches;
+    use_cache_ = true;
+  }
+
+  // returns the input files for input_path, which may be a file, a directory (all files
+  // in it, recursively), a glob pattern in the file name or '@' followed by a path to a file
+  // with one input path per line
+  static std::vector<std::string> list_input_files(const std::string& input_path);
+
+  // numbers of documents in input shards on the last pass, empty if input is a single file
+  const std::vector<long>& get_shard_num_documents() const {
+    return input_shards_.num_documents;
+  }
+
+  const NumaTopology& get_numa_topology() const {
+    return numa_topology_;
+  }
+
+  // CPU of the worker thread with the given index, -1 if threads aren't pinned
+  int get_worker_cpu(int worker_index) const {
+    return pin_threads_ ? numa_topology_.get_worker_cpu(worker_index) : -1;
+  }
+
+  // estimation of memory used by cached batches
+  size_t get_cache_memory_usage() const;
+
+  // depth statistics of the pipeline queues on the last pass, empty if no queues were used
+  const std::vector<std::pair<std::string, QueueStats>>& get_queue_stats() const {
+    return queue_stats_;
+  }
+
  private:
   std::string input_path_;
   std::shared_ptr<std::string> output_path_;
   std::string delimiters_;
+  std::string boundaries_;
   int batch_size_;
   bool use_cache_;
+  int num_decompression_threads_;
+  int num_parser_threads_;
+  bool pin_threads_;
+  // output is written in input order and shards are read sequentially
+  bool deterministic_;
+  NumaTopology numa_topology_;
+  InputShards input_shards_;
+  // batches are recycled between passes if they are not cached, pinned workers reading
+  // input by themselves use the pool of their NUMA node, so batch memory is node-local
+  std::vector<std::shared_ptr<BatchPool>> batch_pools_;
+  std::vector<std::pair<std::string, QueueStats>> queue_stats_;
   // ToDo(mel-lain): optimize cache by using indices instead of strings
   std::vector<std::shared_ptr<Batch>> data_cache_;
   mutable SpinLock read_access_lock_;
@@ -4,12 +4,18 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "include/batch.h"
 #include "include/batch_processor.h"
+#include "include/concurrent_phrase_counters.h"
+#include "include/document_deduplicator.h"
+#include "include/phrase_counts_spiller.h"
+#include "include/space_saving_counters.h"
 #include "include/thread_safe_collocation_start_indices.h"
 #include "include/thread_safe_dictionary.h"
 #include "include/thread_safe_counters.h"
+#include "include/token_mask.h"
 
 class CollocationsProcessor : public BatchProcessor {
  public:
@@ -21,23 +27,126 @@ class CollocationsProcessor : public BatchProcessor {
       : dictionary_(dictionary)
       , index_to_counter_(index_to_counter)
       , collocation_start_indices_(collocation_start_indices)
-      , collocation_size_(0)
+      , first_collocation_size_(0)
+      , last_collocation_size_(0)
+      , heavy_hitters_(nullptr)
+      , phrase_counters_(nullptr)
+      , spiller_(nullptr)
+      , deduplicator_(nullptr)
+      , token_mask_(nullptr)
+      , verification_(false)
+      , scan_all_positions_(false)
       , threshold_(threshold)
-      , esc_character_(esc_character) { }
+      , esc_character_(esc_character)
+      , candidates_()
+      , candidate_hashes_()
+      , candidate_weights_()
+      , num_candidates_(0) { }
 
   virtual std::shared_ptr<Batch> process(const Batch& batch);
 
   virtual ~CollocationsProcessor() { }
 
   void set_collocation_size(int collocation_size) {
-    collocation_size_ = collocation_size;
+    set_collocation_sizes(collocation_size, collocation_size);
   }
 
+  // counts collocations of all sizes from first to last during one pass. Collocations of sizes
+  // greater than first are counted speculatively, if all their sub-collocations of size
+  // (first - 1) are frequent, so after the pass the counters should be pruned with
+  // prune_speculative_collocations to get the same result as with one size per pass
+  void set_collocation_sizes(int first_collocation_size, int last_collocation_size) {
+    first_collocation_size_ = first_collocation_size;
+    last_collocation_size_ = last_collocation_size;
+  }
+
+  // approximate mode: collocations are counted by the bounded heavy hitters summary instead
+  // of dictionary and counters, nullptr turns it off
+  void set_heavy_hitters(const std::shared_ptr<SpaceSavingCounters>& heavy_hitters) {
+    heavy_hitters_ = heavy_hitters;
+  }
+
+  // lock-free mode: collocations are counted by the shared phrase counters, which are moved into
+  // dictionary and counters by flush_phrase_counters after the pass, nullptr turns it off. Dictionary
+  // and counters aren't changed during the pass, so they are read without locks. Candidates of
+  // a batch are collected first and counted with prefetching of their slots
+  void set_phrase_counters(const std::shared_ptr<ConcurrentPhraseCounters>& phrase_counters) {
+    phrase_counters_ = phrase_counters;
+  }
+
+  // phrase counters are spilled into disk by the spiller when they exceed its memory budget,
+  // nullptr turns it off
+  void set_spiller(const std::shared_ptr<PhraseCountsSpiller>& spiller) {
+    spiller_ = spiller;
+  }
+
+  // spilled runs are merged with the rest of counters, spiller may be nullptr. Merged collocations
+  // are added to dictionary in lexicographic order, with sort_collocations the rest of counters
+  // are added in order of their hashes, so indices of collocations don't depend on the order of counting
+  static void flush_phrase_counters(const std::shared_ptr<ConcurrentPhraseCounters>& phrase_counters,
+                                    const std::shared_ptr<PhraseCountsSpiller>& spiller,
+                                    const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                                    const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                                    bool sort_collocations);
+
+  // verification mode: start indices of the previous pass are reused and only collocations
+  // already present in dictionary (candidates of approximate mode) are counted
+  void set_verification(bool verification) {
+    verification_ = verification;
+  }
+
+  // start positions are taken from the whole document instead of the previous pass, used when
+  // counters of the previous sizes are loaded from file (collocation has the same counter at any position)
+  void set_scan_all_positions(bool scan_all_positions) {
+    scan_all_positions_ = scan_all_positions;
+  }
+
+  // collocations of documents are counted with the weights equal to their numbers of copies,
+  // nullptr turns it off
+  void set_deduplicator(const std::shared_ptr<DocumentDeduplicator>& deduplicator) {
+    deduplicator_ = deduplicator;
+  }
+
+  // positions of masked tokens are not taken as start positions on the first pass, so no
+  // candidate of any size contains them, nullptr turns it off
+  void set_token_mask(const std::shared_ptr<TokenMask>& token_mask) {
+    token_mask_ = token_mask;
+  }
+
+  // removes counters of collocations of sizes (first, last] whose prefix or suffix
+  // sub-collocation is not counted or is less frequent than threshold
+  static void prune_speculative_collocations(const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                                             const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                                             int first_collocation_size,
+                                             int last_collocation_size,
+                                             long threshold,
+                                             char esc_character);
+
  private:
+  void add_candidate(const std::string& collocation, long weight);
+  void count_candidates();
+  void increase_candidates();
+
+  // number of candidates between prefetching and counting
+  static const size_t kPrefetchDistance = 8;
+
   std::shared_ptr<ThreadSafeDictionary> dictionary_;
   std::shared_ptr<ThreadSafeCounters> index_to_counter_;
   std::shared_ptr<ThreadSafeCollocationStartIndices> collocation_start_indices_;
-  int collocation_size_;
+  int first_collocation_size_;
+  int last_collocation_size_;
+  std::shared_ptr<SpaceSavingCounters> heavy_hitters_;
+  std::shared_ptr<ConcurrentPhraseCounters> phrase_counters_;
+  std::shared_ptr<PhraseCountsSpiller> spiller_;
+  std::shared_ptr<DocumentDeduplicator> deduplicator_;
+  std::shared_ptr<TokenMask> token_mask_;
+  bool verification_;
+  bool scan_all_positions_;
   long threshold_;
   char esc_character_;
+
+  std::vector<std::string> candidates_;
+  std::vector<size_t> candidate_hashes_;
+  std::vector<long> candidate_weights_;
+  size_t num_candidates_;
 };
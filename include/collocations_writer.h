@@ -0,0 +1,99 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+enum class CollocationsOrder {
+  kNone,
+  kDf,
+  kScore,
+  kLexicographic
+};
+
+struct CollocationRecord {
+  std::string collocation;
+  double df;
+  // max significance score of the merges which produced the collocation
+  double score;
+  double mean_score;
+  // raw frequency of the collocation in collection
+  double frequency;
+};
+
+// Writes collocations into file as '<collocation> <df>' lines (or '<collocation> <df> <score>
+// <mean_score> <frequency>' if write_stats is set) in the given order (by df or score
+// in descending order, ties are ordered lexicographically), keeping only collocations with
+// df >= min_df and at most top_n first ones (all if top_n is 0). Records are sorted in memory
+// by num_threads threads. If they take more than memory_limit_mb (no limit if 0), sorted runs
+// are spilled into temporary files near the output file and merged by finish().
+class CollocationsWriter : boost::noncopyable {
+ public:
+  CollocationsWriter(const std::string& output_path,
+                     CollocationsOrder order,
+                     double min_df,
+                     long top_n,
+                     bool write_stats,
+                     int num_threads,
+                     int memory_limit_mb)
+      : output_path_(output_path)
+      , order_(order)
+      , min_df_(min_df)
+      , top_n_(top_n)
+      , write_stats_(write_stats)
+      , num_threads_(num_threads > 0 ? num_threads : 1)
+      , memory_limit_(static_cast<size_t>(memory_limit_mb) << 20)
+      , output_buffer_(kOutputBufferSize)
+      , output_stream_()
+      , num_written_(0)
+      , records_()
+      , records_memory_(0)
+      , run_paths_()
+  {
+    output_stream_.rdbuf()->pubsetbuf(output_buffer_.data(), output_buffer_.size());
+    output_stream_.open(output_path_);
+    if (!output_stream_.is_open()) {
+      throw std::runtime_error("Error: unable to open collocations output file: " + output_path_);
+    }
+  }
+
+  void add(const CollocationRecord& record);
+
+  // sorts and writes the rest of records, should be called after the last add()
+  void finish();
+
+  ~CollocationsWriter();
+
+  // parses 'none', 'df', 'score' or 'lexicographic', throws otherwise
+  static CollocationsOrder parse_order(const std::string& name);
+
+ private:
+  void sort_records();
+  void spill_run();
+  void write_record(const CollocationRecord& record);
+  bool is_less(const CollocationRecord& first, const CollocationRecord& second) const;
+
+  static const size_t kOutputBufferSize = 1 << 20;
+
+  std::string output_path_;
+  CollocationsOrder order_;
+  double min_df_;
+  long top_n_;
+  bool write_stats_;
+  int num_threads_;
+  size_t memory_limit_;
+
+  std::vector<char> output_buffer_;
+  std::ofstream output_stream_;
+  long num_written_;
+
+  std::vector<CollocationRecord> records_;
+  size_t records_memory_;
+  std::vector<std::string> run_paths_;
+};
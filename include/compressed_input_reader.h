@@ -0,0 +1,87 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <istream>
+#include <memory>
+#include <string>
+
+#include "boost/thread.hpp"
+#include "boost/utility.hpp"
+
+#include "include/batch.h"
+#include "include/batch_pool.h"
+#include "include/bounded_queue.h"
+
+enum class CompressionType {
+  kNone,
+  kGzip,
+  kZstd
+};
+
+// Decompression stage of the collection processing: a separate thread inflates the input
+// file, splits it into documents and sends ready batches to the workers via batch_queue.
+// Zstd input consisting of several frames (pzstd, zstd -B) is decompressed frame-parallel
+// by num_decompression_threads threads, gzip input is decompressed sequentially.
+class CompressedInputReader : boost::noncopyable {
+ public:
+  CompressedInputReader(const std::string& input_path,
+                        const std::string& delimiters,
+                        int batch_size,
+                        int num_decompression_threads,
+                        BoundedQueue<std::shared_ptr<Batch>>* batch_queue,
+                        BatchPool* batch_pool)
+      : input_path_(input_path)
+      , delimiters_(delimiters)
+      , batch_size_(batch_size)
+      , num_decompression_threads_(num_decompression_threads > 0 ? num_decompression_threads : 1)
+      , batch_queue_(batch_queue)
+      , batch_pool_(batch_pool)
+      , batch_()
+      , num_batches_(0)
+      , tail_()
+      , error_message_()
+      , thread_()
+  {
+    boost::thread t(&CompressedInputReader::thread_function, this);
+    thread_.swap(t);
+  }
+
+  // waits for the end of decompression, throws if the reader thread failed
+  void join();
+
+  ~CompressedInputReader() {
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  static CompressionType detect_compression(const std::string& input_path);
+
+  // opens input file for sequential reading in the calling thread, decompressing it if needed
+  static std::shared_ptr<std::istream> open_input_stream(const std::string& input_path);
+
+ private:
+  void thread_function();
+
+  void read_gzip();
+  void read_zstd();
+
+  void add_data(const char* data, size_t size);
+  void add_line(const char* data, size_t size);
+  void push_batch();
+
+  std::string input_path_;
+  std::string delimiters_;
+  int batch_size_;
+  int num_decompression_threads_;
+  BoundedQueue<std::shared_ptr<Batch>>* batch_queue_;
+  BatchPool* batch_pool_;
+
+  std::shared_ptr<Batch> batch_;
+  long num_batches_;
+  std::string tail_;
+  std::string error_message_;
+
+  boost::thread thread_;
+};
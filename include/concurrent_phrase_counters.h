@@ -0,0 +1,142 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include "boost/thread/shared_mutex.hpp"
+#include "boost/utility.hpp"
+
+#include "include/huge_page_memory.h"
+
+// Lock-free counters of phrases: open addressing hash table with linear probing, new keys are
+// inserted by CAS into empty slots and counts are increased by fetch-add, so counting of a
+// known phrase is one probe without locks. Key and count are stored together in one entry.
+// When the table is half full, a twice larger table is chained after it and receives the
+// new keys. Lookups probe all chained tables, so each table adds a cache miss: counting threads
+// hold the mutex in shared mode while they increase a batch of keys and call compact_if_needed()
+// between batches, which moves all entries into one table under the exclusive lock. So the chain
+// is longer than one table only until the end of the batches counted during the growth.
+// A key inserted concurrently with the growth may get entries in both tables, compaction sums
+// them, but for_each() of not compacted counters reports all of them, so the consumer should
+// sum counts by key. Slots of tables are allocated with the given huge pages mode (see HugePageMemory).
+class ConcurrentPhraseCounters : boost::noncopyable {
+ public:
+  ConcurrentPhraseCounters(size_t initial_capacity, HugePagesMode huge_pages_mode)
+      : initial_capacity_(initial_capacity)
+      , huge_pages_mode_(huge_pages_mode)
+      , first_table_(nullptr)
+      , has_grown_(false)
+      , entries_memory_(0)
+      , tables_memory_(0)
+      , mutex_()
+  {
+    first_table_ = create_table(initial_capacity);
+  }
+
+  ~ConcurrentPhraseCounters() {
+    delete_tables();
+  }
+
+  void increase(const std::string& key, long value) {
+    increase(key, get_hash(key), value);
+  }
+
+  // hash should be computed by get_hash(key)
+  void increase(const std::string& key, size_t hash, long value);
+
+  // load the first slots probed for the hash and then the entries they point to into cache,
+  // so increase() of the key doesn't wait for memory. Entries should be prefetched some time
+  // after slots, when the slots are already in cache
+  void prefetch_slots(size_t hash) const {
+    for (Table* table = first_table_; table != nullptr; table = table->next.load(std::memory_order_relaxed)) {
+      __builtin_prefetch(&table->slots[hash & table->mask]);
+    }
+  }
+
+  void prefetch_entries(size_t hash) const {
+    for (Table* table = first_table_; table != nullptr; table = table->next.load(std::memory_order_relaxed)) {
+      const Entry* entry = table->slots[hash & table->mask].load(std::memory_order_relaxed);
+      if (entry != nullptr) {
+        __builtin_prefetch(entry);
+      }
+    }
+  }
+
+  static size_t get_hash(const std::string& key) {
+    return std::hash<std::string>()(key);
+  }
+
+  // visits all entries as function(key, count), isn't thread-safe with increase()
+  void for_each(const std::function<void(const std::string&, long)>& function) const;
+
+  // number of entries, an upper bound of the number of keys
+  size_t size() const;
+
+  // should be held in shared mode while counters are increased, exclusive lock is taken by
+  // compact_if_needed() and by spilling of counters (see PhraseCountsSpiller)
+  boost::shared_mutex& get_mutex() { return mutex_; }
+
+  // moves entries of chained tables into one table if the counters have grown, takes the mutex
+  // exclusively, so it is called by counting threads without the shared lock
+  void compact_if_needed();
+
+  // removes all entries, isn't thread-safe with increase(). The next counting starts with the
+  // capacity reached by this one if keep_capacity, otherwise with the initial capacity
+  void clear(bool keep_capacity = true);
+
+  // estimation of memory used by tables and entries, may be called concurrently with any method
+  size_t get_memory_usage() const {
+    return entries_memory_.load(std::memory_order_relaxed) + tables_memory_.load(std::memory_order_relaxed);
+  }
+
+  // memory of empty counters with the initial capacity
+  size_t get_initial_memory_usage() const;
+
+  // number of slots and huge pages mode of the largest table
+  size_t get_capacity() const;
+  HugePagesMode get_huge_pages_mode() const;
+
+ private:
+  struct Entry {
+    Entry(const std::string& _key, size_t _hash)
+        : key(_key)
+        , hash(_hash)
+        , count(0) { }
+
+    const std::string key;
+    const size_t hash;
+    std::atomic<long> count;
+  };
+
+  struct Table {
+    Table(size_t capacity, HugePagesMode huge_pages_mode);
+
+    ~Table();
+
+    const size_t mask;
+    // max number of entries before the growth
+    const size_t max_size;
+    HugePageMemory memory;
+    std::atomic<Entry*>* const slots;
+    std::atomic<size_t> size;
+    std::atomic<Table*> next;
+  };
+
+  Table* create_table(size_t capacity);
+  void grow(Table* table);
+  void compact();
+  void delete_tables();
+  const Table* get_last_table() const;
+
+  size_t initial_capacity_;
+  HugePagesMode huge_pages_mode_;
+  Table* first_table_;
+  // set when a table is chained, so compact_if_needed() checks it without the lock
+  std::atomic<bool> has_grown_;
+  std::atomic<size_t> entries_memory_;
+  std::atomic<size_t> tables_memory_;
+  boost::shared_mutex mutex_;
+};
@@ -0,0 +1,121 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "include/spinlock.h"
+
+// Two independent 64-bit hashes of document tokens, documents are copies only if both are equal
+struct DocumentHash {
+  bool operator==(const DocumentHash& other) const {
+    return first == other.first && second == other.second;
+  }
+
+  // FNV-1a over std::hash of tokens (or the hash function of deduplicator)
+  uint64_t first;
+  // FNV-1a over chars of tokens and their sizes
+  uint64_t second;
+};
+
+struct DocumentHashHasher {
+  size_t operator()(const DocumentHash& hash) const {
+    return hash.first ^ (hash.second * 0x9e3779b97f4a7c15ULL);
+  }
+};
+
+// Finds repeated documents by pairs of 64-bit hashes of their tokens (so documents differing only
+// in delimiters are equal) during the first pass. The first registered copy of a document
+// represents all its copies: later passes count it with the weight equal to the number of
+// copies and skip the other ones. Only documents with several copies are kept after finish().
+// Segmentations of repeated documents are shared between copies, so the scoring pass
+// transforms each of them only once.
+class DocumentDeduplicator : boost::noncopyable {
+ public:
+  // spans of segmented document in order: (dictionary index, size) pairs
+  typedef std::vector<std::pair<int, int>> Segmentation;
+
+  typedef std::function<uint64_t(const std::vector<std::string>&)> HashFunction;
+
+  // hash_function replaces the first hash of documents, e.g. to make collisions in tests
+  explicit DocumentDeduplicator(const HashFunction& hash_function = &DocumentDeduplicator::get_token_hash)
+      : hash_function_(hash_function)
+      , shards_(kNumShards)
+      , id_to_num_copies_()
+      , num_documents_(0)
+      , num_unique_documents_(0)
+      , segmentations_lock_()
+      , hash_to_segmentation_() { }
+
+  // registers document during the first pass, returns false if it is a copy of a registered one
+  bool add(long document_id, const std::vector<std::string>& tokens);
+
+  // drops unique documents, should be called after the first pass
+  void finish();
+
+  // number of copies of the document represented by the document with this id (1 for unique
+  // documents), valid after finish() only for documents registered as first copies
+  long get_num_copies(long document_id) const;
+
+  // the same for any document: 0 if it is a repeated copy of a document with another id
+  long get_num_copies(long document_id, const DocumentHash& hash) const;
+
+  // stores segmentation of repeated document if it isn't stored yet
+  void add_segmentation(const DocumentHash& hash, const Segmentation& segmentation);
+
+  // returns false if there is no segmentation for the document with this hash
+  bool get_segmentation(const DocumentHash& hash, Segmentation* segmentation) const;
+
+  // visits repeated documents as function(hash, first copy id, number of copies) after finish()
+  void for_each_repeated(const std::function<void(const DocumentHash&, long, long)>& function) const;
+
+  // restores state of finish() from visited repeated documents and numbers of documents
+  void add_repeated(const DocumentHash& hash, long first_id, long num_copies);
+  void set_num_documents(long num_documents, long num_unique_documents);
+
+  long get_num_documents() const { return num_documents_; }
+
+  long get_num_unique_documents() const { return num_unique_documents_; }
+
+  // number of documents visited by for_each_repeated()
+  size_t get_num_repeated_documents() const;
+
+  DocumentHash get_hash(const std::vector<std::string>& tokens) const {
+    return { hash_function_(tokens), get_char_hash(tokens) };
+  }
+
+  static uint64_t get_token_hash(const std::vector<std::string>& tokens);
+  static uint64_t get_char_hash(const std::vector<std::string>& tokens);
+
+ private:
+  struct Copies {
+    long first_id;
+    long num_copies;
+  };
+
+  struct Shard {
+    Shard() : lock(), hash_to_copies() { }
+
+    SpinLock lock;
+    std::unordered_map<DocumentHash, Copies, DocumentHashHasher> hash_to_copies;
+  };
+
+  // hashes are spread among shards with separate locks, so threads rarely wait for each other
+  static const size_t kNumShards = 64;
+
+  HashFunction hash_function_;
+  std::vector<Shard> shards_;
+  std::unordered_map<long, long> id_to_num_copies_;
+  long num_documents_;
+  long num_unique_documents_;
+
+  mutable SpinLock segmentations_lock_;
+  std::unordered_map<DocumentHash, Segmentation, DocumentHashHasher> hash_to_segmentation_;
+};
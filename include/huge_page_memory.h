@@ -0,0 +1,44 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "boost/utility.hpp"
+
+enum class HugePagesMode {
+  kNone,
+  kTransparent,
+  kExplicit
+};
+
+// Zero-filled anonymous memory for large flat tables with random access, optionally backed
+// by huge pages to reduce TLB misses. Explicit mode takes pages from the reserved hugetlbfs
+// pool (MAP_HUGETLB) and falls back to transparent mode if the pool is exhausted, transparent
+// mode aligns the mapping to the huge page size and asks the kernel to back it by huge pages
+// (MADV_HUGEPAGE), which is only a hint. Regions smaller than a huge page use normal pages.
+class HugePageMemory : boost::noncopyable {
+ public:
+  HugePageMemory(size_t size, HugePagesMode mode);
+
+  ~HugePageMemory();
+
+  void* data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  // mode of the mapping after fallbacks
+  HugePagesMode get_mode() const { return mode_; }
+
+  // parses 'none', 'transparent' or 'explicit', throws otherwise
+  static HugePagesMode parse_mode(const std::string& name);
+
+  static const size_t kHugePageSize = 2 << 20;
+
+ private:
+  void* data_;
+  size_t size_;
+  HugePagesMode mode_;
+  size_t mapping_size_;
+};
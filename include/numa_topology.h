@@ -0,0 +1,36 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// CPUs of NUMA nodes available to the process, read from sysfs. Without NUMA information
+// all allowed CPUs belong to a single node 0.
+class NumaTopology {
+ public:
+  NumaTopology();
+
+  int num_nodes() const { return node_cpus_.size(); }
+
+  const std::vector<int>& get_node_cpus(int node) const { return node_cpus_[node]; }
+
+  // CPU for worker thread with the given index: nodes are filled one by one, so
+  // workers share a node until all its CPUs are used
+  int get_worker_cpu(int worker_index) const;
+
+  int get_cpu_node(int cpu) const;
+
+  // binds the calling thread to the CPU, returns false if it is not allowed
+  static bool pin_current_thread(int cpu);
+
+  // CPUs the calling thread is allowed to run on
+  static std::vector<int> get_current_thread_cpus();
+
+  // parses sysfs list format, e.g. '0-3,8,10-11'
+  static std::vector<int> parse_cpu_list(const std::string& cpu_list);
+
+ private:
+  std::vector<std::vector<int>> node_cpus_;
+  std::vector<int> worker_cpus_;
+};
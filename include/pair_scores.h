@@ -0,0 +1,43 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <cmath>
+
+#include "include/common.h"
+
+// Significance scores of pairs (f - c1 * c2 / N) / sqrt(f), where c1 and c2 are frequencies of
+// the parts, f is the frequency of the pair and N is the size of collection (0 if f is 0).
+// compute() scores all adjacent pairs of a document at once with the widest SIMD instructions
+// supported by the processor (AVX or SSE2), the version is chosen on the first call. All
+// versions make the same operations in the same order, so they give the same results.
+class PairScores {
+ public:
+  static double compute_score(double frequency_first,
+                              double frequency_second,
+                              double pair_frequency,
+                              double total_collection_size)
+  {
+    double mu = frequency_first * frequency_second;
+    mu /= total_collection_size;
+
+    return pair_frequency > kEps ? (pair_frequency - mu) / std::sqrt(pair_frequency) : 0.0;
+  }
+
+  // scores[i] is the score of pair of tokens i and i + 1: token_frequencies has (num_pairs + 1)
+  // elements, pair_frequencies and scores have num_pairs ones
+  static void compute(const double* token_frequencies,
+                      const double* pair_frequencies,
+                      int num_pairs,
+                      double total_collection_size,
+                      double* scores);
+
+  static void compute_scalar(const double* token_frequencies,
+                             const double* pair_frequencies,
+                             int num_pairs,
+                             double total_collection_size,
+                             double* scores);
+
+  // 'avx', 'sse2' or 'scalar'
+  static const char* get_version();
+};
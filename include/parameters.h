@@ -4,6 +4,13 @@
 
 #include <string>
 
+// values of Parameters::mode, empty mode means full
+static const char* const kModeFull = "full";
+static const char* const kModeCount = "count";
+static const char* const kModeMerge = "merge";
+static const char* const kModeScore = "score";
+static const char* const kModeConvert = "convert";
+
 struct Parameters {
   std::string input_path;
   std::string output_path;
@@ -17,4 +24,32 @@ struct Parameters {
   bool use_cache;
   std::string delimiters;
   char esc_character;
+  int num_decompression_threads;
+  int num_parser_threads;
+  int collocation_sizes_per_pass;
+  int heavy_hitters_memory_mb;
+  bool heavy_hitters_verify;
+  std::string mode;
+  std::string model_path;
+  std::string counts_output_path;
+  std::string collocations_order;
+  int min_df;
+  long top_n;
+  int sort_memory_mb;
+  bool collocations_stats;
+  std::string output_format;
+  bool pin_threads;
+  bool numa_replicas;
+  std::string huge_pages;
+  bool dedup;
+  std::string checkpoint_path;
+  std::string resume_from;
+  int memory_limit_mb;
+  bool deterministic;
+  std::string stop_words_path;
+  int min_unigram_df;
+  float max_unigram_ratio;
+  std::string boundaries;
+  // progress isn't printed into std::cout
+  bool quiet;
 };
@@ -0,0 +1,39 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "include/thread_safe_counters.h"
+#include "include/thread_safe_dictionary.h"
+
+struct PartialCountsHeader {
+  // max size of collocations in the file
+  int collocation_size;
+  long total_collection_size;
+  // frequency threshold applied to the counts by the next counting rounds
+  long threshold;
+};
+
+// Mergeable counts of tokens and collocations, used to run counting passes on corpus shards
+// in separate processes. File format is text: the header line
+// 'topmine-counts <collocation_size> <total_collection_size> <threshold>' and then one
+// '<collocation> <count>' line per collocation.
+class PartialCounts {
+ public:
+  // stores collocations with dictionary indices >= first_index
+  static void store(const std::string& path,
+                    const PartialCountsHeader& header,
+                    const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                    const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                    int first_index);
+
+  // adds collocations from file to dictionary and their counts to counters,
+  // so loading of several files sums their counts
+  static PartialCountsHeader load(const std::string& path,
+                                  const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                                  const std::shared_ptr<ThreadSafeCounters>& index_to_counter);
+
+  static const char* const kSignature;
+};
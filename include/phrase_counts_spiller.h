@@ -0,0 +1,55 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "include/concurrent_phrase_counters.h"
+
+// Keeps memory of phrase counters within the budget during a counting pass. Counting threads
+// increase counters under the shared lock of their mutex and then call spill_if_needed(): if the
+// counters take more than memory_budget bytes, the first thread takes the lock exclusively, writes the entries
+// sorted by key as a run into temporary file '<path_prefix>.counts_run_<N>' and clears the
+// counters down to their initial capacity, so the budget should leave room for entries above it.
+// After the pass merge() sums counts of all runs and of the rest of counters by key.
+// At most max_open_runs runs are read at once: if there are more, the first ones are merged into
+// a new run until the rest fit, so the merge doesn't run out of file descriptors.
+class PhraseCountsSpiller : boost::noncopyable {
+ public:
+  static const size_t kMaxOpenRuns = 64;
+
+  PhraseCountsSpiller(const std::string& path_prefix, size_t memory_budget, size_t max_open_runs = kMaxOpenRuns)
+      : path_prefix_(path_prefix)
+      , memory_budget_(memory_budget)
+      , max_open_runs_(std::max<size_t>(max_open_runs, 2))
+      , num_created_runs_(0)
+      , run_paths_() { }
+
+  ~PhraseCountsSpiller();
+
+  void spill_if_needed(ConcurrentPhraseCounters* phrase_counters);
+
+  // visits summed counts as function(key, count) in order of keys, then removes runs and clears
+  // the counters, isn't thread-safe with counting
+  void merge(ConcurrentPhraseCounters* phrase_counters,
+             const std::function<void(const std::string&, long)>& function);
+
+  // number of runs spilled since the last merge()
+  size_t get_num_runs() const { return run_paths_.size(); }
+
+ private:
+  void spill(ConcurrentPhraseCounters* phrase_counters);
+  std::string create_run_path();
+  void remove_runs();
+
+  std::string path_prefix_;
+  size_t memory_budget_;
+  size_t max_open_runs_;
+  size_t num_created_runs_;
+  std::vector<std::string> run_paths_;
+};
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -10,9 +11,12 @@
 
 #include "include/batch.h"
 #include "include/batch_processor.h"
+#include "include/document_deduplicator.h"
 #include "include/thread_safe_dictionary.h"
 #include "include/thread_safe_counters.h"
+#include "include/thread_safe_score_stats.h"
 #include "include/heap.h"
+#include "include/segmentation_format.h"
 
 struct Collocation {
   Collocation(int _collocation_index, int _collocation_size)
@@ -23,48 +27,168 @@ struct Collocation {
   int collocation_size;
 };
 
+// Dictionary and counters of tokens and collocations are frozen while documents are scored,
+// so they are read without locks and processors of all threads share them.
 class ScoringProcessor : public BatchProcessor {
  public:
   ScoringProcessor(const std::shared_ptr<ThreadSafeDictionary>& dictionary,
                    const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
                    const std::shared_ptr<ThreadSafeCounters>& collocation_index_to_counter,
+                   const std::shared_ptr<ThreadSafeScoreStats>& collocation_index_to_score_stats,
                    const std::shared_ptr<std::atomic<long>>& total_collection_size,
                    float alpha,
                    int collocation_max_size,
                    bool return_processed_batch,
                    bool return_indices,
+                   OutputFormat output_format,
                    char esc_character)
       : dictionary_(dictionary)
       , index_to_counter_(index_to_counter)
       , collocation_index_to_counter_(collocation_index_to_counter)
+      , collocation_index_to_score_stats_(collocation_index_to_score_stats)
       , total_collection_size_(total_collection_size)
       , alpha_(alpha)
       , collocation_max_size_(collocation_max_size)
       , return_processed_batch_(return_processed_batch)
       , return_indices_(return_indices)
-      , esc_character_(esc_character) { }
+      , output_format_(output_format)
+      , esc_character_(esc_character)
+      , deduplicator_(nullptr)
+      , merge_function_(get_merge_function(collocation_max_size))
+      , processed_batch_()
+      , output_buffer_()
+      , span_lengths_()
+      , token_indices_()
+      , token_frequencies_()
+      , key_hashes_()
+      , pair_collocations_()
+      , pair_frequencies_()
+      , pair_indices_()
+      , pair_scores_()
+      , segmentation_() { }
 
   virtual std::shared_ptr<Batch> process(const Batch& batch);
 
+  // replaces frozen tables used for scoring, e.g. with replicas local to the NUMA node of the thread
+  void set_tables(const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                  const std::shared_ptr<ThreadSafeCounters>& index_to_counter)
+  {
+    dictionary_ = dictionary;
+    index_to_counter_ = index_to_counter;
+  }
+
+  // documents are counted with the weights equal to their numbers of copies, repeated copies
+  // reuse segmentation of the first transformed one, nullptr turns it off
+  void set_deduplicator(const std::shared_ptr<DocumentDeduplicator>& deduplicator) {
+    deduplicator_ = deduplicator;
+  }
+
+  // writes lengths of spans of the document into span_lengths, statistics of collocations aren't
+  // collected, so the processor used only for it may have nullptr tables of them. Tokens absent
+  // in the dictionary stay single-token spans
+  void segment(const Document& document, std::vector<int>* span_lengths);
+
+  // the same for a document of one segment given by indices of its tokens in the dictionary (-1 for
+  // absent tokens), e.g. mapped from ids of tokens, so there are no token strings: tokens of pairs
+  // are taken from the dictionary
+  void segment_indices(const std::vector<int>& token_indices, std::vector<int>* span_lengths);
+
+  virtual const std::string* get_serialized_output() const {
+    return return_processed_batch_ && is_serialized() ? &output_buffer_ : nullptr;
+  }
+
   virtual ~ScoringProcessor() { }
 
  private:
   double compute_pair_score(int index_first,
                             int index_second,
-                            const std::string& token_first,
-                            const std::string& token_second) const;
+                            boost::string_ref token_first,
+                            boost::string_ref token_second) const;
+
+  // frequency of collocation, 0 if it is absent, collocation_index is set to its index or -1
+  double get_frequency(const std::string& collocation, int* collocation_index) const;
+
+  // writes '<first><esc_character><second>' into collocation
+  void join_tokens(boost::string_ref first, boost::string_ref second, std::string* collocation) const;
+
+  // writes indices of the first num_keys keys in the dictionary into indices (-1 for absent ones),
+  // dictionary slots of the next keys are prefetched while the current one is looked up
+  void get_indices(const std::vector<std::string>& keys, size_t num_keys, std::vector<int>* indices);
+
+  // merges pairs of tokens and collocations while they are significant
+  void segment_document(const Document& document,
+                        std::unordered_map<int, Collocation>* position_to_collocation,
+                        std::unordered_map<int, double>* position_to_score);
+
+  // scores pairs of tokens with indices token_indices_ and merges them, tokens of pairs are taken
+  // from tokens or from the dictionary if it is nullptr
+  void merge_indexed_tokens(const std::vector<std::string>* tokens,
+                            const std::vector<int>& segment_starts,
+                            bool has_absent_tokens,
+                            std::unordered_map<int, Collocation>* position_to_collocation,
+                            std::unordered_map<int, double>* position_to_score);
 
-  void add_processed_item(const std::shared_ptr<Batch>& processed_batch,
-                          const std::unordered_map<int, Collocation>& position_to_collocation,
+  // merge loops over scored pairs of the document, specialized by the maximum collocation size
+  // (0 means that it is taken from collocation_max_size_)
+  typedef void (ScoringProcessor::*MergeFunction)(const std::vector<int>& segment_starts,
+                                                  int num_pairs,
+                                                  std::unordered_map<int, Collocation>* position_to_collocation,
+                                                  std::unordered_map<int, double>* position_to_score);
+
+  template <int kMaxSize>
+  void merge_pairs(const std::vector<int>& segment_starts,
+                   int num_pairs,
+                   std::unordered_map<int, Collocation>* position_to_collocation,
+                   std::unordered_map<int, double>* position_to_score);
+
+  static MergeFunction get_merge_function(int collocation_max_size);
+
+  static void get_span_lengths(const std::unordered_map<int, Collocation>& position_to_collocation,
+                               int num_tokens,
+                               std::vector<int>* span_lengths);
+
+  void add_processed_item(const std::unordered_map<int, Collocation>& position_to_collocation,
                           const Document& document);
 
+  // writes '<id> <start>|<size> ...' line of the document into output buffer
+  void serialize_indices(const std::unordered_map<int, Collocation>& position_to_collocation,
+                         const Document& document,
+                         char delimiter);
+
+  // writes document into output buffer in binary format (see SegmentationFormat)
+  void serialize_binary(const std::unordered_map<int, Collocation>& position_to_collocation,
+                        const Document& document);
+
+  bool is_serialized() const {
+    return return_indices_ || output_format_ == OutputFormat::kBinary;
+  }
+
+  // number of keys between prefetching and lookup
+  static const size_t kPrefetchDistance = 8;
+
   std::shared_ptr<ThreadSafeDictionary> dictionary_;
   std::shared_ptr<ThreadSafeCounters> index_to_counter_;
   std::shared_ptr<ThreadSafeCounters> collocation_index_to_counter_;
+  std::shared_ptr<ThreadSafeScoreStats> collocation_index_to_score_stats_;
   std::shared_ptr<std::atomic<long>> total_collection_size_;
   float alpha_;
   int collocation_max_size_;
   bool return_processed_batch_;
   bool return_indices_;
+  OutputFormat output_format_;
   char esc_character_;
+  std::shared_ptr<DocumentDeduplicator> deduplicator_;
+  MergeFunction merge_function_;
+
+  std::shared_ptr<Batch> processed_batch_;
+  std::string output_buffer_;
+  std::vector<int> span_lengths_;
+  std::vector<int> token_indices_;
+  std::vector<double> token_frequencies_;
+  std::vector<uint32_t> key_hashes_;
+  std::vector<std::string> pair_collocations_;
+  std::vector<double> pair_frequencies_;
+  std::vector<int> pair_indices_;
+  std::vector<double> pair_scores_;
+  DocumentDeduplicator::Segmentation segmentation_;
 };
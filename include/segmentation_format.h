@@ -0,0 +1,55 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "include/tokenizer.h"
+
+enum class OutputFormat {
+  kText,
+  kBinary
+};
+
+// segmented document: spans of tokens and collocations in order, covering all tokens
+struct SegmentedDocument {
+  long id;
+  std::vector<TokenSpan> spans;
+};
+
+// Binary format of segmented documents, used instead of the text output with indices. Each
+// document is a zigzag varint id, a varint number of spans and varint lengths of spans,
+// the start of a span is the sum of lengths of the previous ones.
+class SegmentationFormat {
+ public:
+  // parses 'text' or 'binary', throws otherwise
+  static OutputFormat parse_output_format(const std::string& name);
+
+  static void append_varint(unsigned long value, std::string* output);
+
+  static void append_document(long id, const std::vector<int>& span_lengths, std::string* output);
+
+  // converts binary file into text format of '--return-indices 1' output
+  static void convert_to_text(const std::string& input_path,
+                              const std::string& output_path,
+                              char delimiter,
+                              char esc_character);
+};
+
+class BinarySegmentationReader : boost::noncopyable {
+ public:
+  explicit BinarySegmentationReader(const std::string& input_path);
+
+  // returns false at the end of file, throws if the file is truncated or invalid
+  bool read(SegmentedDocument* document);
+
+ private:
+  bool read_varint(unsigned long* value);
+
+  std::string input_path_;
+  std::ifstream input_stream_;
+};
@@ -0,0 +1,64 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "include/spinlock.h"
+
+struct SpaceSavingEntry {
+  double count;
+  // upper bound of count overestimation, true frequency is in [count - error, count]
+  double error;
+};
+
+// Space-Saving heavy hitters summary (Metwally et al., 2005) with a fixed number of counters.
+// When the summary is full, a new key replaces the key with the minimal count and inherits
+// that count as its error. Every key with frequency greater than total / capacity is kept.
+class SpaceSavingCounters : boost::noncopyable {
+ public:
+  explicit SpaceSavingCounters(size_t capacity)
+      : capacity_(capacity > 0 ? capacity : 1)
+      , total_(0.0)
+      , key_to_entry_()
+      , count_to_key_() { }
+
+  void increase(const std::unordered_map<std::string, double>& key_to_value);
+
+  std::vector<std::pair<std::string, SpaceSavingEntry>> get_all() const;
+
+  size_t capacity() const { return capacity_; }
+
+  // approximate memory used by one counter including its key
+  static const size_t kEntrySize = 160;
+
+  // total weight of all increments
+  double total() const;
+
+  // max possible error of any count, 0 until the summary is full
+  double max_error() const;
+
+  size_t size() const;
+
+ private:
+  typedef std::multimap<double, const std::string*> CountToKey;
+
+  struct Item {
+    SpaceSavingEntry entry;
+    CountToKey::iterator count_iter;
+  };
+
+  void increase_unsafe(const std::string& key, double value);
+
+  mutable SpinLock lock_;
+  size_t capacity_;
+  double total_;
+  std::unordered_map<std::string, Item> key_to_entry_;
+  CountToKey count_to_key_;
+};
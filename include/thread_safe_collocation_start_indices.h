@@ -17,6 +17,10 @@ class ThreadSafeCollocationStartIndices : boost::noncopyable {
 
   size_t size() const;
 
+  const std::unordered_map<long, std::vector<int>>& get_all_unsafe() const {
+    return indices_;
+  }
+
  private:
   mutable SpinLock lock_;
   std::unordered_map<long, std::vector<int>> indices_;
@@ -13,12 +13,26 @@ class ThreadSafeCounters : boost::noncopyable {
  public:
   const double* get(int key) const;
 
+  // without locking, for passes that don't change counters
+  const double* get_unsafe(int key) const;
+
   void increase(int key, double value);
   void increase(const std::unordered_map<int, double>& key_to_value);
 
+  void erase(const std::vector<int>& keys);
+
+  // replaces each key below new_keys.size() with new_keys[key], new keys should be distinct
+  void remap_keys(const std::vector<int>& new_keys);
+
+  // replaces content with a copy of other counters, memory is allocated by the calling thread
+  void copy_from(const ThreadSafeCounters& other);
+
   size_t size() const;
   bool empty() const;
 
+  // estimation of memory used by hash table
+  size_t get_memory_usage() const;
+
   const std::unordered_map<int, double>& get_all_unsafe() const {
     return index_to_counter_;
   }
@@ -2,29 +2,97 @@
 
 #pragma once
 
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <string>
 #include <vector>
-#include <unordered_map>
 
 #include "boost/utility.hpp"
+#include "boost/utility/string_ref.hpp"
 
 #include "include/spinlock.h"
 
+// Each token is stored once: its characters are appended to the arena of large chunks, which
+// are never reallocated, so tokens returned by get_token stay valid while the dictionary grows.
+// Hash table of open addressing keeps only indices of tokens with 32-bit parts of their hashes.
 class ThreadSafeDictionary : boost::noncopyable {
  public:
+  ThreadSafeDictionary() : lock_(), chunks_(), entries_(), slots_(kInitialNumSlots, { 0, -1 }) { }
+
+  // returns nullptr if the token is absent, the pointer stays valid while the dictionary grows
   const int* get_index(const std::string& token) const;
-  const std::string* get_token(int index) const;
 
-  const int* get_index_unsafe(const std::string& token) const;
-  const std::string* get_token_unsafe(int index) const;
+  // returns empty token if the index is absent
+  boost::string_ref get_token(int index) const;
+
+  const int* get_index_unsafe(const std::string& token) const {
+    return get_index_unsafe(token, get_hash(token));
+  }
+
+  // hash should be computed by get_hash(token)
+  const int* get_index_unsafe(const std::string& token, uint32_t hash) const;
+  boost::string_ref get_token_unsafe(int index) const;
+
+  // load the first slot probed for the hash and then the entry it points to into cache, so
+  // get_index_unsafe() of the token doesn't wait for memory. The entry should be prefetched
+  // some time after the slot, when the slot is already in cache
+  void prefetch_slot(uint32_t hash) const {
+    __builtin_prefetch(&slots_[hash & (slots_.size() - 1)]);
+  }
+
+  void prefetch_entry(uint32_t hash) const {
+    int index = slots_[hash & (slots_.size() - 1)].index;
+    if (index >= 0) {
+      __builtin_prefetch(&entries_[index]);
+    }
+  }
+
+  static uint32_t get_hash(const std::string& token) {
+    return std::hash<std::string>()(token);
+  }
+
+  // returns index of the token, it is added if it is absent
+  int add(const std::string& token);
 
-  void add(const std::string& token);
+  // the same without the lock, for adding by one thread while other threads don't use the dictionary
+  int add_unsafe(const std::string& token);
+
+  // orders tokens with indices from first_index by is_less(index, other index), ties are ordered
+  // lexicographically, so their indices don't depend on the order of adding. Returns new indices
+  // of all tokens (the ones below first_index keep their indices), all pointers returned by get_index
+  // before are invalidated
+  std::vector<int> sort_tokens(int first_index, const std::function<bool(int, int)>& is_less);
+
+  // replaces content with a copy of other dictionary, memory is allocated by the calling thread
+  void copy_from(const ThreadSafeDictionary& other);
 
   size_t size() const;
   bool empty() const;
 
+  // estimation of memory used by tokens and hash table
+  size_t get_memory_usage() const;
+
  private:
+  struct Entry {
+    uint32_t chunk;
+    uint32_t position;
+    uint32_t size;
+    int index;
+  };
+
+  struct Slot {
+    uint32_t hash;
+    int index;  // -1 for empty slot
+  };
+
+  void add_slot(uint32_t hash, int index);
+
+  static const size_t kChunkSize = 1 << 20;
+  static const size_t kInitialNumSlots = 16;
+
   mutable SpinLock lock_;
-  std::unordered_map<std::string, int> token_to_index_;
-  std::vector<std::string> tokens_;
+  std::vector<std::vector<char>> chunks_;
+  std::deque<Entry> entries_;
+  std::vector<Slot> slots_;
 };
@@ -0,0 +1,57 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "include/spinlock.h"
+
+// significance scores of the merges which produced the collocation in documents
+struct ScoreStats {
+  float max_score;
+  float sum_score;
+};
+
+// statistics of one batch, the sum of scores is also kept in fixed point
+struct BatchScoreStats {
+  float max_score;
+  float sum_score;
+  int64_t fixed_point_sum_score;
+};
+
+// Score statistics of collocations, stored in array parallel to dictionary
+// (8 bytes per dictionary index), grows on demand. Float sums depend on the order of
+// batches, with exact sums the scores are summed in fixed point with 2^-20 precision
+// (8 more bytes per index): integer sums are the same for any order.
+class ThreadSafeScoreStats : boost::noncopyable {
+ public:
+  ThreadSafeScoreStats() : lock_(), index_to_stats_(), exact_sums_(false), index_to_fixed_point_sum_() { }
+
+  void set_exact_sums(bool exact_sums) {
+    exact_sums_ = exact_sums;
+  }
+
+  static int64_t to_fixed_point(float score) {
+    return std::llround(static_cast<double>(score) * kFixedPointScale);
+  }
+
+  void add(const std::unordered_map<int, BatchScoreStats>& index_to_stats);
+
+  // returns zero stats for collocations without recorded merges
+  ScoreStats get(int index) const;
+
+  size_t size() const;
+
+ private:
+  static constexpr double kFixedPointScale = 1 << 20;
+
+  mutable SpinLock lock_;
+  std::vector<ScoreStats> index_to_stats_;
+  bool exact_sums_;
+  std::vector<int64_t> index_to_fixed_point_sum_;
+};
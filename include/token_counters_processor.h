@@ -9,6 +9,7 @@
 
 #include "include/batch.h"
 #include "include/batch_processor.h"
+#include "include/document_deduplicator.h"
 #include "include/thread_safe_collocation_start_indices.h"
 #include "include/thread_safe_dictionary.h"
 #include "include/thread_safe_counters.h"
@@ -22,10 +23,29 @@ class TokenCountersProcessor : public BatchProcessor {
       : dictionary_(dictionary)
       , index_to_counter_(index_to_counter)
       , collocation_start_indices_(collocation_start_indices)
-      , total_collection_size_(total_collection_size) { }
+      , total_collection_size_(total_collection_size)
+      , deduplicator_(nullptr)
+      , index_to_df_(nullptr)
+      , num_documents_(nullptr)
+      , document_indices_() { }
 
   virtual std::shared_ptr<Batch> process(const Batch& batch);
 
+  // repeated documents are registered in deduplicator and get no start indices, so the next
+  // passes skip them, nullptr turns it off
+  void set_deduplicator(const std::shared_ptr<DocumentDeduplicator>& deduplicator) {
+    deduplicator_ = deduplicator;
+  }
+
+  // numbers of documents containing each token are counted into index_to_df, documents are
+  // counted into num_documents, nullptr turns it off
+  void set_document_frequencies(const std::shared_ptr<ThreadSafeCounters>& index_to_df,
+                                const std::shared_ptr<std::atomic<long>>& num_documents)
+  {
+    index_to_df_ = index_to_df;
+    num_documents_ = num_documents;
+  }
+
   virtual ~TokenCountersProcessor() { }
 
  private:
@@ -33,4 +53,9 @@ class TokenCountersProcessor : public BatchProcessor {
   std::shared_ptr<ThreadSafeCounters> index_to_counter_;
   std::shared_ptr<ThreadSafeCollocationStartIndices> collocation_start_indices_;
   std::shared_ptr<std::atomic<long>> total_collection_size_;
+  std::shared_ptr<DocumentDeduplicator> deduplicator_;
+  std::shared_ptr<ThreadSafeCounters> index_to_df_;
+  std::shared_ptr<std::atomic<long>> num_documents_;
+
+  std::vector<int> document_indices_;
 };
@@ -0,0 +1,37 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+// Tokens excluded from collocations: stop words and tokens out of the band of document
+// frequencies. The mask is filled after the pass of token counters and is only read by the
+// next passes, so it has no lock. Masked tokens never start or continue candidates, so
+// collocations with them are not counted and masked tokens split documents into parts.
+class TokenMask : boost::noncopyable {
+ public:
+  TokenMask() : is_masked_(), num_masked_(0) { }
+
+  void mask(int index);
+
+  // false for indices of collocations and tokens added after filling the mask
+  bool is_masked(int index) const {
+    return index >= 0 && index < is_masked_.size() && is_masked_[index];
+  }
+
+  // indices of masked tokens in increasing order
+  std::vector<int> get_masked_indices() const;
+
+  // number of masked tokens
+  size_t size() const { return num_masked_; }
+
+  // words of file are separated by whitespaces or line breaks
+  static std::vector<std::string> load_stop_words(const std::string& path);
+
+ private:
+  std::vector<bool> is_masked_;
+  size_t num_masked_;
+};
@@ -0,0 +1,54 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct TokenSpan {
+  TokenSpan(int _begin, int _length) : begin(_begin), length(_length) { }
+
+  int begin;
+  int length;
+};
+
+enum class TokenizerKernel {
+  kAuto,
+  kScalar,
+  kSse2,
+  kAvx2
+};
+
+// Splits lines into non-empty tokens separated by any number of delimiter chars. Lines are
+// scanned in 64-byte blocks: the kernel builds a bit mask of delimiter positions for the block
+// and token boundaries are taken from mask transitions, so no substrings are created.
+class Tokenizer {
+ public:
+  explicit Tokenizer(const std::string& delimiters, TokenizerKernel kernel = TokenizerKernel::kAuto);
+
+  // appends spans of all non-empty tokens of [data, data + size) to spans
+  void split(const char* data, size_t size, std::vector<TokenSpan>* spans) const;
+
+  // parses [data, data + size) as a signed decimal integer, returns false on malformed input
+  static bool parse_id(const char* data, size_t size, long* id);
+
+  static bool is_kernel_supported(TokenizerKernel kernel);
+
+  TokenizerKernel kernel() const { return kernel_; }
+
+  static const int kBlockSize = 64;
+  static const int kMaxSimdDelimiters = 8;
+
+ private:
+  typedef uint64_t (*BlockMaskFunction)(const char* block, const Tokenizer& tokenizer);
+
+  static uint64_t block_mask_scalar(const char* block, const Tokenizer& tokenizer);
+  static uint64_t block_mask_sse2(const char* block, const Tokenizer& tokenizer);
+  static uint64_t block_mask_avx2(const char* block, const Tokenizer& tokenizer);
+
+  std::string delimiters_;
+  bool is_delimiter_[256];
+  TokenizerKernel kernel_;
+  BlockMaskFunction block_mask_;
+};
@@ -0,0 +1,84 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+// C API of libtopmine for embedding without the command line tool. All functions return 0 on
+// success and -1 on error, the message of the last error of the calling thread is returned by
+// topmine_last_error(). A model is only read after training or loading, so it may be used by
+// concurrent calls of segmentation functions.
+
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define TOPMINE_API __declspec(dllexport)
+#else
+#define TOPMINE_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct topmine_model topmine_model;
+
+typedef struct topmine_options {
+  int collocation_max_size;
+  int threshold;
+  float alpha;
+  int num_threads;
+  int batch_size;
+  // chars separating tokens of text documents, tokens made of ids are separated by spaces
+  const char* delimiters;
+  // char joining tokens of collocations in the stored model
+  char esc_character;
+} topmine_options;
+
+// fills options with the defaults of the command line tool
+TOPMINE_API void topmine_options_init(topmine_options* options);
+
+// counts collocations of file or directory with the documents in lines
+TOPMINE_API int topmine_train_file(const char* input_path, const topmine_options* options, topmine_model** model);
+
+// counts collocations of documents made of token ids: tokens of document i are
+// token_ids[document_offsets[i]] ... token_ids[document_offsets[i + 1] - 1]
+TOPMINE_API int topmine_train_ids(const int32_t* token_ids,
+                                  const int64_t* document_offsets,
+                                  int64_t num_documents,
+                                  const topmine_options* options,
+                                  topmine_model** model);
+
+// reads model stored by topmine_store_model() or by '--counts-output-path' of the command line tool,
+// alpha and esc_character are taken from options
+TOPMINE_API int topmine_load_model(const char* path, const topmine_options* options, topmine_model** model);
+
+TOPMINE_API int topmine_store_model(const topmine_model* model, const char* path);
+
+// segments documents made of token ids (see topmine_train_ids) into spans of tokens and
+// collocations. Lengths of spans of document i are written into
+// span_lengths[span_offsets[i]] ... span_lengths[span_offsets[i + 1] - 1], so span_lengths needs
+// document_offsets[num_documents] elements at most and span_offsets needs num_documents + 1 ones.
+// Both buffers are owned by the caller, nothing is allocated for the output
+TOPMINE_API int topmine_segment_ids(const topmine_model* model,
+                                    const int32_t* token_ids,
+                                    const int64_t* document_offsets,
+                                    int64_t num_documents,
+                                    int32_t* span_lengths,
+                                    int64_t* span_offsets);
+
+// segments text documents split by delimiters of options the model was made with, output is
+// the same as of topmine_segment_ids, span_lengths_capacity is the number of its elements
+TOPMINE_API int topmine_segment_texts(const topmine_model* model,
+                                      const char* const* documents,
+                                      int64_t num_documents,
+                                      int32_t* span_lengths,
+                                      int64_t span_lengths_capacity,
+                                      int64_t* span_offsets);
+
+TOPMINE_API void topmine_free_model(topmine_model* model);
+
+// message of the last error of the calling thread, empty if there was no error
+TOPMINE_API const char* topmine_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,9 +2,34 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
+#include "include/batch.h"
 #include "include/parameters.h"
+#include "include/partial_counts.h"
+#include "include/thread_safe_counters.h"
+#include "include/thread_safe_dictionary.h"
+
+// counters of tokens and collocations of all sizes after the counting stages of full mode
+struct CollocationCounts {
+  PartialCountsHeader header;
+  std::shared_ptr<ThreadSafeDictionary> dictionary;
+  std::shared_ptr<ThreadSafeCounters> index_to_counter;
+};
 
 class TopmineImpl {
  public:
   static void run_topmine(const Parameters& parameters);
+
+  // runs only the counting stages of full mode and returns the counters, documents are taken
+  // from batches on every pass if it isn't nullptr (input_path isn't read then)
+  static CollocationCounts count_collocations(const Parameters& parameters,
+                                              const std::vector<std::shared_ptr<Batch>>* batches);
+
+ private:
+  // counts is filled after the counting stages and the scoring stage is skipped if it isn't nullptr
+  static void run_topmine(const Parameters& parameters,
+                          const std::vector<std::shared_ptr<Batch>>* batches,
+                          CollocationCounts* counts);
 };
@@ -0,0 +1,49 @@
+// Author: Murat Apishev (@mel-lain)
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "include/batch.h"
+#include "include/parameters.h"
+#include "include/scoring_processor.h"
+#include "include/topmine_impl.h"
+
+// Frozen counters of tokens and collocations used to segment documents in memory, e.g. by the
+// embedding code through C API. The model is only read after training or loading, so any number
+// of scoring processors created from it may segment documents concurrently.
+class TopmineModel : boost::noncopyable {
+ public:
+  TopmineModel(const CollocationCounts& counts, float alpha, char esc_character)
+      : counts_(counts)
+      , total_collection_size_(std::make_shared<std::atomic<long>>(counts.header.total_collection_size))
+      , alpha_(alpha)
+      , esc_character_(esc_character) { }
+
+  // counts collocations in full mode, documents are taken from batches if it isn't nullptr
+  static std::shared_ptr<TopmineModel> train(const Parameters& parameters,
+                                             const std::vector<std::shared_ptr<Batch>>* batches);
+
+  // reads model stored by store() or by '--counts-output-path' of the command line tool
+  static std::shared_ptr<TopmineModel> load(const std::string& path, float alpha, char esc_character);
+
+  void store(const std::string& path) const;
+
+  // processor used by one thread only, documents are segmented by its segment()
+  std::shared_ptr<ScoringProcessor> create_scoring_processor() const;
+
+  const PartialCountsHeader& get_header() const { return counts_.header; }
+
+  const std::shared_ptr<ThreadSafeDictionary>& get_dictionary() const { return counts_.dictionary; }
+
+ private:
+  CollocationCounts counts_;
+  std::shared_ptr<std::atomic<long>> total_collection_size_;
+  float alpha_;
+  char esc_character_;
+};
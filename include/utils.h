@@ -14,5 +14,11 @@ class Utils {
                                   int end_index,
                                   char separator);
 
+  // appends decimal representation of value to output without temporary strings
+  static void append_integer(long value, std::string* output);
+
+  // bytes allocated by the string outside of its object, 0 for short strings stored inline
+  static size_t get_heap_memory(const std::string& value);
+
   static long get_peak_memory_usage_kb();
 };
@@ -1,40 +1,102 @@
 // Author: Murat Apishev (@mel-lain)
 
-#include "boost/algorithm/string.hpp"
+#include <stdexcept>
+#include <utility>
 
 #include "include/batch.h"
+#include "include/utils.h"
 
 void Batch::add_document(const std::string& src_document) {
-  std::vector<std::string> parts;
-  boost::split(parts, src_document, boost::is_any_of(delimiters.c_str()));
+  token_spans_.clear();
+  tokenizer_.split(src_document.data(), src_document.size(), &token_spans_);
 
-  if (parts.size() < 2) {
+  if (token_spans_.size() < 2) {
     throw std::runtime_error("Error: empty or incomplete document string: " + src_document);
   }
 
-  long id = std::stol(parts[0]);
-  std::vector<std::string> tokens;
+  // id should be the very first element of the string
+  long id = 0L;
+  const auto& id_span = token_spans_[0];
+  if (id_span.begin != 0 || !Tokenizer::parse_id(src_document.data(), id_span.length, &id)) {
+    throw std::runtime_error("Error: invalid document id in string: " + src_document);
+  }
 
-  for (int i = 1; i < parts.size(); ++i) {
-    auto& token = parts[i];
-    if (token.empty()) {
-      continue;
+  start_document(id);
+  for (int i = 1; i < token_spans_.size(); ++i) {
+    if (has_boundaries_ && i > 1) {
+      // chars between tokens are delimiters or boundaries
+      const auto& prev_span = token_spans_[i - 1];
+      for (int position = prev_span.begin + prev_span.length; position < token_spans_[i].begin; ++position) {
+        if (is_boundary_[static_cast<unsigned char>(src_document[position])]) {
+          documents_[num_documents_ - 1].segment_starts.push_back(i - 1);
+          break;
+        }
+      }
     }
 
-    tokens.push_back(token);
+    add_token(src_document.data() + token_spans_[i].begin, token_spans_[i].length);
   }
+}
 
+void Batch::add_document(long id, const std::vector<std::string>& tokens) {
   if (tokens.empty()) {
-    throw std::runtime_error("Error: empty or incomplete document string-2: " + src_document);
+    throw std::runtime_error("Error: empty document with id " + std::to_string(id));
   }
 
-  documents_.push_back({ id, tokens });
+  start_document(id);
+  for (const auto& token : tokens) {
+    add_token(token.data(), token.size());
+  }
 }
 
-void Batch::add_document(long id, const std::vector<std::string>& tokens) {
-  if (tokens.empty()) {
-    throw std::runtime_error("Error: empty document with id " + std::to_string(id));
+void Batch::start_document(long id) {
+  if (num_documents_ == documents_.size()) {
+    documents_.emplace_back();
+  }
+
+  documents_[num_documents_].segment_starts.clear();
+  documents_[num_documents_++].id = id;
+}
+
+void Batch::add_token(const char* data, size_t size) {
+  auto& tokens = documents_[num_documents_ - 1].tokens;
+
+  if (free_tokens_.empty()) {
+    tokens.emplace_back(data, size);
+  } else {
+    tokens.push_back(std::move(free_tokens_.back()));
+    free_tokens_.pop_back();
+    tokens.back().assign(data, size);
+  }
+}
+
+size_t Batch::get_memory_usage() const {
+  size_t memory_usage = sizeof(Batch) + documents_.capacity() * sizeof(Document);
+
+  for (const auto& document : documents_) {
+    memory_usage += document.tokens.capacity() * sizeof(std::string) + document.segment_starts.capacity() * sizeof(int);
+    for (const auto& token : document.tokens) {
+      memory_usage += Utils::get_heap_memory(token);
+    }
+  }
+
+  memory_usage += free_tokens_.capacity() * sizeof(std::string);
+  for (const auto& token : free_tokens_) {
+    memory_usage += Utils::get_heap_memory(token);
+  }
+
+  return memory_usage;
+}
+
+void Batch::clear() {
+  for (int i = 0; i < num_documents_; ++i) {
+    auto& tokens = documents_[i].tokens;
+    for (auto& token : tokens) {
+      free_tokens_.push_back(std::move(token));
+    }
+    tokens.clear();
   }
 
-  documents_.push_back({ id, tokens });
+  num_documents_ = 0;
+  sequence_number_ = 0;
 }
@@ -0,0 +1,303 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "include/checkpoint.h"
+
+namespace {
+  const size_t kBufferSize = 1 << 20;
+
+  template <typename T>
+  void write_value(T value, std::ofstream* output_stream) {
+    output_stream->write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void write_string(boost::string_ref value, std::ofstream* output_stream) {
+    write_value<uint32_t>(value.size(), output_stream);
+    output_stream->write(value.data(), value.size());
+  }
+
+  // content of file mapped into memory, or read into buffer if mapping isn't possible
+  class FileContent : boost::noncopyable {
+   public:
+    explicit FileContent(const std::string& path) : data_(nullptr), size_(0), mapping_(nullptr), buffer_() {
+      int descriptor = open(path.c_str(), O_RDONLY);
+      if (descriptor < 0) {
+        throw std::runtime_error("Error: unable to open checkpoint file: " + path);
+      }
+
+      struct stat file_stat;
+      if (fstat(descriptor, &file_stat) == 0 && file_stat.st_size > 0) {
+        size_ = file_stat.st_size;
+        void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping != MAP_FAILED) {
+          mapping_ = mapping;
+          madvise(mapping_, size_, MADV_SEQUENTIAL);
+          data_ = static_cast<const char*>(mapping_);
+        }
+      }
+      close(descriptor);
+
+      if (mapping_ == nullptr) {
+        std::ifstream input_stream(path, std::ios::binary);
+        buffer_.assign(std::istreambuf_iterator<char>(input_stream), std::istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+      }
+    }
+
+    ~FileContent() {
+      if (mapping_ != nullptr) {
+        munmap(mapping_, size_);
+      }
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+   private:
+    const char* data_;
+    size_t size_;
+    void* mapping_;
+    std::vector<char> buffer_;
+  };
+
+  class ContentReader {
+   public:
+    ContentReader(const FileContent& content, const std::string& path)
+        : position_(content.data())
+        , end_(content.data() + content.size())
+        , path_(path) { }
+
+    template <typename T>
+    T read_value() {
+      check_size(sizeof(T));
+
+      T value;
+      std::memcpy(&value, position_, sizeof(T));
+      position_ += sizeof(T);
+      return value;
+    }
+
+    std::string read_string() {
+      uint32_t size = read_value<uint32_t>();
+      check_size(size);
+
+      std::string value(position_, size);
+      position_ += size;
+      return value;
+    }
+
+    void skip(size_t size) {
+      check_size(size);
+      position_ += size;
+    }
+
+   private:
+    void check_size(size_t size) const {
+      if (static_cast<size_t>(end_ - position_) < size) {
+        throw std::runtime_error("Error: truncated checkpoint file: " + path_);
+      }
+    }
+
+    const char* position_;
+    const char* end_;
+    std::string path_;
+  };
+}  // namespace
+
+const char* const Checkpoint::kSignature = "topmine-checkpoint-6";
+
+void Checkpoint::store(const std::string& path,
+                       const CheckpointHeader& header,
+                       const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                       const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                       const std::shared_ptr<ThreadSafeCollocationStartIndices>& collocation_start_indices,
+                       const std::shared_ptr<DocumentDeduplicator>& deduplicator,
+                       const std::shared_ptr<TokenMask>& token_mask)
+{
+  // the previous checkpoint stays valid until the new one is completely written
+  std::string temporary_path = path + ".tmp";
+
+  std::vector<char> buffer(kBufferSize);
+  std::ofstream output_stream;
+  output_stream.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+  output_stream.open(temporary_path, std::ios::binary);
+  if (!output_stream.is_open()) {
+    throw std::runtime_error("Error: unable to open checkpoint file: " + temporary_path);
+  }
+
+  output_stream.write(kSignature, std::strlen(kSignature));
+  write_value<int32_t>(header.num_finished_stages, &output_stream);
+  write_value<int64_t>(header.total_collection_size, &output_stream);
+  write_value<int32_t>(header.collocation_max_size, &output_stream);
+  write_value<int32_t>(header.collocation_sizes_per_pass, &output_stream);
+  write_value<int32_t>(header.heavy_hitters_memory_mb, &output_stream);
+  write_value<uint8_t>(header.heavy_hitters_verify, &output_stream);
+  write_value<int64_t>(header.threshold, &output_stream);
+  write_value<uint8_t>(header.dedup, &output_stream);
+  write_value<uint8_t>(header.token_filter, &output_stream);
+  write_string(header.stop_words_path, &output_stream);
+  write_value<int32_t>(header.min_unigram_df, &output_stream);
+  write_value<float>(header.max_unigram_ratio, &output_stream);
+  write_value<int64_t>(header.input_size, &output_stream);
+  write_string(header.delimiters, &output_stream);
+  write_value<char>(header.esc_character, &output_stream);
+  write_value<uint8_t>(header.deterministic, &output_stream);
+  write_string(header.boundaries, &output_stream);
+
+  uint64_t dictionary_size = dictionary->size();
+  write_value<uint64_t>(dictionary_size, &output_stream);
+  for (uint64_t index = 0; index < dictionary_size; ++index) {
+    write_string(dictionary->get_token_unsafe(index), &output_stream);
+  }
+
+  const auto& counters = index_to_counter->get_all_unsafe();
+  write_value<uint64_t>(counters.size(), &output_stream);
+  for (const auto& index_counter : counters) {
+    write_value<int32_t>(index_counter.first, &output_stream);
+    write_value<double>(index_counter.second, &output_stream);
+  }
+
+  const auto& start_indices = collocation_start_indices->get_all_unsafe();
+  write_value<uint64_t>(start_indices.size(), &output_stream);
+  for (const auto& id_indices : start_indices) {
+    write_value<int64_t>(id_indices.first, &output_stream);
+    write_value<uint32_t>(id_indices.second.size(), &output_stream);
+    output_stream.write(reinterpret_cast<const char*>(id_indices.second.data()),
+                        id_indices.second.size() * sizeof(int));
+  }
+
+  if (deduplicator != nullptr) {
+    write_value<int64_t>(deduplicator->get_num_documents(), &output_stream);
+    write_value<int64_t>(deduplicator->get_num_unique_documents(), &output_stream);
+
+    write_value<uint64_t>(deduplicator->get_num_repeated_documents(), &output_stream);
+    deduplicator->for_each_repeated([&](const DocumentHash& hash, long first_id, long num_copies) {
+      write_value<uint64_t>(hash.first, &output_stream);
+      write_value<uint64_t>(hash.second, &output_stream);
+      write_value<int64_t>(first_id, &output_stream);
+      write_value<int64_t>(num_copies, &output_stream);
+    });
+  }
+
+  if (token_mask != nullptr) {
+    auto masked_indices = token_mask->get_masked_indices();
+    write_value<uint64_t>(masked_indices.size(), &output_stream);
+    output_stream.write(reinterpret_cast<const char*>(masked_indices.data()), masked_indices.size() * sizeof(int));
+  }
+
+  output_stream.close();
+  if (output_stream.fail()) {
+    throw std::runtime_error("Error: unable to write checkpoint file: " + temporary_path);
+  }
+
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Error: unable to replace checkpoint file: " + path);
+  }
+}
+
+CheckpointHeader Checkpoint::load(const std::string& path,
+                                  const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                                  const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                                  const std::shared_ptr<ThreadSafeCollocationStartIndices>& collocation_start_indices,
+                                  const std::shared_ptr<DocumentDeduplicator>& deduplicator,
+                                  const std::shared_ptr<TokenMask>& token_mask)
+{
+  FileContent content(path);
+  ContentReader reader(content, path);
+
+  size_t signature_size = std::strlen(kSignature);
+  if (content.size() < signature_size || std::memcmp(content.data(), kSignature, signature_size) != 0) {
+    throw std::runtime_error("Error: invalid header of checkpoint file: " + path);
+  }
+  reader.skip(signature_size);
+
+  CheckpointHeader header;
+  header.num_finished_stages = reader.read_value<int32_t>();
+  header.total_collection_size = reader.read_value<int64_t>();
+  header.collocation_max_size = reader.read_value<int32_t>();
+  header.collocation_sizes_per_pass = reader.read_value<int32_t>();
+  header.heavy_hitters_memory_mb = reader.read_value<int32_t>();
+  header.heavy_hitters_verify = reader.read_value<uint8_t>();
+  header.threshold = reader.read_value<int64_t>();
+  header.dedup = reader.read_value<uint8_t>();
+  header.token_filter = reader.read_value<uint8_t>();
+  header.stop_words_path = reader.read_string();
+  header.min_unigram_df = reader.read_value<int32_t>();
+  header.max_unigram_ratio = reader.read_value<float>();
+  header.input_size = reader.read_value<int64_t>();
+  header.delimiters = reader.read_string();
+  header.esc_character = reader.read_value<char>();
+  header.deterministic = reader.read_value<uint8_t>();
+  header.boundaries = reader.read_string();
+
+  if (header.dedup != (deduplicator != nullptr)) {
+    throw std::runtime_error("Error: checkpoint was made with other value of dedup: " + path);
+  }
+
+  if (header.token_filter != (token_mask != nullptr)) {
+    throw std::runtime_error("Error: checkpoint was made with other token filtering: " + path);
+  }
+
+  // indices of tokens are restored by adding them in order into empty dictionary
+  uint64_t dictionary_size = reader.read_value<uint64_t>();
+  for (uint64_t index = 0; index < dictionary_size; ++index) {
+    dictionary->add(reader.read_string());
+  }
+
+  uint64_t num_counters = reader.read_value<uint64_t>();
+  for (uint64_t i = 0; i < num_counters; ++i) {
+    int32_t index = reader.read_value<int32_t>();
+    index_to_counter->increase(index, reader.read_value<double>());
+  }
+
+  uint64_t num_documents = reader.read_value<uint64_t>();
+  std::vector<int> indices;
+  for (uint64_t i = 0; i < num_documents; ++i) {
+    int64_t document_id = reader.read_value<int64_t>();
+
+    indices.resize(reader.read_value<uint32_t>());
+    for (auto& index : indices) {
+      index = reader.read_value<int32_t>();
+    }
+    collocation_start_indices->add_indices(document_id, indices);
+  }
+
+  if (deduplicator != nullptr) {
+    int64_t num_documents = reader.read_value<int64_t>();
+    int64_t num_unique_documents = reader.read_value<int64_t>();
+    deduplicator->set_num_documents(num_documents, num_unique_documents);
+
+    uint64_t num_repeated = reader.read_value<uint64_t>();
+    for (uint64_t i = 0; i < num_repeated; ++i) {
+      DocumentHash hash;
+      hash.first = reader.read_value<uint64_t>();
+      hash.second = reader.read_value<uint64_t>();
+      int64_t first_id = reader.read_value<int64_t>();
+      deduplicator->add_repeated(hash, first_id, reader.read_value<int64_t>());
+    }
+  }
+
+  if (token_mask != nullptr) {
+    uint64_t num_masked = reader.read_value<uint64_t>();
+    for (uint64_t i = 0; i < num_masked; ++i) {
+      token_mask->mask(reader.read_value<int32_t>());
+    }
+  }
+
+  return header;
+}
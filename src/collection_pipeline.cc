@@ -0,0 +1,118 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <fstream>
+#include <stdexcept>
+
+#include "boost/thread/locks.hpp"
+
+#include "include/collection_pipeline.h"
+
+CollectionPipeline::CollectionPipeline(const std::string& input_path,
+                                       const std::string& delimiters,
+                                       int batch_size,
+                                       int num_parser_threads,
+                                       BoundedQueue<std::shared_ptr<Batch>>* batch_queue,
+                                       BatchPool* batch_pool)
+    : input_path_(input_path)
+    , delimiters_(delimiters)
+    , batch_size_(batch_size)
+    , batch_queue_(batch_queue)
+    , batch_pool_(batch_pool)
+    , lines_queue_(2 * num_parser_threads)
+    , num_active_parsers_(num_parser_threads)
+    , error_lock_()
+    , error_message_()
+    , threads_()
+{
+  threads_.create_thread(boost::bind(&CollectionPipeline::reader_function, this));
+  for (int i = 0; i < num_parser_threads; ++i) {
+    threads_.create_thread(boost::bind(&CollectionPipeline::parser_function, this));
+  }
+}
+
+CollectionPipeline::~CollectionPipeline() {
+  lines_queue_.close();
+  threads_.join_all();
+}
+
+void CollectionPipeline::join() {
+  threads_.join_all();
+
+  boost::lock_guard<SpinLock> guard(error_lock_);
+  if (!error_message_.empty()) {
+    throw std::runtime_error(error_message_);
+  }
+}
+
+void CollectionPipeline::reader_function() {
+  try {
+    std::ifstream input_stream(input_path_);
+    if (!input_stream.is_open()) {
+      throw std::runtime_error("Error: unable to open input file: " + input_path_);
+    }
+
+    long num_portions = 0;
+    auto lines = std::make_shared<Lines>();
+    lines->sequence_number = num_portions++;
+    lines->lines.reserve(batch_size_);
+
+    std::string str;
+    while (std::getline(input_stream, str)) {
+      lines->lines.push_back(std::move(str));
+
+      if (lines->lines.size() >= batch_size_) {
+        if (!lines_queue_.push(lines)) {
+          break;
+        }
+
+        lines = std::make_shared<Lines>();
+        lines->sequence_number = num_portions++;
+        lines->lines.reserve(batch_size_);
+      }
+    }
+
+    if (!lines->lines.empty()) {
+      lines_queue_.push(lines);
+    }
+
+    lines_queue_.close();
+  } catch (std::exception& e) {
+    abort(e.what());
+  }
+}
+
+void CollectionPipeline::parser_function() {
+  try {
+    std::shared_ptr<Lines> lines;
+    while (lines_queue_.pop(&lines)) {
+      auto batch = batch_pool_->acquire();
+      batch->set_sequence_number(lines->sequence_number);
+      for (const auto& line : lines->lines) {
+        batch->add_document(line);
+      }
+
+      if (!batch_queue_->push(batch)) {
+        break;
+      }
+    }
+  } catch (std::exception& e) {
+    abort(e.what());
+  }
+
+  // the last parser tells the workers that there will be no more batches
+  if (--num_active_parsers_ == 0) {
+    batch_queue_->close();
+  }
+}
+
+void CollectionPipeline::abort(const std::string& error_message) {
+  {
+    boost::lock_guard<SpinLock> guard(error_lock_);
+    if (error_message_.empty()) {
+      error_message_ = error_message;
+    }
+  }
+
+  lines_queue_.close();
+  batch_queue_->close();
+}
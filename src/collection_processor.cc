@@ -1,17 +1,80 @@
 // Author: Murat Apishev (@mel-lain)
 
+#include <fnmatch.h>
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 
+#include "boost/filesystem.hpp"
 #include "boost/thread/locks.hpp"
 
+#include "include/collection_pipeline.h"
 #include "include/collection_processor.h"
+#include "include/compressed_input_reader.h"
+
+namespace {
+  void write_batch_output(const std::shared_ptr<Batch>& processed_batch,
+                          const std::string* serialized_output,
+                          char delimiter,
+                          std::ostream* output_stream)
+  {
+    if (serialized_output != nullptr) {
+      output_stream->write(serialized_output->data(), serialized_output->size());
+    }
+
+    if (processed_batch != nullptr) {
+      for (const auto& document : processed_batch->get_documents()) {
+        (*output_stream) << document.id;
+        for (const auto& token : document.tokens) {
+          (*output_stream) << delimiter << token;
+        }
+        (*output_stream) << '\n';
+      }
+    }
+  }
+}  // namespace
 
 void CollectionProcessorThread::thread_function() {
   try {
+    if (cpu_ >= 0 && !NumaTopology::pin_current_thread(cpu_)) {
+      std::cerr << "Warning: unable to pin thread to CPU " << cpu_ << std::endl;
+    }
+
     while (true) {
       std::shared_ptr<Batch> batch;
-      if (input_stream_ == nullptr) {
+      if (batch_queue_ != nullptr) {
+        if (!batch_queue_->pop(&batch)) {
+          break;
+        }
+
+        if (use_cache_) {
+          boost::lock_guard<SpinLock> guard(*read_access_lock_);
+          data_cache_->push_back(batch);
+        }
+      } else if (input_shards_ != nullptr) {
+        if (input_shards_->is_sequential) {
+          boost::lock_guard<SpinLock> guard(*read_access_lock_);
+
+          batch = read_shards_batch(&input_shards_->stream, &input_shards_->stream_index);
+          if (batch != nullptr) {
+            batch->set_sequence_number((*num_read_batches_)++);
+          }
+        } else {
+          batch = read_shards_batch(&shard_stream_, &shard_index_);
+        }
+
+        if (batch == nullptr) {
+          break;
+        }
+
+        if (use_cache_) {
+          boost::lock_guard<SpinLock> guard(*read_access_lock_);
+          data_cache_->push_back(batch);
+        }
+      } else if (input_stream_ == nullptr) {
         {
           boost::lock_guard<SpinLock> guard(*read_access_lock_);
 
@@ -22,14 +85,16 @@ void CollectionProcessorThread::thread_function() {
           batch = (*data_cache_)[(*cache_top_index_)++];
         }
       } else {
-        batch.reset(new Batch(delimiters_));
+        batch = batch_pool_->acquire();
         {
           boost::lock_guard<SpinLock> guard(*read_access_lock_);
 
           if (input_stream_->eof()) {
+            batch_pool_->release(batch);
             break;
           }
 
+          batch->set_sequence_number((*num_read_batches_)++);
           while (batch->size() < batch_size_) {
             std::string str;
             std::getline(*input_stream_, str);
@@ -48,17 +113,14 @@ void CollectionProcessorThread::thread_function() {
       }
 
       auto processed_batch = batch_processor_->process(*batch);
+      const auto* serialized_output = batch_processor_->get_serialized_output();
 
-      if (processed_batch != nullptr && output_stream_ != nullptr) {
-        boost::lock_guard<SpinLock> guard(*write_access_lock_);
+      if (output_stream_ != nullptr) {
+        write_output(batch->get_sequence_number(), processed_batch, serialized_output);
+      }
 
-        for (const auto& document : processed_batch->get_documents()) {
-          (*output_stream_) << document.id;
-          for (const auto& token : document.tokens) {
-            (*output_stream_) << delimiters_[0] << token;
-          }
-          (*output_stream_) << std::endl;
-        }
+      if (!use_cache_) {
+        batch_pool_->release(batch);
       }
     }
 
@@ -71,34 +133,230 @@ void CollectionProcessorThread::thread_function() {
   }
 }
 
+void CollectionProcessorThread::write_output(long sequence_number,
+                                             const std::shared_ptr<Batch>& processed_batch,
+                                             const std::string* serialized_output)
+{
+  {
+    boost::lock_guard<SpinLock> guard(*write_access_lock_);
+
+    if (pending_outputs_ == nullptr || sequence_number == pending_outputs_->next_sequence_number) {
+      write_batch_output(processed_batch, serialized_output, delimiters_[0], output_stream_);
+      if (pending_outputs_ != nullptr) {
+        ++pending_outputs_->next_sequence_number;
+        write_pending_outputs();
+      }
+      return;
+    }
+  }
+
+  // the output is copied outside of the lock, the previous batches may be written meanwhile
+  std::string output;
+  if (serialized_output != nullptr && processed_batch == nullptr) {
+    output = *serialized_output;
+  } else {
+    std::ostringstream output_stream;
+    write_batch_output(processed_batch, serialized_output, delimiters_[0], &output_stream);
+    output = output_stream.str();
+  }
+
+  boost::lock_guard<SpinLock> guard(*write_access_lock_);
+  pending_outputs_->outputs.emplace(sequence_number, std::move(output));
+  write_pending_outputs();
+}
+
+void CollectionProcessorThread::write_pending_outputs() {
+  auto& outputs = pending_outputs_->outputs;
+  while (!outputs.empty() && outputs.begin()->first == pending_outputs_->next_sequence_number) {
+    output_stream_->write(outputs.begin()->second.data(), outputs.begin()->second.size());
+    outputs.erase(outputs.begin());
+    ++pending_outputs_->next_sequence_number;
+  }
+}
+
+std::shared_ptr<Batch> CollectionProcessorThread::read_shards_batch(std::shared_ptr<std::istream>* shard_stream,
+                                                                    size_t* shard_index)
+{
+  auto batch = batch_pool_->acquire();
+
+  while (batch->size() < batch_size_) {
+    if (*shard_stream == nullptr) {
+      *shard_index = input_shards_->next_index++;
+      if (*shard_index >= input_shards_->paths.size()) {
+        break;
+      }
+
+      *shard_stream = CompressedInputReader::open_input_stream(input_shards_->paths[*shard_index]);
+    }
+
+    std::string str;
+    if (!std::getline(**shard_stream, str)) {
+      shard_stream->reset();
+      continue;
+    }
+
+    batch->add_document(str);
+    ++input_shards_->num_documents[*shard_index];
+  }
+
+  if (batch->size() == 0) {
+    batch_pool_->release(batch);
+    return nullptr;
+  }
+
+  return batch;
+}
+
+size_t CollectionProcessor::get_cache_memory_usage() const {
+  size_t memory_usage = data_cache_.capacity() * sizeof(std::shared_ptr<Batch>);
+  for (const auto& batch : data_cache_) {
+    memory_usage += batch->get_memory_usage();
+  }
+
+  return memory_usage;
+}
+
+std::vector<std::string> CollectionProcessor::list_input_files(const std::string& input_path) {
+  namespace fs = boost::filesystem;
+
+  std::vector<std::string> input_files;
+
+  if (!input_path.empty() && input_path[0] == '@') {
+    std::ifstream list_stream(input_path.substr(1));
+    if (!list_stream.is_open()) {
+      throw std::runtime_error("Error: unable to open file with input paths: " + input_path.substr(1));
+    }
+
+    std::string str;
+    while (std::getline(list_stream, str)) {
+      if (!str.empty()) {
+        input_files.push_back(str);
+      }
+    }
+  } else if (fs::is_directory(input_path)) {
+    for (fs::recursive_directory_iterator iter(input_path), end; iter != end; ++iter) {
+      if (fs::is_regular_file(iter->path()) && iter->path().filename().string()[0] != '.') {
+        input_files.push_back(iter->path().string());
+      }
+    }
+  } else if (input_path.find_first_of("*?[") != std::string::npos) {
+    fs::path pattern_path(input_path);
+    fs::path directory = pattern_path.has_parent_path() ? pattern_path.parent_path() : fs::path(".");
+    std::string pattern = pattern_path.filename().string();
+
+    if (fs::is_directory(directory)) {
+      for (fs::directory_iterator iter(directory), end; iter != end; ++iter) {
+        if (fs::is_regular_file(iter->path()) &&
+            fnmatch(pattern.c_str(), iter->path().filename().string().c_str(), FNM_PERIOD) == 0) {
+          input_files.push_back(iter->path().string());
+        }
+      }
+    }
+  } else if (fs::exists(input_path)) {
+    input_files.push_back(input_path);
+  }
+
+  if (input_files.empty()) {
+    throw std::runtime_error("Error: no input files found for input path: " + input_path);
+  }
+
+  std::sort(input_files.begin(), input_files.end());
+  return input_files;
+}
+
 void CollectionProcessor::process(const std::vector<BatchProcessor*>& batch_processors) {
   std::shared_ptr<std::ifstream> input_stream = nullptr;
   std::shared_ptr<std::ofstream> output_stream = nullptr;
 
+  // compressed input is read by a separate decompression stage, plain input
+  // may be read and parsed by a separate pipeline
+  std::shared_ptr<BoundedQueue<std::shared_ptr<Batch>>> batch_queue = nullptr;
+  std::shared_ptr<CompressedInputReader> compressed_input_reader = nullptr;
+  std::shared_ptr<CollectionPipeline> collection_pipeline = nullptr;
+
   try {
+    queue_stats_.clear();
+
+    if (batch_pools_.empty()) {
+      // enough for the batches in the queue, in processing and in reading stages
+      for (int node = 0; node < numa_topology_.num_nodes(); ++node) {
+        batch_pools_.push_back(std::make_shared<BatchPool>(delimiters_, boundaries_, 4 * batch_processors.size() + 2));
+      }
+    }
+
+    InputShards* input_shards = nullptr;
     if (!use_cache_ || data_cache_.empty()) {
-      input_stream.reset(new std::ifstream(input_path_));
+      if (input_shards_.paths.empty()) {
+        input_shards_.paths = list_input_files(input_path_);
+      }
+
+      // a single file is read by all threads, several files are distributed between threads
+      bool is_sharded = input_shards_.paths.size() > 1;
+      const auto& input_path = input_shards_.paths[0];
+
+      if (is_sharded) {
+        input_shards_.num_documents.assign(input_shards_.paths.size(), 0L);
+        input_shards_.next_index = 0;
+        input_shards_.is_sequential = deterministic_;
+        input_shards_.stream.reset();
+        input_shards = &input_shards_;
+      } else if (CompressedInputReader::detect_compression(input_path) == CompressionType::kNone) {
+        if (num_parser_threads_ > 0) {
+          batch_queue.reset(new BoundedQueue<std::shared_ptr<Batch>>(2 * batch_processors.size()));
+          collection_pipeline.reset(new CollectionPipeline(input_path,
+                                                           delimiters_,
+                                                           batch_size_,
+                                                           num_parser_threads_,
+                                                           batch_queue.get(),
+                                                           batch_pools_[0].get()));
+        } else {
+          input_stream.reset(new std::ifstream(input_path));
+        }
+      } else {
+        batch_queue.reset(new BoundedQueue<std::shared_ptr<Batch>>(2 * batch_processors.size()));
+        compressed_input_reader.reset(new CompressedInputReader(input_path,
+                                                                delimiters_,
+                                                                batch_size_,
+                                                                num_decompression_threads_,
+                                                                batch_queue.get(),
+                                                                batch_pools_[0].get()));
+      }
     }
 
+    std::shared_ptr<PendingOutputs> pending_outputs = nullptr;
     if (output_path_ != nullptr) {
-      output_stream.reset(new std::ofstream(*output_path_));
+      output_stream.reset(new std::ofstream(*output_path_, std::ios::binary));
+      if (deterministic_) {
+        pending_outputs = std::make_shared<PendingOutputs>();
+      }
     }
 
     long cache_top_index = 0L;
+    long num_read_batches = 0L;
     std::vector<std::shared_ptr<CollectionProcessorThread>> threads;
 
-    for (const auto& processor : batch_processors) {
+    for (int thread_id = 0; thread_id < batch_processors.size(); ++thread_id) {
+      // batches from queue come from the pool of the producer
+      int cpu = get_worker_cpu(thread_id);
+      int node = cpu >= 0 && batch_queue == nullptr ? numa_topology_.get_cpu_node(cpu) : 0;
+
       threads.push_back(std::shared_ptr<CollectionProcessorThread>(
-        new CollectionProcessorThread(processor,
+        new CollectionProcessorThread(batch_processors[thread_id],
                                       input_stream.get(),
+                                      batch_queue.get(),
+                                      input_shards,
+                                      batch_pools_[node].get(),
                                       output_stream.get(),
+                                      pending_outputs.get(),
                                       &read_access_lock_,
                                       &write_access_lock_,
                                       &data_cache_,
                                       &cache_top_index,
+                                      &num_read_batches,
                                       delimiters_,
                                       batch_size_,
-                                      use_cache_)));
+                                      use_cache_,
+                                      cpu)));
     }
 
     while (true) {
@@ -116,11 +374,30 @@ void CollectionProcessor::process(const std::vector<BatchProcessor*>& batch_proc
       usleep(2000);
     }
 
+    if (compressed_input_reader != nullptr) {
+      batch_queue->close();
+      compressed_input_reader->join();
+    }
+
+    if (collection_pipeline != nullptr) {
+      batch_queue->close();
+      collection_pipeline->join();
+      queue_stats_.push_back(std::make_pair("lines", collection_pipeline->get_lines_queue_stats()));
+    }
+
+    if (batch_queue != nullptr) {
+      queue_stats_.push_back(std::make_pair("batches", batch_queue->get_stats()));
+    }
+
     if (output_stream != nullptr) {
       output_stream->close();
     }
   } catch (std::exception& e) {
-    if (input_stream->is_open()) {
+    if (batch_queue != nullptr) {
+      batch_queue->close();
+    }
+
+    if (input_stream != nullptr && input_stream->is_open()) {
       input_stream->close();
     }
 
@@ -1,23 +1,39 @@
 // Author: Murat Apishev (@mel-lain)
 
+#include <algorithm>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
 #include "boost/range/algorithm_ext/push_back.hpp"
 #include "boost/range/irange.hpp"
+#include "boost/thread/locks.hpp"
 
 #include "include/collocations_processor.h"
 #include "include/utils.h"
 
+namespace {
+  struct HashedCount {
+    size_t hash;
+    const std::string* collocation;
+    long count;
+  };
+}  // namespace
+
 std::shared_ptr<Batch> CollocationsProcessor::process(const Batch& batch) {
   std::unordered_map<int, double> index_to_counter_local;
+  std::unordered_map<std::string, double> collocation_to_counter_local;
 
   for (const auto& document : batch.get_documents()) {
     std::vector<int> next_indices;
-    std::unordered_set<int> next_indices_set;
+    // repeated copies have no start indices, the first copy is counted for all of them
+    const long weight = deduplicator_ != nullptr ? deduplicator_->get_num_copies(document.id) : 1;
 
     std::vector<int> indices;
-    if (collocation_size_ == 2) {  // special case on first launch
+    if (verification_) {  // start indices were already filtered on the approximate pass
+      next_indices = collocation_start_indices_->get_indices(document.id);
+    } else if (scan_all_positions_) {
+      boost::push_back(indices, boost::irange(0, static_cast<int>(document.tokens.size())));
+    } else if (first_collocation_size_ == 2) {  // special case on first launch
       const auto& document_length = collocation_start_indices_->get_indices(document.id);
 
       if (document_length.empty()) {
@@ -30,43 +46,231 @@ std::shared_ptr<Batch> CollocationsProcessor::process(const Batch& batch) {
     }
 
     for (const auto& index : indices) {
-      if (index + collocation_size_ - 2 >= document.tokens.size()) {
+      if (index + first_collocation_size_ - 2 >= document.get_segment_end(index)) {
         continue;
       }
 
-      auto collocation = Utils::join_strings(document.tokens, index, index + collocation_size_ - 1, esc_character_);
+      auto collocation = Utils::join_strings(document.tokens,
+                                             index,
+                                             index + first_collocation_size_ - 1,
+                                             esc_character_);
 
-      const int* collocation_index_ptr = dictionary_->get_index(collocation);
-      if (collocation_index_ptr != nullptr) {
-        const auto counter_ptr = index_to_counter_->get(*collocation_index_ptr);
+      const int* collocation_index_ptr = phrase_counters_ != nullptr ? dictionary_->get_index_unsafe(collocation)
+                                                                      : dictionary_->get_index(collocation);
+      // indices of collocations are never masked, so only tokens of the first pass are checked
+      if (collocation_index_ptr != nullptr &&
+          (token_mask_ == nullptr || !token_mask_->is_masked(*collocation_index_ptr))) {
+        const auto counter_ptr = phrase_counters_ != nullptr ? index_to_counter_->get_unsafe(*collocation_index_ptr)
+                                                             : index_to_counter_->get(*collocation_index_ptr);
         if (counter_ptr != nullptr && *counter_ptr >= threshold_) {
           next_indices.push_back(index);
-          next_indices_set.insert(index);
         }
       }
     }
 
-    collocation_start_indices_->add_indices(document.id, next_indices);
+    if (!verification_) {
+      collocation_start_indices_->add_indices(document.id, next_indices);
+    }
+
     if (next_indices.empty()) {
       continue;
     }
 
-    for (const auto& index : next_indices) {
-      auto iter = next_indices_set.find(index + 1);
-      if (iter == next_indices_set.end()) {
+    // number of consecutive frequent start positions beginning with each one
+    std::vector<int> run_lengths(next_indices.size(), 1);
+    for (int i = static_cast<int>(next_indices.size()) - 2; i >= 0; --i) {
+      if (next_indices[i + 1] == next_indices[i] + 1) {
+        run_lengths[i] = run_lengths[i + 1] + 1;
+      }
+    }
+
+    for (int i = 0; i < next_indices.size(); ++i) {
+      // collocation of size s starting at index is a candidate if sub-collocations
+      // of size (first - 1) starting at index, ..., index + s - first + 1 are frequent
+      // and it doesn't cross the end of segment
+      int index = next_indices[i];
+      int max_collocation_size = std::min(last_collocation_size_, first_collocation_size_ + run_lengths[i] - 2);
+      max_collocation_size = std::min(max_collocation_size, document.get_segment_end(index) - index);
+      if (max_collocation_size < first_collocation_size_) {
         continue;
       }
 
-      auto collocation = Utils::join_strings(document.tokens, index, index + collocation_size_, esc_character_);
+      auto collocation = Utils::join_strings(document.tokens,
+                                             index,
+                                             index + first_collocation_size_ - 1,
+                                             esc_character_);
+
+      for (int size = first_collocation_size_; size <= max_collocation_size; ++size) {
+        collocation += esc_character_;
+        collocation += document.tokens[index + size - 1];
 
-      dictionary_->add(collocation);
-      const int* collocation_index_ptr = dictionary_->get_index(collocation);
+        if (heavy_hitters_ != nullptr) {
+          collocation_to_counter_local[collocation] += weight;
+          continue;
+        }
+
+        if (phrase_counters_ != nullptr) {
+          add_candidate(collocation, weight);
+          continue;
+        }
 
-      ++index_to_counter_local[*collocation_index_ptr];
+        if (verification_) {
+          const int* collocation_index_ptr = dictionary_->get_index(collocation);
+          if (collocation_index_ptr != nullptr) {
+            index_to_counter_local[*collocation_index_ptr] += weight;
+          }
+          continue;
+        }
+
+        dictionary_->add(collocation);
+        const int* collocation_index_ptr = dictionary_->get_index(collocation);
+
+        index_to_counter_local[*collocation_index_ptr] += weight;
+      }
     }
   }
 
-  index_to_counter_->increase(index_to_counter_local);
+  if (heavy_hitters_ != nullptr) {
+    heavy_hitters_->increase(collocation_to_counter_local);
+  } else if (phrase_counters_ != nullptr) {
+    count_candidates();
+  } else {
+    index_to_counter_->increase(index_to_counter_local);
+  }
 
   return nullptr;
 }
+
+void CollocationsProcessor::add_candidate(const std::string& collocation, long weight) {
+  // strings are reused to keep their memory between batches
+  if (num_candidates_ == candidates_.size()) {
+    candidates_.emplace_back();
+    candidate_weights_.emplace_back();
+  }
+  candidates_[num_candidates_] = collocation;
+  candidate_weights_[num_candidates_] = weight;
+  ++num_candidates_;
+}
+
+void CollocationsProcessor::count_candidates() {
+  candidate_hashes_.resize(num_candidates_);
+  for (size_t i = 0; i < num_candidates_; ++i) {
+    candidate_hashes_[i] = ConcurrentPhraseCounters::get_hash(candidates_[i]);
+  }
+
+  {
+    boost::shared_lock<boost::shared_mutex> lock(phrase_counters_->get_mutex());
+    increase_candidates();
+  }
+
+  // growth and spilling of counters take them exclusively, so they are done between batches
+  phrase_counters_->compact_if_needed();
+  if (spiller_ != nullptr) {
+    spiller_->spill_if_needed(phrase_counters_.get());
+  }
+
+  num_candidates_ = 0;
+}
+
+void CollocationsProcessor::increase_candidates() {
+  // slots of the candidate (i + 2 * distance) and entries of the candidate (i + distance) are
+  // requested before counting the candidate i, so their cache misses overlap with the counting
+  for (size_t i = 0; i < num_candidates_; ++i) {
+    if (i + 2 * kPrefetchDistance < num_candidates_) {
+      phrase_counters_->prefetch_slots(candidate_hashes_[i + 2 * kPrefetchDistance]);
+    }
+    if (i + kPrefetchDistance < num_candidates_) {
+      phrase_counters_->prefetch_entries(candidate_hashes_[i + kPrefetchDistance]);
+    }
+
+    phrase_counters_->increase(candidates_[i], candidate_hashes_[i], candidate_weights_[i]);
+  }
+}
+
+void CollocationsProcessor::flush_phrase_counters(const std::shared_ptr<ConcurrentPhraseCounters>& phrase_counters,
+                                                  const std::shared_ptr<PhraseCountsSpiller>& spiller,
+                                                  const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                                                  const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                                                  bool sort_collocations)
+{
+  // the same key may be reported several times after the growth of phrase counters, counts are summed.
+  // Counting threads are finished, so collocations are added without the lock of dictionary. Counts
+  // go straight into counters, so merged runs don't need memory for another copy of them
+  auto add_count = [&](const std::string& collocation, long count) {
+    index_to_counter->increase(dictionary->add_unsafe(collocation), count);
+  };
+
+  if (spiller != nullptr && spiller->get_num_runs() > 0) {
+    spiller->merge(phrase_counters.get(), add_count);
+  } else if (sort_collocations) {
+    // order of hashes is close to the order of the table, so collocations close in the dictionary
+    // are close in its hash table too, ties of hashes are ordered by keys
+    std::vector<HashedCount> hashed_counts;
+    hashed_counts.reserve(phrase_counters->size());
+    phrase_counters->for_each([&](const std::string& collocation, long count) {
+      hashed_counts.push_back({ ConcurrentPhraseCounters::get_hash(collocation), &collocation, count });
+    });
+
+    std::sort(hashed_counts.begin(), hashed_counts.end(), [](const HashedCount& first, const HashedCount& second) {
+      return first.hash != second.hash ? first.hash < second.hash : *first.collocation < *second.collocation;
+    });
+
+    for (const auto& hashed_count : hashed_counts) {
+      add_count(*hashed_count.collocation, hashed_count.count);
+    }
+    phrase_counters->clear();
+  } else {
+    phrase_counters->for_each(add_count);
+    phrase_counters->clear();
+  }
+}
+
+void CollocationsProcessor::prune_speculative_collocations(
+    const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+    const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+    int first_collocation_size,
+    int last_collocation_size,
+    long threshold,
+    char esc_character)
+{
+  if (last_collocation_size <= first_collocation_size) {
+    return;
+  }
+
+  std::vector<std::vector<int>> size_to_indices(last_collocation_size + 1);
+  for (const auto& index_counter : index_to_counter->get_all_unsafe()) {
+    auto collocation = dictionary->get_token(index_counter.first);
+    int size = std::count(collocation.begin(), collocation.end(), esc_character) + 1;
+
+    if (size > first_collocation_size && size <= last_collocation_size) {
+      size_to_indices[size].push_back(index_counter.first);
+    }
+  }
+
+  auto is_frequent = [&](const std::string& collocation) {
+    const int* index_ptr = dictionary->get_index(collocation);
+    if (index_ptr == nullptr) {
+      return false;
+    }
+
+    const double* counter_ptr = index_to_counter->get(*index_ptr);
+    return counter_ptr != nullptr && *counter_ptr >= threshold;
+  };
+
+  // sizes are processed in increasing order, so sub-collocations are already pruned
+  for (int size = first_collocation_size + 1; size <= last_collocation_size; ++size) {
+    std::vector<int> pruned_indices;
+
+    for (const auto& index : size_to_indices[size]) {
+      auto collocation = dictionary->get_token(index);
+      auto prefix = collocation.substr(0, collocation.rfind(esc_character)).to_string();
+      auto suffix = collocation.substr(collocation.find(esc_character) + 1).to_string();
+
+      if (!is_frequent(prefix) || !is_frequent(suffix)) {
+        pruned_indices.push_back(index);
+      }
+    }
+
+    index_to_counter->erase(pruned_indices);
+  }
+}
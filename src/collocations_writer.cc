@@ -0,0 +1,203 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <queue>
+#include <stdexcept>
+
+#include "boost/thread.hpp"
+
+#include "include/collocations_writer.h"
+
+namespace {
+  void write_run_record(const CollocationRecord& record, std::ofstream* output_stream) {
+    uint32_t size = record.collocation.size();
+    output_stream->write(reinterpret_cast<const char*>(&record.df), sizeof(record.df));
+    output_stream->write(reinterpret_cast<const char*>(&record.score), sizeof(record.score));
+    output_stream->write(reinterpret_cast<const char*>(&record.mean_score), sizeof(record.mean_score));
+    output_stream->write(reinterpret_cast<const char*>(&record.frequency), sizeof(record.frequency));
+    output_stream->write(reinterpret_cast<const char*>(&size), sizeof(size));
+    output_stream->write(record.collocation.data(), size);
+  }
+
+  bool read_run_record(std::ifstream* input_stream, CollocationRecord* record) {
+    uint32_t size = 0;
+    input_stream->read(reinterpret_cast<char*>(&record->df), sizeof(record->df));
+    input_stream->read(reinterpret_cast<char*>(&record->score), sizeof(record->score));
+    input_stream->read(reinterpret_cast<char*>(&record->mean_score), sizeof(record->mean_score));
+    input_stream->read(reinterpret_cast<char*>(&record->frequency), sizeof(record->frequency));
+    input_stream->read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (!(*input_stream)) {
+      return false;
+    }
+
+    record->collocation.resize(size);
+    input_stream->read(&record->collocation[0], size);
+    return static_cast<bool>(*input_stream);
+  }
+}  // namespace
+
+CollocationsOrder CollocationsWriter::parse_order(const std::string& name) {
+  if (name.empty() || name == "none") {
+    return CollocationsOrder::kNone;
+  }
+  if (name == "df") {
+    return CollocationsOrder::kDf;
+  }
+  if (name == "score") {
+    return CollocationsOrder::kScore;
+  }
+  if (name == "lexicographic") {
+    return CollocationsOrder::kLexicographic;
+  }
+
+  throw std::runtime_error("Error: unknown collocations order: " + name);
+}
+
+void CollocationsWriter::add(const CollocationRecord& record) {
+  if (record.df < min_df_) {
+    return;
+  }
+
+  if (order_ == CollocationsOrder::kNone) {
+    write_record(record);
+    return;
+  }
+
+  records_.push_back(record);
+  records_memory_ += sizeof(CollocationRecord) + record.collocation.capacity();
+
+  if (memory_limit_ > 0 && records_memory_ >= memory_limit_) {
+    spill_run();
+  }
+}
+
+void CollocationsWriter::finish() {
+  if (run_paths_.empty()) {
+    sort_records();
+    for (const auto& record : records_) {
+      write_record(record);
+    }
+  } else {
+    if (!records_.empty()) {
+      spill_run();
+    }
+
+    // k-way merge of sorted runs
+    std::vector<std::shared_ptr<std::ifstream>> run_streams;
+    std::vector<CollocationRecord> run_records(run_paths_.size());
+
+    auto is_greater = [&](size_t first, size_t second) { return is_less(run_records[second], run_records[first]); };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(is_greater)> runs_heap(is_greater);
+
+    for (size_t i = 0; i < run_paths_.size(); ++i) {
+      run_streams.push_back(std::make_shared<std::ifstream>(run_paths_[i], std::ios::binary));
+      if (read_run_record(run_streams[i].get(), &run_records[i])) {
+        runs_heap.push(i);
+      }
+    }
+
+    while (!runs_heap.empty() && (top_n_ <= 0 || num_written_ < top_n_)) {
+      size_t run_index = runs_heap.top();
+      runs_heap.pop();
+
+      write_record(run_records[run_index]);
+      if (read_run_record(run_streams[run_index].get(), &run_records[run_index])) {
+        runs_heap.push(run_index);
+      }
+    }
+  }
+
+  records_.clear();
+  output_stream_.close();
+  if (output_stream_.fail()) {
+    throw std::runtime_error("Error: unable to write collocations output file: " + output_path_);
+  }
+}
+
+CollocationsWriter::~CollocationsWriter() {
+  for (const auto& run_path : run_paths_) {
+    std::remove(run_path.c_str());
+  }
+}
+
+void CollocationsWriter::sort_records() {
+  auto compare = [this](const CollocationRecord& first, const CollocationRecord& second) {
+    return is_less(first, second);
+  };
+
+  // each thread sorts its own part, then parts are merged pairwise
+  size_t num_parts = std::min(static_cast<size_t>(num_threads_), std::max<size_t>(records_.size() / 1024, 1));
+  std::vector<size_t> bounds;
+  for (size_t i = 0; i <= num_parts; ++i) {
+    bounds.push_back(records_.size() * i / num_parts);
+  }
+
+  boost::thread_group threads;
+  for (size_t i = 0; i < num_parts; ++i) {
+    threads.create_thread([&, i]() {
+      std::sort(records_.begin() + bounds[i], records_.begin() + bounds[i + 1], compare);
+    });
+  }
+  threads.join_all();
+
+  for (size_t step = 1; step < num_parts; step *= 2) {
+    for (size_t i = 0; i + step < num_parts; i += 2 * step) {
+      std::inplace_merge(records_.begin() + bounds[i],
+                         records_.begin() + bounds[i + step],
+                         records_.begin() + bounds[std::min(i + 2 * step, num_parts)],
+                         compare);
+    }
+  }
+}
+
+void CollocationsWriter::spill_run() {
+  sort_records();
+
+  run_paths_.push_back(output_path_ + ".run_" + std::to_string(run_paths_.size()));
+  std::ofstream run_stream(run_paths_.back(), std::ios::binary);
+
+  // no more than top_n records of each run can be written
+  size_t num_records = records_.size();
+  if (top_n_ > 0) {
+    num_records = std::min(num_records, static_cast<size_t>(top_n_));
+  }
+
+  for (size_t i = 0; i < num_records; ++i) {
+    write_run_record(records_[i], &run_stream);
+  }
+
+  run_stream.close();
+  if (run_stream.fail()) {
+    throw std::runtime_error("Error: unable to write temporary file: " + run_paths_.back());
+  }
+
+  records_.clear();
+  records_memory_ = 0;
+}
+
+void CollocationsWriter::write_record(const CollocationRecord& record) {
+  if (top_n_ > 0 && num_written_ >= top_n_) {
+    return;
+  }
+
+  output_stream_ << record.collocation << ' ' << record.df;
+  if (write_stats_) {
+    output_stream_ << ' ' << record.score << ' ' << record.mean_score << ' ' << record.frequency;
+  }
+  output_stream_ << '\n';
+  ++num_written_;
+}
+
+bool CollocationsWriter::is_less(const CollocationRecord& first, const CollocationRecord& second) const {
+  if (order_ == CollocationsOrder::kDf && first.df != second.df) {
+    return first.df > second.df;
+  }
+
+  if (order_ == CollocationsOrder::kScore && first.score != second.score) {
+    return first.score > second.score;
+  }
+
+  return first.collocation < second.collocation;
+}
@@ -0,0 +1,315 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <utility>
+
+#include "boost/iostreams/copy.hpp"
+#include "boost/iostreams/device/array.hpp"
+#include "boost/iostreams/device/back_inserter.hpp"
+#include "boost/iostreams/device/file.hpp"
+#include "boost/iostreams/filter/gzip.hpp"
+#include "boost/iostreams/filter/zstd.hpp"
+#include "boost/iostreams/filtering_stream.hpp"
+#include "boost/iostreams/restrict.hpp"
+
+#include "include/compressed_input_reader.h"
+
+namespace io = boost::iostreams;
+
+namespace {
+  const uint32_t kZstdMagic = 0xFD2FB528;
+  const uint32_t kZstdSkippableMagic = 0x184D2A50;
+  const uint32_t kZstdSkippableMagicMask = 0xFFFFFFF0;
+
+  // frames larger than this are decompressed in streaming mode instead of being buffered
+  const std::streamoff kMaxBufferedFrameSize = 64 << 20;
+  const size_t kReadChunkSize = 1 << 20;
+
+  uint32_t read_little_endian(std::istream* input_stream, int num_bytes) {
+    unsigned char bytes[4] = { 0 };
+    input_stream->read(reinterpret_cast<char*>(bytes), num_bytes);
+    if (input_stream->gcount() != num_bytes) {
+      throw std::runtime_error("Error: unexpected end of zstd input");
+    }
+
+    uint32_t value = 0;
+    for (int i = num_bytes - 1; i >= 0; --i) {
+      value = (value << 8) | bytes[i];
+    }
+
+    return value;
+  }
+
+  // finds the bounds of the next zstd frame by walking its header and block headers,
+  // skippable frames are ignored, returns false if the stream has ended
+  bool find_zstd_frame(std::istream* input_stream,
+                       std::streamoff stream_size,
+                       std::streamoff* frame_begin,
+                       std::streamoff* frame_size)
+  {
+    while (true) {
+      *frame_begin = input_stream->tellg();
+      if (input_stream->peek() == std::char_traits<char>::eof()) {
+        return false;
+      }
+
+      uint32_t magic = read_little_endian(input_stream, 4);
+      if ((magic & kZstdSkippableMagicMask) == kZstdSkippableMagic) {
+        input_stream->seekg(read_little_endian(input_stream, 4), std::ios_base::cur);
+        if (input_stream->tellg() > stream_size) {
+          throw std::runtime_error("Error: truncated zstd skippable frame");
+        }
+
+        continue;
+      }
+
+      if (magic != kZstdMagic) {
+        throw std::runtime_error("Error: invalid zstd frame magic number");
+      }
+
+      uint32_t descriptor = read_little_endian(input_stream, 1);
+      int content_size_flag = descriptor >> 6;
+      bool single_segment = (descriptor >> 5) & 1;
+      bool has_checksum = (descriptor >> 2) & 1;
+      int dictionary_id_flag = descriptor & 3;
+
+      const int kDictionaryIdSizes[] = { 0, 1, 2, 4 };
+      const int kContentSizeSizes[] = { single_segment ? 1 : 0, 2, 4, 8 };
+
+      input_stream->seekg((single_segment ? 0 : 1) + kDictionaryIdSizes[dictionary_id_flag] +
+                          kContentSizeSizes[content_size_flag], std::ios_base::cur);
+
+      bool is_last_block = false;
+      while (!is_last_block) {
+        uint32_t block_header = read_little_endian(input_stream, 3);
+        is_last_block = block_header & 1;
+        int block_type = (block_header >> 1) & 3;
+        uint32_t block_size = block_header >> 3;
+
+        if (block_type == 3) {
+          throw std::runtime_error("Error: invalid zstd block type");
+        }
+
+        // RLE blocks store a single byte
+        input_stream->seekg(block_type == 1 ? 1 : block_size, std::ios_base::cur);
+      }
+
+      if (has_checksum) {
+        input_stream->seekg(4, std::ios_base::cur);
+      }
+
+      *frame_size = static_cast<std::streamoff>(input_stream->tellg()) - *frame_begin;
+      if (*frame_begin + *frame_size > stream_size) {
+        throw std::runtime_error("Error: truncated zstd frame");
+      }
+
+      return true;
+    }
+  }
+
+  std::string decompress_zstd_frame(const std::string& frame) {
+    std::string data;
+
+    io::filtering_istreambuf input_buffer;
+    input_buffer.push(io::zstd_decompressor());
+    input_buffer.push(io::array_source(frame.data(), frame.size()));
+    io::copy(input_buffer, io::back_inserter(data));
+
+    return data;
+  }
+}  // namespace
+
+void CompressedInputReader::join() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  if (!error_message_.empty()) {
+    throw std::runtime_error(error_message_);
+  }
+}
+
+CompressionType CompressedInputReader::detect_compression(const std::string& input_path) {
+  std::ifstream input_stream(input_path, std::ios::binary);
+
+  unsigned char magic[4] = { 0 };
+  input_stream.read(reinterpret_cast<char*>(magic), sizeof(magic));
+  auto num_read = input_stream.gcount();
+
+  if (num_read >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+    return CompressionType::kGzip;
+  }
+
+  if (num_read == 4) {
+    uint32_t value = magic[0] | (magic[1] << 8) | (magic[2] << 16) | (static_cast<uint32_t>(magic[3]) << 24);
+    if (value == kZstdMagic || (value & kZstdSkippableMagicMask) == kZstdSkippableMagic) {
+      return CompressionType::kZstd;
+    }
+  }
+
+  return CompressionType::kNone;
+}
+
+std::shared_ptr<std::istream> CompressedInputReader::open_input_stream(const std::string& input_path) {
+  auto compression = detect_compression(input_path);
+
+  if (compression == CompressionType::kNone) {
+    auto input_stream = std::make_shared<std::ifstream>(input_path);
+    if (!input_stream->is_open()) {
+      throw std::runtime_error("Error: unable to open input file: " + input_path);
+    }
+
+    return input_stream;
+  }
+
+  io::file_source file(input_path, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("Error: unable to open input file: " + input_path);
+  }
+
+  auto input_stream = std::make_shared<io::filtering_istream>();
+  if (compression == CompressionType::kGzip) {
+    input_stream->push(io::gzip_decompressor());
+  } else {
+    input_stream->push(io::zstd_decompressor());
+  }
+  input_stream->push(file);
+
+  return input_stream;
+}
+
+void CompressedInputReader::thread_function() {
+  try {
+    batch_ = batch_pool_->acquire();
+
+    if (detect_compression(input_path_) == CompressionType::kGzip) {
+      read_gzip();
+    } else {
+      read_zstd();
+    }
+
+    if (!tail_.empty()) {
+      add_line(tail_.data(), tail_.size());
+      tail_.clear();
+    }
+
+    push_batch();
+  } catch (std::exception& e) {
+    error_message_ = e.what();
+  }
+
+  batch_queue_->close();
+}
+
+void CompressedInputReader::read_gzip() {
+  io::filtering_istream input_stream;
+  input_stream.push(io::gzip_decompressor());
+  input_stream.push(io::file_source(input_path_, std::ios::binary));
+
+  std::vector<char> buffer(kReadChunkSize);
+  while (input_stream) {
+    input_stream.read(buffer.data(), buffer.size());
+    add_data(buffer.data(), input_stream.gcount());
+  }
+}
+
+void CompressedInputReader::read_zstd() {
+  std::ifstream input_stream(input_path_, std::ios::binary);
+  if (!input_stream.is_open()) {
+    throw std::runtime_error("Error: unable to open input file: " + input_path_);
+  }
+
+  input_stream.seekg(0, std::ios_base::end);
+  std::streamoff file_size = input_stream.tellg();
+  input_stream.seekg(0, std::ios_base::beg);
+
+  // frames are decompressed in parallel, but their data is consumed in the file order,
+  // as documents may cross frame boundaries
+  std::deque<std::future<std::string>> pending_frames;
+  auto consume_frame = [&]() {
+    auto data = pending_frames.front().get();
+    pending_frames.pop_front();
+    add_data(data.data(), data.size());
+  };
+
+  std::streamoff frame_begin = 0;
+  std::streamoff frame_size = 0;
+  while (find_zstd_frame(&input_stream, file_size, &frame_begin, &frame_size)) {
+    if (frame_size <= kMaxBufferedFrameSize) {
+      std::string frame(frame_size, '\0');
+      input_stream.seekg(frame_begin, std::ios_base::beg);
+      input_stream.read(&frame[0], frame_size);
+
+      pending_frames.push_back(std::async(std::launch::async, decompress_zstd_frame, std::move(frame)));
+      if (pending_frames.size() >= num_decompression_threads_) {
+        consume_frame();
+      }
+
+      continue;
+    }
+
+    while (!pending_frames.empty()) {
+      consume_frame();
+    }
+
+    io::filtering_istream frame_stream;
+    frame_stream.push(io::zstd_decompressor());
+    frame_stream.push(io::restrict(io::file_source(input_path_, std::ios::binary), frame_begin, frame_size));
+
+    std::vector<char> buffer(kReadChunkSize);
+    while (frame_stream) {
+      frame_stream.read(buffer.data(), buffer.size());
+      add_data(buffer.data(), frame_stream.gcount());
+    }
+  }
+
+  while (!pending_frames.empty()) {
+    consume_frame();
+  }
+}
+
+void CompressedInputReader::add_data(const char* data, size_t size) {
+  const char* end = data + size;
+  while (data < end) {
+    const char* line_end = static_cast<const char*>(std::memchr(data, '\n', end - data));
+    if (line_end == nullptr) {
+      tail_.append(data, end - data);
+      break;
+    }
+
+    if (tail_.empty()) {
+      add_line(data, line_end - data);
+    } else {
+      tail_.append(data, line_end - data);
+      add_line(tail_.data(), tail_.size());
+      tail_.clear();
+    }
+
+    data = line_end + 1;
+  }
+}
+
+void CompressedInputReader::add_line(const char* data, size_t size) {
+  batch_->add_document(std::string(data, size));
+
+  if (batch_->size() >= batch_size_) {
+    push_batch();
+  }
+}
+
+void CompressedInputReader::push_batch() {
+  if (batch_->size() == 0) {
+    return;
+  }
+
+  batch_->set_sequence_number(num_batches_++);
+  if (!batch_queue_->push(batch_)) {
+    throw std::runtime_error("Error: batch queue was closed before the end of input");
+  }
+
+  batch_ = batch_pool_->acquire();
+}
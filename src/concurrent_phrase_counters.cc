@@ -0,0 +1,222 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <new>
+
+#include "boost/thread/locks.hpp"
+
+#include "include/concurrent_phrase_counters.h"
+#include "include/utils.h"
+
+namespace {
+  size_t round_up_to_power_of_two(size_t value) {
+    size_t result = 1024;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+}  // namespace
+
+ConcurrentPhraseCounters::Table::Table(size_t capacity, HugePagesMode huge_pages_mode)
+    : mask(round_up_to_power_of_two(capacity) - 1)
+    , max_size((mask + 1) / 2)
+    , memory((mask + 1) * sizeof(std::atomic<Entry*>), huge_pages_mode)
+    , slots(static_cast<std::atomic<Entry*>*>(memory.data()))
+    , size(0)
+    , next(nullptr)
+{
+  for (size_t i = 0; i <= mask; ++i) {
+    new (&slots[i]) std::atomic<Entry*>(nullptr);
+  }
+}
+
+ConcurrentPhraseCounters::Table::~Table() {
+  for (size_t i = 0; i <= mask; ++i) {
+    delete slots[i].load(std::memory_order_relaxed);
+  }
+}
+
+void ConcurrentPhraseCounters::increase(const std::string& key, size_t hash, long value) {
+  Entry* new_entry = nullptr;
+
+  Table* table = first_table_;
+  while (true) {
+    size_t position = hash & table->mask;
+
+    // entries are never removed during counting, so an empty slot ends the probing
+    Entry* entry = table->slots[position].load(std::memory_order_acquire);
+    while (entry != nullptr) {
+      if (entry->hash == hash && entry->key == key) {
+        entry->count.fetch_add(value, std::memory_order_relaxed);
+        delete new_entry;
+        return;
+      }
+
+      position = (position + 1) & table->mask;
+      entry = table->slots[position].load(std::memory_order_acquire);
+    }
+
+    Table* next_table = table->next.load(std::memory_order_acquire);
+    if (next_table != nullptr) {
+      table = next_table;
+      continue;
+    }
+
+    if (table->size.load(std::memory_order_relaxed) >= table->max_size) {
+      grow(table);
+      continue;
+    }
+
+    if (new_entry == nullptr) {
+      new_entry = new Entry(key, hash);
+    }
+
+    // count is set before publishing, the entry is visible to other threads after CAS
+    new_entry->count.store(value, std::memory_order_relaxed);
+
+    Entry* expected = nullptr;
+    if (table->slots[position].compare_exchange_strong(expected, new_entry, std::memory_order_acq_rel)) {
+      table->size.fetch_add(1, std::memory_order_relaxed);
+      entries_memory_.fetch_add(sizeof(Entry) + Utils::get_heap_memory(key), std::memory_order_relaxed);
+      return;
+    }
+
+    // the slot was taken by another thread (maybe with the same key), probe this table again
+  }
+}
+
+void ConcurrentPhraseCounters::for_each(const std::function<void(const std::string&, long)>& function) const {
+  for (Table* table = first_table_; table != nullptr; table = table->next.load()) {
+    for (size_t i = 0; i <= table->mask; ++i) {
+      const Entry* entry = table->slots[i].load(std::memory_order_relaxed);
+      if (entry != nullptr) {
+        function(entry->key, entry->count.load(std::memory_order_relaxed));
+      }
+    }
+  }
+}
+
+size_t ConcurrentPhraseCounters::size() const {
+  size_t size = 0;
+  for (Table* table = first_table_; table != nullptr; table = table->next.load()) {
+    size += table->size.load(std::memory_order_relaxed);
+  }
+
+  return size;
+}
+
+void ConcurrentPhraseCounters::compact_if_needed() {
+  if (!has_grown_.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+  // another thread could have compacted the counters while this one waited for the lock
+  if (first_table_->next.load(std::memory_order_acquire) != nullptr) {
+    compact();
+  }
+  has_grown_.store(false, std::memory_order_release);
+}
+
+void ConcurrentPhraseCounters::compact() {
+  // the new table is at most half full, as the tables after growth
+  size_t num_entries = size();
+  size_t capacity = get_capacity();
+  while (capacity / 2 <= num_entries) {
+    capacity *= 2;
+  }
+  // the new table isn't counted by create_table(), delete_tables() resets memory of old ones
+  Table* new_table = new Table(capacity, huge_pages_mode_);
+
+  size_t new_size = 0;
+  for (Table* table = first_table_; table != nullptr; table = table->next.load()) {
+    for (size_t i = 0; i <= table->mask; ++i) {
+      Entry* entry = table->slots[i].exchange(nullptr, std::memory_order_relaxed);
+      if (entry == nullptr) {
+        continue;
+      }
+
+      // entries of the same key from different tables are merged
+      size_t position = entry->hash & new_table->mask;
+      Entry* new_entry = new_table->slots[position].load(std::memory_order_relaxed);
+      while (new_entry != nullptr && (new_entry->hash != entry->hash || new_entry->key != entry->key)) {
+        position = (position + 1) & new_table->mask;
+        new_entry = new_table->slots[position].load(std::memory_order_relaxed);
+      }
+
+      if (new_entry == nullptr) {
+        new_table->slots[position].store(entry, std::memory_order_relaxed);
+        ++new_size;
+      } else {
+        new_entry->count.fetch_add(entry->count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        entries_memory_.fetch_sub(sizeof(Entry) + Utils::get_heap_memory(entry->key), std::memory_order_relaxed);
+        delete entry;
+      }
+    }
+  }
+  new_table->size.store(new_size, std::memory_order_relaxed);
+
+  // slots of old tables are empty now, so their entries aren't deleted with them
+  delete_tables();
+  first_table_ = new_table;
+  tables_memory_.store((new_table->mask + 1) * sizeof(std::atomic<Entry*>), std::memory_order_relaxed);
+}
+
+void ConcurrentPhraseCounters::clear(bool keep_capacity) {
+  size_t capacity = keep_capacity ? get_capacity() : initial_capacity_;
+
+  delete_tables();
+  first_table_ = create_table(capacity);
+  has_grown_ = false;
+  entries_memory_ = 0;
+}
+
+size_t ConcurrentPhraseCounters::get_initial_memory_usage() const {
+  return round_up_to_power_of_two(initial_capacity_) * sizeof(std::atomic<Entry*>);
+}
+
+size_t ConcurrentPhraseCounters::get_capacity() const {
+  return get_last_table()->mask + 1;
+}
+
+HugePagesMode ConcurrentPhraseCounters::get_huge_pages_mode() const {
+  return get_last_table()->memory.get_mode();
+}
+
+ConcurrentPhraseCounters::Table* ConcurrentPhraseCounters::create_table(size_t capacity) {
+  Table* table = new Table(capacity, huge_pages_mode_);
+  tables_memory_.fetch_add((table->mask + 1) * sizeof(std::atomic<Entry*>), std::memory_order_relaxed);
+  return table;
+}
+
+void ConcurrentPhraseCounters::grow(Table* table) {
+  Table* expected = nullptr;
+  Table* next_table = create_table(2 * (table->mask + 1));
+
+  if (table->next.compare_exchange_strong(expected, next_table, std::memory_order_acq_rel)) {
+    has_grown_.store(true, std::memory_order_release);
+  } else {
+    tables_memory_.fetch_sub((next_table->mask + 1) * sizeof(std::atomic<Entry*>), std::memory_order_relaxed);
+    delete next_table;
+  }
+}
+
+const ConcurrentPhraseCounters::Table* ConcurrentPhraseCounters::get_last_table() const {
+  const Table* table = first_table_;
+  while (table->next.load() != nullptr) {
+    table = table->next.load();
+  }
+  return table;
+}
+
+void ConcurrentPhraseCounters::delete_tables() {
+  Table* table = first_table_;
+  while (table != nullptr) {
+    Table* next_table = table->next.load();
+    delete table;
+    table = next_table;
+  }
+  first_table_ = nullptr;
+  tables_memory_ = 0;
+}
@@ -0,0 +1,131 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include "boost/thread/locks.hpp"
+
+#include "include/document_deduplicator.h"
+
+bool DocumentDeduplicator::add(long document_id, const std::vector<std::string>& tokens) {
+  auto hash = get_hash(tokens);
+  auto& shard = shards_[hash.second % kNumShards];
+
+  boost::lock_guard<SpinLock> guard(shard.lock);
+  auto iter = shard.hash_to_copies.find(hash);
+  if (iter == shard.hash_to_copies.end()) {
+    shard.hash_to_copies.emplace(hash, Copies{ document_id, 1 });
+    return true;
+  }
+
+  ++iter->second.num_copies;
+  return false;
+}
+
+void DocumentDeduplicator::finish() {
+  num_documents_ = 0;
+  num_unique_documents_ = 0;
+
+  for (auto& shard : shards_) {
+    boost::lock_guard<SpinLock> guard(shard.lock);
+
+    for (auto iter = shard.hash_to_copies.begin(); iter != shard.hash_to_copies.end();) {
+      num_documents_ += iter->second.num_copies;
+      ++num_unique_documents_;
+
+      if (iter->second.num_copies == 1) {
+        iter = shard.hash_to_copies.erase(iter);
+      } else {
+        id_to_num_copies_.emplace(iter->second.first_id, iter->second.num_copies);
+        ++iter;
+      }
+    }
+  }
+}
+
+long DocumentDeduplicator::get_num_copies(long document_id) const {
+  auto iter = id_to_num_copies_.find(document_id);
+  return iter != id_to_num_copies_.end() ? iter->second : 1;
+}
+
+long DocumentDeduplicator::get_num_copies(long document_id, const DocumentHash& hash) const {
+  const auto& hash_to_copies = shards_[hash.second % kNumShards].hash_to_copies;
+
+  auto iter = hash_to_copies.find(hash);
+  if (iter == hash_to_copies.end()) {
+    return 1;
+  }
+
+  return iter->second.first_id == document_id ? iter->second.num_copies : 0;
+}
+
+void DocumentDeduplicator::for_each_repeated(
+    const std::function<void(const DocumentHash&, long, long)>& function) const
+{
+  for (const auto& shard : shards_) {
+    for (const auto& hash_copies : shard.hash_to_copies) {
+      function(hash_copies.first, hash_copies.second.first_id, hash_copies.second.num_copies);
+    }
+  }
+}
+
+size_t DocumentDeduplicator::get_num_repeated_documents() const {
+  size_t num_repeated_documents = 0;
+  for (const auto& shard : shards_) {
+    num_repeated_documents += shard.hash_to_copies.size();
+  }
+
+  return num_repeated_documents;
+}
+
+void DocumentDeduplicator::add_repeated(const DocumentHash& hash, long first_id, long num_copies) {
+  shards_[hash.second % kNumShards].hash_to_copies.emplace(hash, Copies{ first_id, num_copies });
+  id_to_num_copies_.emplace(first_id, num_copies);
+}
+
+void DocumentDeduplicator::set_num_documents(long num_documents, long num_unique_documents) {
+  num_documents_ = num_documents;
+  num_unique_documents_ = num_unique_documents;
+}
+
+void DocumentDeduplicator::add_segmentation(const DocumentHash& hash, const Segmentation& segmentation) {
+  boost::lock_guard<SpinLock> guard(segmentations_lock_);
+  hash_to_segmentation_.emplace(hash, segmentation);
+}
+
+bool DocumentDeduplicator::get_segmentation(const DocumentHash& hash, Segmentation* segmentation) const {
+  boost::lock_guard<SpinLock> guard(segmentations_lock_);
+
+  auto iter = hash_to_segmentation_.find(hash);
+  if (iter == hash_to_segmentation_.end()) {
+    return false;
+  }
+
+  *segmentation = iter->second;
+  return true;
+}
+
+uint64_t DocumentDeduplicator::get_token_hash(const std::vector<std::string>& tokens) {
+  // FNV-1a over token hashes, the number of tokens is mixed in to separate token boundaries
+  uint64_t hash = 14695981039346656037ULL ^ tokens.size();
+  for (const auto& token : tokens) {
+    hash ^= std::hash<std::string>()(token);
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+uint64_t DocumentDeduplicator::get_char_hash(const std::vector<std::string>& tokens) {
+  // FNV-1a over chars doesn't depend on std::hash, so tokens colliding in it still differ here.
+  // Size of each token is mixed in before its chars to separate token boundaries
+  uint64_t hash = 14695981039346656037ULL;
+  for (const auto& token : tokens) {
+    hash ^= token.size();
+    hash *= 1099511628211ULL;
+
+    for (const auto& c : token) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  return hash;
+}
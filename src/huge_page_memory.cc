@@ -0,0 +1,98 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <stdexcept>
+
+#include "include/huge_page_memory.h"
+
+namespace {
+  size_t round_up_to_huge_page(size_t size) {
+    return (size + HugePageMemory::kHugePageSize - 1) / HugePageMemory::kHugePageSize * HugePageMemory::kHugePageSize;
+  }
+
+  void* map_anonymous(size_t size, int flags) {
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return mapping == MAP_FAILED ? nullptr : mapping;
+  }
+}  // namespace
+
+HugePageMemory::HugePageMemory(size_t size, HugePagesMode mode)
+    : data_(nullptr)
+    , size_(size)
+    , mode_(mode)
+    , mapping_size_(0)
+{
+  if (size_ < kHugePageSize) {
+    mode_ = HugePagesMode::kNone;
+  }
+
+#ifdef MAP_HUGETLB
+  if (mode_ == HugePagesMode::kExplicit) {
+    mapping_size_ = round_up_to_huge_page(size_);
+    data_ = map_anonymous(mapping_size_, MAP_HUGETLB);
+    if (data_ == nullptr) {
+      mode_ = HugePagesMode::kTransparent;
+    }
+  }
+#else
+  if (mode_ == HugePagesMode::kExplicit) {
+    mode_ = HugePagesMode::kTransparent;
+  }
+#endif
+
+#ifdef MADV_HUGEPAGE
+  if (mode_ == HugePagesMode::kTransparent) {
+    // huge pages are used only for aligned regions, so one more page is mapped and the unaligned
+    // head and tail are unmapped
+    size_t aligned_size = round_up_to_huge_page(size_);
+    char* mapping = static_cast<char*>(map_anonymous(aligned_size + kHugePageSize, 0));
+    if (mapping == nullptr) {
+      throw std::runtime_error("Error: unable to allocate " + std::to_string(size_) + " bytes");
+    }
+
+    char* aligned = reinterpret_cast<char*>(round_up_to_huge_page(reinterpret_cast<uintptr_t>(mapping)));
+    if (aligned > mapping) {
+      munmap(mapping, aligned - mapping);
+    }
+    munmap(aligned + aligned_size, mapping + kHugePageSize - aligned);
+
+    data_ = aligned;
+    mapping_size_ = aligned_size;
+    if (madvise(data_, mapping_size_, MADV_HUGEPAGE) != 0) {
+      mode_ = HugePagesMode::kNone;
+    }
+  }
+#else
+  if (mode_ == HugePagesMode::kTransparent) {
+    mode_ = HugePagesMode::kNone;
+  }
+#endif
+
+  if (data_ == nullptr) {
+    mapping_size_ = size_ > 0 ? size_ : 1;
+    data_ = map_anonymous(mapping_size_, 0);
+    if (data_ == nullptr) {
+      throw std::runtime_error("Error: unable to allocate " + std::to_string(size_) + " bytes");
+    }
+  }
+}
+
+HugePageMemory::~HugePageMemory() {
+  munmap(data_, mapping_size_);
+}
+
+HugePagesMode HugePageMemory::parse_mode(const std::string& name) {
+  if (name.empty() || name == "none") {
+    return HugePagesMode::kNone;
+  }
+  if (name == "transparent") {
+    return HugePagesMode::kTransparent;
+  }
+  if (name == "explicit") {
+    return HugePagesMode::kExplicit;
+  }
+
+  throw std::runtime_error("Error: unknown huge pages mode: " + name);
+}
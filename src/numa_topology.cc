@@ -0,0 +1,108 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "include/numa_topology.h"
+
+NumaTopology::NumaTopology() : node_cpus_(), worker_cpus_() {
+  auto allowed_cpus = get_current_thread_cpus();
+
+  for (int node = 0; ; ++node) {
+    std::ifstream cpu_list_stream("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (!cpu_list_stream.is_open()) {
+      break;
+    }
+
+    std::string cpu_list;
+    std::getline(cpu_list_stream, cpu_list);
+
+    std::vector<int> node_cpus;
+    for (const auto& cpu : parse_cpu_list(cpu_list)) {
+      if (std::binary_search(allowed_cpus.begin(), allowed_cpus.end(), cpu)) {
+        node_cpus.push_back(cpu);
+      }
+    }
+
+    if (!node_cpus.empty()) {
+      node_cpus_.push_back(node_cpus);
+    }
+  }
+
+  if (node_cpus_.empty()) {
+    node_cpus_.push_back(allowed_cpus);
+  }
+
+  for (const auto& node_cpus : node_cpus_) {
+    worker_cpus_.insert(worker_cpus_.end(), node_cpus.begin(), node_cpus.end());
+  }
+}
+
+int NumaTopology::get_worker_cpu(int worker_index) const {
+  return worker_cpus_.empty() ? -1 : worker_cpus_[worker_index % worker_cpus_.size()];
+}
+
+int NumaTopology::get_cpu_node(int cpu) const {
+  for (int node = 0; node < node_cpus_.size(); ++node) {
+    if (std::find(node_cpus_[node].begin(), node_cpus_[node].end(), cpu) != node_cpus_[node].end()) {
+      return node;
+    }
+  }
+
+  return 0;
+}
+
+bool NumaTopology::pin_current_thread(int cpu) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    return false;
+  }
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+}
+
+std::vector<int> NumaTopology::get_current_thread_cpus() {
+  std::vector<int> cpus;
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &cpu_set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+
+  return cpus;
+}
+
+std::vector<int> NumaTopology::parse_cpu_list(const std::string& cpu_list) {
+  std::vector<int> cpus;
+  std::stringstream cpu_list_stream(cpu_list);
+
+  std::string range;
+  while (std::getline(cpu_list_stream, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+
+    auto separator_pos = range.find('-');
+    int first_cpu = std::stoi(range.substr(0, separator_pos));
+    int last_cpu = separator_pos == std::string::npos ? first_cpu : std::stoi(range.substr(separator_pos + 1));
+
+    for (int cpu = first_cpu; cpu <= last_cpu; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+
+  return cpus;
+}
@@ -0,0 +1,113 @@
+// Author: Murat Apishev (@mel-lain)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TOPMINE_PAIR_SCORES_X86
+#endif
+
+#include "include/pair_scores.h"
+
+namespace {
+  typedef void (*ComputeFunction)(const double*, const double*, int, double, double*);
+
+#ifdef TOPMINE_PAIR_SCORES_X86
+  // the remaining pairs of vectorized versions are scored by the scalar loop
+  __attribute__((target("avx")))
+  void compute_avx(const double* token_frequencies,
+                   const double* pair_frequencies,
+                   int num_pairs,
+                   double total_collection_size,
+                   double* scores)
+  {
+    const __m256d total = _mm256_set1_pd(total_collection_size);
+    const __m256d eps = _mm256_set1_pd(kEps);
+
+    int i = 0;
+    for (; i + 4 <= num_pairs; i += 4) {
+      __m256d mu = _mm256_mul_pd(_mm256_loadu_pd(token_frequencies + i), _mm256_loadu_pd(token_frequencies + i + 1));
+      mu = _mm256_div_pd(mu, total);
+
+      __m256d frequency = _mm256_loadu_pd(pair_frequencies + i);
+      __m256d score = _mm256_div_pd(_mm256_sub_pd(frequency, mu), _mm256_sqrt_pd(frequency));
+
+      // scores of pairs with zero frequency (0 / 0) are replaced with 0
+      __m256d is_met = _mm256_cmp_pd(frequency, eps, _CMP_GT_OQ);
+      _mm256_storeu_pd(scores + i, _mm256_and_pd(score, is_met));
+    }
+
+    PairScores::compute_scalar(token_frequencies + i, pair_frequencies + i, num_pairs - i, total_collection_size, scores + i);
+  }
+
+  __attribute__((target("sse2")))
+  void compute_sse2(const double* token_frequencies,
+                    const double* pair_frequencies,
+                    int num_pairs,
+                    double total_collection_size,
+                    double* scores)
+  {
+    const __m128d total = _mm_set1_pd(total_collection_size);
+    const __m128d eps = _mm_set1_pd(kEps);
+
+    int i = 0;
+    for (; i + 2 <= num_pairs; i += 2) {
+      __m128d mu = _mm_mul_pd(_mm_loadu_pd(token_frequencies + i), _mm_loadu_pd(token_frequencies + i + 1));
+      mu = _mm_div_pd(mu, total);
+
+      __m128d frequency = _mm_loadu_pd(pair_frequencies + i);
+      __m128d score = _mm_div_pd(_mm_sub_pd(frequency, mu), _mm_sqrt_pd(frequency));
+
+      __m128d is_met = _mm_cmpgt_pd(frequency, eps);
+      _mm_storeu_pd(scores + i, _mm_and_pd(score, is_met));
+    }
+
+    PairScores::compute_scalar(token_frequencies + i, pair_frequencies + i, num_pairs - i, total_collection_size, scores + i);
+  }
+#endif
+
+  struct ComputeVersion {
+    ComputeFunction function;
+    const char* name;
+  };
+
+  ComputeVersion choose_version() {
+#ifdef TOPMINE_PAIR_SCORES_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+      return { compute_avx, "avx" };
+    }
+    if (__builtin_cpu_supports("sse2")) {
+      return { compute_sse2, "sse2" };
+    }
+#endif
+    return { PairScores::compute_scalar, "scalar" };
+  }
+
+  const ComputeVersion& get_compute_version() {
+    static const ComputeVersion version = choose_version();
+    return version;
+  }
+}  // namespace
+
+void PairScores::compute(const double* token_frequencies,
+                         const double* pair_frequencies,
+                         int num_pairs,
+                         double total_collection_size,
+                         double* scores)
+{
+  get_compute_version().function(token_frequencies, pair_frequencies, num_pairs, total_collection_size, scores);
+}
+
+void PairScores::compute_scalar(const double* token_frequencies,
+                                const double* pair_frequencies,
+                                int num_pairs,
+                                double total_collection_size,
+                                double* scores)
+{
+  for (int i = 0; i < num_pairs; ++i) {
+    scores[i] = compute_score(token_frequencies[i], token_frequencies[i + 1], pair_frequencies[i], total_collection_size);
+  }
+}
+
+const char* PairScores::get_version() {
+  return get_compute_version().name;
+}
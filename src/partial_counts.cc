@@ -0,0 +1,83 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "include/partial_counts.h"
+
+const char* const PartialCounts::kSignature = "topmine-counts";
+
+void PartialCounts::store(const std::string& path,
+                          const PartialCountsHeader& header,
+                          const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                          const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                          int first_index)
+{
+  std::ofstream output_stream(path);
+  if (!output_stream.is_open()) {
+    throw std::runtime_error("Error: unable to open counts output file: " + path);
+  }
+
+  output_stream.precision(std::numeric_limits<double>::max_digits10);
+  output_stream << kSignature << " " << header.collocation_size << " "
+                << header.total_collection_size << " " << header.threshold << "\n";
+
+  // counters are stored in the order of indices, so the file is the same for the same dictionary
+  const int dictionary_size = static_cast<int>(dictionary->size());
+  for (int index = first_index; index < dictionary_size; ++index) {
+    const double* counter = index_to_counter->get_unsafe(index);
+    if (counter != nullptr) {
+      output_stream << dictionary->get_token(index) << " " << *counter << "\n";
+    }
+  }
+
+  output_stream.close();
+  if (output_stream.fail()) {
+    throw std::runtime_error("Error: unable to write counts output file: " + path);
+  }
+}
+
+PartialCountsHeader PartialCounts::load(const std::string& path,
+                                        const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                                        const std::shared_ptr<ThreadSafeCounters>& index_to_counter)
+{
+  std::ifstream input_stream(path);
+  if (!input_stream.is_open()) {
+    throw std::runtime_error("Error: unable to open counts file: " + path);
+  }
+
+  PartialCountsHeader header;
+  std::string signature;
+  std::string str;
+
+  std::getline(input_stream, str);
+  std::istringstream header_stream(str);
+  header_stream >> signature >> header.collocation_size >> header.total_collection_size >> header.threshold;
+
+  if (header_stream.fail() || signature != kSignature) {
+    throw std::runtime_error("Error: invalid header of counts file: " + path);
+  }
+
+  std::unordered_map<int, double> index_to_counter_local;
+  while (std::getline(input_stream, str)) {
+    if (str.empty()) {
+      continue;
+    }
+
+    auto separator_pos = str.rfind(' ');
+    if (separator_pos == std::string::npos || separator_pos == 0) {
+      throw std::runtime_error("Error: invalid line in counts file " + path + ": " + str);
+    }
+
+    auto collocation = str.substr(0, separator_pos);
+    dictionary->add(collocation);
+    index_to_counter_local[*(dictionary->get_index(collocation))] += std::stod(str.substr(separator_pos + 1));
+  }
+
+  index_to_counter->increase(index_to_counter_local);
+
+  return header;
+}
@@ -0,0 +1,230 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+#include "boost/thread/locks.hpp"
+
+#include "include/phrase_counts_spiller.h"
+
+namespace {
+  const size_t kBufferSize = 1 << 20;
+
+  // entries of counters sorted by key with summed counts, keys point into the counters
+  std::vector<std::pair<const std::string*, long>> get_sorted_counts(const ConcurrentPhraseCounters& phrase_counters) {
+    std::vector<std::pair<const std::string*, long>> counts;
+    counts.reserve(phrase_counters.size());
+    phrase_counters.for_each([&](const std::string& key, long count) {
+      counts.emplace_back(&key, count);
+    });
+
+    std::sort(counts.begin(), counts.end(), [](const std::pair<const std::string*, long>& first,
+                                               const std::pair<const std::string*, long>& second) {
+      return *first.first < *second.first;
+    });
+
+    // the same key may have several entries after the growth of counters
+    size_t size = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+      if (size > 0 && *counts[size - 1].first == *counts[i].first) {
+        counts[size - 1].second += counts[i].second;
+      } else {
+        counts[size++] = counts[i];
+      }
+    }
+    counts.resize(size);
+
+    return counts;
+  }
+
+  // returns false at the end of the run, a truncated or unreadable run is an error, as its counts would be lost
+  bool read_run_count(std::ifstream* input_stream, const std::string& path, std::string* key, long* count) {
+    uint32_t size = 0;
+    int64_t value = 0;
+    input_stream->read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (input_stream->gcount() == 0 && input_stream->eof()) {
+      return false;
+    }
+
+    if (*input_stream) {
+      key->resize(size);
+      input_stream->read(&(*key)[0], size);
+      input_stream->read(reinterpret_cast<char*>(&value), sizeof(value));
+    }
+    if (!(*input_stream)) {
+      throw std::runtime_error("Error: unable to read temporary file: " + path);
+    }
+
+    *count = value;
+    return true;
+  }
+
+  // sorted run in temporary file, entries are written with a large buffer
+  class RunWriter {
+   public:
+    explicit RunWriter(const std::string& path)
+        : path_(path)
+        , buffer_(kBufferSize)
+        , run_stream_()
+    {
+      run_stream_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+      run_stream_.open(path, std::ios::binary);
+    }
+
+    void write(const std::string& key, long count) {
+      uint32_t size = key.size();
+      int64_t value = count;
+      run_stream_.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      run_stream_.write(key.data(), size);
+      run_stream_.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void close() {
+      run_stream_.close();
+      if (run_stream_.fail()) {
+        throw std::runtime_error("Error: unable to write temporary file: " + path_);
+      }
+    }
+
+   private:
+    std::string path_;
+    std::vector<char> buffer_;
+    std::ofstream run_stream_;
+  };
+
+  // k-way merge of runs and sorted counts from memory, visits summed counts as function(key, count)
+  // in order of keys
+  void merge_sorted_counts(const std::vector<std::string>& run_paths,
+                           const std::vector<std::pair<const std::string*, long>>& memory_counts,
+                           const std::function<void(const std::string&, long)>& function)
+  {
+    // counts from memory are the last source
+    size_t memory_position = 0;
+
+    size_t num_runs = run_paths.size();
+    std::vector<std::shared_ptr<std::ifstream>> run_streams;
+    std::vector<std::string> keys(num_runs + 1);
+    std::vector<long> counts(num_runs + 1);
+
+    auto read_next = [&](size_t source) {
+      if (source < num_runs) {
+        return read_run_count(run_streams[source].get(), run_paths[source], &keys[source], &counts[source]);
+      }
+      if (memory_position == memory_counts.size()) {
+        return false;
+      }
+
+      keys[source] = *memory_counts[memory_position].first;
+      counts[source] = memory_counts[memory_position].second;
+      ++memory_position;
+      return true;
+    };
+
+    auto is_greater = [&](size_t first, size_t second) { return keys[second] < keys[first]; };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(is_greater)> sources_heap(is_greater);
+
+    for (size_t source = 0; source <= num_runs; ++source) {
+      if (source < num_runs) {
+        run_streams.push_back(std::make_shared<std::ifstream>(run_paths[source], std::ios::binary));
+        if (!run_streams.back()->is_open()) {
+          throw std::runtime_error("Error: unable to open temporary file: " + run_paths[source]);
+        }
+      }
+      if (read_next(source)) {
+        sources_heap.push(source);
+      }
+    }
+
+    std::string key;
+    while (!sources_heap.empty()) {
+      key = keys[sources_heap.top()];
+      long count = 0;
+
+      while (!sources_heap.empty() && keys[sources_heap.top()] == key) {
+        size_t source = sources_heap.top();
+        sources_heap.pop();
+
+        count += counts[source];
+        if (read_next(source)) {
+          sources_heap.push(source);
+        }
+      }
+
+      function(key, count);
+    }
+  }
+}  // namespace
+
+PhraseCountsSpiller::~PhraseCountsSpiller() {
+  remove_runs();
+}
+
+void PhraseCountsSpiller::spill_if_needed(ConcurrentPhraseCounters* phrase_counters) {
+  if (phrase_counters->get_memory_usage() <= memory_budget_) {
+    return;
+  }
+
+  boost::unique_lock<boost::shared_mutex> lock(phrase_counters->get_mutex());
+
+  // another thread could have spilled the counters while this one waited for the lock
+  if (phrase_counters->get_memory_usage() > memory_budget_ && phrase_counters->size() > 0) {
+    spill(phrase_counters);
+  }
+}
+
+void PhraseCountsSpiller::spill(ConcurrentPhraseCounters* phrase_counters) {
+  run_paths_.push_back(create_run_path());
+
+  RunWriter run_writer(run_paths_.back());
+  for (const auto& key_count : get_sorted_counts(*phrase_counters)) {
+    run_writer.write(*key_count.first, key_count.second);
+  }
+  run_writer.close();
+
+  // the grown table would keep the memory above the budget, so the next run starts from the initial one
+  phrase_counters->clear(false);
+}
+
+void PhraseCountsSpiller::merge(ConcurrentPhraseCounters* phrase_counters,
+                                const std::function<void(const std::string&, long)>& function)
+{
+  // the first runs are merged into a new one at the end of the list until the rest can be opened at once,
+  // the new run is listed before merging, so it is removed with the others in case of error
+  while (run_paths_.size() > max_open_runs_) {
+    std::vector<std::string> merged_run_paths(run_paths_.begin(), run_paths_.begin() + max_open_runs_);
+    run_paths_.push_back(create_run_path());
+
+    RunWriter run_writer(run_paths_.back());
+    merge_sorted_counts(merged_run_paths, { }, [&](const std::string& key, long count) {
+      run_writer.write(key, count);
+    });
+    run_writer.close();
+
+    for (const auto& run_path : merged_run_paths) {
+      std::remove(run_path.c_str());
+    }
+    run_paths_.erase(run_paths_.begin(), run_paths_.begin() + max_open_runs_);
+  }
+
+  merge_sorted_counts(run_paths_, get_sorted_counts(*phrase_counters), function);
+
+  remove_runs();
+  phrase_counters->clear();
+}
+
+std::string PhraseCountsSpiller::create_run_path() {
+  return path_prefix_ + ".counts_run_" + std::to_string(num_created_runs_++);
+}
+
+void PhraseCountsSpiller::remove_runs() {
+  for (const auto& run_path : run_paths_) {
+    std::remove(run_path.c_str());
+  }
+  run_paths_.clear();
+}
@@ -1,105 +1,283 @@
 // Author: Murat Apishev (@mel-lain)
 
-#include <cmath>
-
+#include <algorithm>
+#include <limits>
 #include <map>
 #include <sstream>
 
-#include "include/common.h"
+#include "include/pair_scores.h"
 #include "include/utils.h"
 
 #include "include/scoring_processor.h"
 
 double ScoringProcessor::compute_pair_score(int index_first,
                                             int index_second,
-                                            const std::string& token_first,
-                                            const std::string& token_second) const
+                                            boost::string_ref token_first,
+                                            boost::string_ref token_second) const
 {
-  double mu = *(index_to_counter_->get(index_first)) * *(index_to_counter_->get(index_second));
-  mu /= static_cast<double>(*total_collection_size_);
-
-  auto collocation = Utils::join_strings({ token_first, token_second }, esc_character_);
+  std::string collocation;
+  join_tokens(token_first, token_second, &collocation);
+
+  int collocation_index = 0;
+  return PairScores::compute_score(*(index_to_counter_->get_unsafe(index_first)),
+                                   *(index_to_counter_->get_unsafe(index_second)),
+                                   get_frequency(collocation, &collocation_index),
+                                   static_cast<double>(*total_collection_size_));
+}
 
-  double pair_frequency = 0.0;
-  const int* token_index_ptr = dictionary_->get_index_unsafe(collocation);
-  if (token_index_ptr != nullptr) {
-    pair_frequency = *(index_to_counter_->get(*token_index_ptr));
+double ScoringProcessor::get_frequency(const std::string& collocation, int* collocation_index) const {
+  const int* index_ptr = dictionary_->get_index_unsafe(collocation);
+  *collocation_index = index_ptr != nullptr ? *index_ptr : -1;
+  if (index_ptr == nullptr) {
+    return 0.0;
   }
 
-  return pair_frequency > kEps ? (pair_frequency - mu) / std::sqrt(pair_frequency) : 0.0;
+  // collocations pruned after speculative counting stay in dictionary without counters
+  const double* counter_ptr = index_to_counter_->get_unsafe(*index_ptr);
+  return counter_ptr != nullptr ? *counter_ptr : 0.0;
+}
+
+void ScoringProcessor::join_tokens(boost::string_ref first,
+                                   boost::string_ref second,
+                                   std::string* collocation) const
+{
+  collocation->reserve(first.size() + second.size() + 1);
+  collocation->assign(first.data(), first.size());
+  *collocation += esc_character_;
+  collocation->append(second.data(), second.size());
 }
 
-void ScoringProcessor::add_processed_item(const std::shared_ptr<Batch>& processed_batch,
-                                          const std::unordered_map<int, Collocation>& position_to_collocation,
+void ScoringProcessor::add_processed_item(const std::unordered_map<int, Collocation>& position_to_collocation,
                                           const Document& document)
 {
-  std::vector<std::string> tokens;
+  processed_batch_->start_document(document.id);
 
   for (int i = 0; i < document.tokens.size();) {
-    auto str_i = std::to_string(i);
     auto iter = position_to_collocation.find(i);
+    int collocation_size = iter == position_to_collocation.end() ? 1 : iter->second.collocation_size;
 
-    if (iter == position_to_collocation.end()) {
-      tokens.push_back(return_indices_ ? Utils::join_strings({ str_i, "1" }, esc_character_) : document.tokens[i]);
+    auto token = iter == position_to_collocation.end()
+      ? boost::string_ref(document.tokens[i]) : dictionary_->get_token_unsafe(iter->second.collocation_index);
+    processed_batch_->add_token(token.data(), token.size());
 
-      ++i;
-      continue;
-    }
+    i += collocation_size;
+  }
+}
 
-    tokens.push_back(return_indices_ ? Utils::join_strings({ str_i, std::to_string(iter->second.collocation_size) },
-                                                           esc_character_)
-                                     : *(dictionary_->get_token_unsafe(iter->second.collocation_index)));
+void ScoringProcessor::serialize_indices(const std::unordered_map<int, Collocation>& position_to_collocation,
+                                         const Document& document,
+                                         char delimiter)
+{
+  Utils::append_integer(document.id, &output_buffer_);
 
-    i += iter->second.collocation_size;
+  for (int i = 0; i < document.tokens.size();) {
+    auto iter = position_to_collocation.find(i);
+    int collocation_size = iter == position_to_collocation.end() ? 1 : iter->second.collocation_size;
+
+    output_buffer_ += delimiter;
+    Utils::append_integer(i, &output_buffer_);
+    output_buffer_ += esc_character_;
+    Utils::append_integer(collocation_size, &output_buffer_);
+
+    i += collocation_size;
   }
 
-  processed_batch->add_document(document.id, tokens);
+  output_buffer_ += '\n';
 }
 
-std::shared_ptr<Batch> ScoringProcessor::process(const Batch& batch) {
-  std::unordered_map<int, Collocation> position_to_collocation;
-  auto processed_batch = std::make_shared<Batch>(Batch(batch.delimiters));
+void ScoringProcessor::get_span_lengths(const std::unordered_map<int, Collocation>& position_to_collocation,
+                                        int num_tokens,
+                                        std::vector<int>* span_lengths)
+{
+  span_lengths->clear();
 
-  for (const auto& document : batch.get_documents()) {
-    const int num_elements = document.tokens.size() - 1;
-    Heap token_pairs_heap(num_elements);
+  for (int i = 0; i < num_tokens;) {
+    auto iter = position_to_collocation.find(i);
+    span_lengths->push_back(iter == position_to_collocation.end() ? 1 : iter->second.collocation_size);
+
+    i += span_lengths->back();
+  }
+}
 
-    for (int i = 0; i < num_elements; ++i) {
-      int index_first = *(dictionary_->get_index_unsafe(document.tokens[i]));
-      int index_second = *(dictionary_->get_index_unsafe(document.tokens[i + 1]));
+void ScoringProcessor::serialize_binary(const std::unordered_map<int, Collocation>& position_to_collocation,
+                                        const Document& document)
+{
+  get_span_lengths(position_to_collocation, document.tokens.size(), &span_lengths_);
+  SegmentationFormat::append_document(document.id, span_lengths_, &output_buffer_);
+}
+
+void ScoringProcessor::get_indices(const std::vector<std::string>& keys, size_t num_keys, std::vector<int>* indices) {
+  key_hashes_.resize(num_keys);
+  for (size_t i = 0; i < num_keys; ++i) {
+    key_hashes_[i] = ThreadSafeDictionary::get_hash(keys[i]);
+  }
+
+  // the slot of the key (i + 2 * distance) and the entry of the key (i + distance) are requested
+  // before the lookup of the key i, so their cache misses overlap with the lookups
+  indices->resize(num_keys);
+  for (size_t i = 0; i < num_keys; ++i) {
+    if (i + 2 * kPrefetchDistance < num_keys) {
+      dictionary_->prefetch_slot(key_hashes_[i + 2 * kPrefetchDistance]);
+    }
+    if (i + kPrefetchDistance < num_keys) {
+      dictionary_->prefetch_entry(key_hashes_[i + kPrefetchDistance]);
+    }
+
+    const int* index_ptr = dictionary_->get_index_unsafe(keys[i], key_hashes_[i]);
+    (*indices)[i] = index_ptr != nullptr ? *index_ptr : -1;
+  }
+}
 
-      double score = compute_pair_score(index_first, index_second, document.tokens[i], document.tokens[i + 1]);
+void ScoringProcessor::segment_document(const Document& document,
+                                        std::unordered_map<int, Collocation>* position_to_collocation,
+                                        std::unordered_map<int, double>* position_to_score)
+{
+  // each token is looked up once. Tokens are absent in dictionary only if it is loaded from model,
+  // their index is -1
+  get_indices(document.tokens, document.tokens.size(), &token_indices_);
+  bool has_absent_tokens = std::find(token_indices_.begin(), token_indices_.end(), -1) != token_indices_.end();
+
+  merge_indexed_tokens(&document.tokens,
+                       document.segment_starts,
+                       has_absent_tokens,
+                       position_to_collocation,
+                       position_to_score);
+}
+
+void ScoringProcessor::merge_indexed_tokens(const std::vector<std::string>* tokens,
+                                            const std::vector<int>& segment_starts,
+                                            bool has_absent_tokens,
+                                            std::unordered_map<int, Collocation>* position_to_collocation,
+                                            std::unordered_map<int, double>* position_to_score)
+{
+  const int num_elements = static_cast<int>(token_indices_.size()) - 1;
+  if (num_elements <= 0) {
+    return;
+  }
+
+  // frequencies of all adjacent pairs are gathered first, then their scores are computed at once
+  token_frequencies_.clear();
+  for (const auto& index : token_indices_) {
+    const double* counter_ptr = index >= 0 ? index_to_counter_->get_unsafe(index) : nullptr;
+    token_frequencies_.push_back(counter_ptr != nullptr ? *counter_ptr : 0.0);
+  }
+
+  // all pairs are joined before their lookups, so the lookups are done with prefetching. Strings of
+  // pairs are reused between documents to keep their memory
+  if (pair_collocations_.size() < num_elements) {
+    pair_collocations_.resize(num_elements);
+  }
+  for (int i = 0; i < num_elements; ++i) {
+    if (tokens != nullptr) {
+      join_tokens((*tokens)[i], (*tokens)[i + 1], &pair_collocations_[i]);
+    } else if (token_indices_[i] >= 0 && token_indices_[i + 1] >= 0) {
+      join_tokens(dictionary_->get_token_unsafe(token_indices_[i]),
+                  dictionary_->get_token_unsafe(token_indices_[i + 1]),
+                  &pair_collocations_[i]);
+    } else {
+      pair_collocations_[i].clear();
+    }
+  }
+  get_indices(pair_collocations_, num_elements, &pair_indices_);
+
+  pair_frequencies_.resize(num_elements);
+  for (int i = 0; i < num_elements; ++i) {
+    // the pair with absent token is never merged
+    if (has_absent_tokens && (token_indices_[i] < 0 || token_indices_[i + 1] < 0)) {
+      pair_indices_[i] = -1;
+    }
 
-      if (score >= alpha_) {
-        token_pairs_heap.push({ { index_first, i }, { index_second, i + 1 }, 1, 1, score });
+    // collocations pruned after speculative counting stay in dictionary without counters
+    const double* counter_ptr = pair_indices_[i] >= 0 ? index_to_counter_->get_unsafe(pair_indices_[i]) : nullptr;
+    pair_frequencies_[i] = counter_ptr != nullptr ? *counter_ptr : 0.0;
+  }
+
+  pair_scores_.resize(num_elements);
+  PairScores::compute(token_frequencies_.data(),
+                      pair_frequencies_.data(),
+                      num_elements,
+                      static_cast<double>(*total_collection_size_),
+                      pair_scores_.data());
+
+  // pairs crossing the ends of segments and pairs with absent tokens are never merged
+  for (const auto& segment_start : segment_starts) {
+    pair_scores_[segment_start - 1] = -std::numeric_limits<double>::infinity();
+  }
+  for (int i = 0; has_absent_tokens && i < num_elements; ++i) {
+    if (token_indices_[i] < 0 || token_indices_[i + 1] < 0) {
+      pair_scores_[i] = -std::numeric_limits<double>::infinity();
+    }
+  }
+
+  (this->*merge_function_)(segment_starts, num_elements, position_to_collocation, position_to_score);
+}
+
+// pairs are the largest collocations, so a merged pair is never scored with its neighbours
+// and all significant pairs are merged in any order of scores: a linear scan replaces the heap.
+// Overlapping pairs are kept as the heap loop keeps them, the output takes the leftmost ones
+template <>
+void ScoringProcessor::merge_pairs<2>(const std::vector<int>& /*segment_starts*/,
+                                      int num_pairs,
+                                      std::unordered_map<int, Collocation>* position_to_collocation,
+                                      std::unordered_map<int, double>* position_to_score)
+{
+  for (int i = 0; i < num_pairs; ++i) {
+    if (pair_scores_[i] >= alpha_) {
+      position_to_collocation->emplace(i, Collocation(pair_indices_[i], 2));
+      (*position_to_score)[i] = pair_scores_[i];
+    }
+  }
+}
+
+template <int kMaxSize>
+void ScoringProcessor::merge_pairs(const std::vector<int>& segment_starts,
+                                   int num_pairs,
+                                   std::unordered_map<int, Collocation>* position_to_collocation,
+                                   std::unordered_map<int, double>* position_to_score)
+{
+  const int max_size = kMaxSize > 0 ? kMaxSize : collocation_max_size_;
+  Heap token_pairs_heap(num_pairs);
+
+  // segments are merged one by one, so the heap keeps pairs of one segment only
+  for (int first_pair = 0; first_pair < num_pairs;) {
+    // the pair before the start of the next segment crosses the end of this one
+    auto next_segment_start = std::upper_bound(segment_starts.begin(), segment_starts.end(), first_pair);
+    int end_pair = next_segment_start == segment_starts.end() ? num_pairs : *next_segment_start - 1;
+    for (int i = first_pair; i < end_pair; ++i) {
+      if (pair_scores_[i] >= alpha_) {
+        token_pairs_heap.push({ { token_indices_[i], i }, { token_indices_[i + 1], i + 1 }, 1, 1, pair_scores_[i] });
       }
     }
+    // the pair crossing the end of segment is skipped
+    first_pair = end_pair + 1;
 
     while (!token_pairs_heap.empty()) {
       auto element = token_pairs_heap.pop();
 
       if (element.value < alpha_) {
-        position_to_collocation.emplace(element.indices_first.position_index,
+        position_to_collocation->emplace(element.indices_first.position_index,
           Collocation(element.indices_first.token_index, element.collocation_size_first));
 
-        position_to_collocation.emplace(element.indices_second.position_index,
+        position_to_collocation->emplace(element.indices_second.position_index,
           Collocation(element.indices_second.token_index, element.collocation_size_second));
 
         continue;
       }
 
-      auto collocation = Utils::join_strings({ *(dictionary_->get_token_unsafe(element.indices_first.token_index)),
-                                               *(dictionary_->get_token_unsafe(element.indices_second.token_index)) },
-                                             esc_character_);
+      std::string collocation;
+      join_tokens(dictionary_->get_token_unsafe(element.indices_first.token_index),
+                  dictionary_->get_token_unsafe(element.indices_second.token_index),
+                  &collocation);
 
       int collocation_index = *(dictionary_->get_index_unsafe(collocation));
       int collocation_size = element.collocation_size_first + element.collocation_size_second;
+      (*position_to_score)[element.indices_first.position_index] = element.value;
 
       auto left_element = token_pairs_heap.get_left_neighbour(element);
       auto right_element = token_pairs_heap.get_right_neighbour(element);
 
-      if ((left_element == nullptr && right_element == nullptr) || collocation_size >= collocation_max_size_) {
-        position_to_collocation.emplace(element.indices_first.position_index,
+      if ((left_element == nullptr && right_element == nullptr) || collocation_size >= max_size) {
+        position_to_collocation->emplace(element.indices_first.position_index,
           Collocation(collocation_index, collocation_size));
 
         continue;
@@ -110,7 +288,7 @@ std::shared_ptr<Batch> ScoringProcessor::process(const Batch& batch) {
 
         double score = compute_pair_score(token_index_left,
                                           collocation_index,
-                                          *(dictionary_->get_token_unsafe(token_index_left)),
+                                          dictionary_->get_token_unsafe(token_index_left),
                                           collocation);
 
         token_pairs_heap.erase(*left_element);
@@ -128,7 +306,7 @@ std::shared_ptr<Batch> ScoringProcessor::process(const Batch& batch) {
         double score = compute_pair_score(collocation_index,
                                           token_index_right,
                                           collocation,
-                                          *(dictionary_->get_token_unsafe(token_index_right)));
+                                          dictionary_->get_token_unsafe(token_index_right));
 
         token_pairs_heap.erase(*right_element);
 
@@ -139,17 +317,131 @@ std::shared_ptr<Batch> ScoringProcessor::process(const Batch& batch) {
                                 score });
       }
     }
+  }
+}
+
+ScoringProcessor::MergeFunction ScoringProcessor::get_merge_function(int collocation_max_size) {
+  static const MergeFunction kMergeFunctions[] = {
+    &ScoringProcessor::merge_pairs<0>,
+    &ScoringProcessor::merge_pairs<0>,
+    &ScoringProcessor::merge_pairs<2>,
+    &ScoringProcessor::merge_pairs<3>,
+    &ScoringProcessor::merge_pairs<4>
+  };
+  static const int kNumMergeFunctions = sizeof(kMergeFunctions) / sizeof(kMergeFunctions[0]);
+
+  return collocation_max_size >= 0 && collocation_max_size < kNumMergeFunctions
+    ? kMergeFunctions[collocation_max_size] : &ScoringProcessor::merge_pairs<0>;
+}
+
+void ScoringProcessor::segment(const Document& document, std::vector<int>* span_lengths) {
+  std::unordered_map<int, Collocation> position_to_collocation;
+  std::unordered_map<int, double> position_to_score;
+
+  segment_document(document, &position_to_collocation, &position_to_score);
+  get_span_lengths(position_to_collocation, document.tokens.size(), span_lengths);
+}
+
+void ScoringProcessor::segment_indices(const std::vector<int>& token_indices, std::vector<int>* span_lengths) {
+  std::unordered_map<int, Collocation> position_to_collocation;
+  std::unordered_map<int, double> position_to_score;
+
+  token_indices_ = token_indices;
+  bool has_absent_tokens = std::find(token_indices.begin(), token_indices.end(), -1) != token_indices.end();
+
+  merge_indexed_tokens(nullptr, std::vector<int>(), has_absent_tokens, &position_to_collocation, &position_to_score);
+  get_span_lengths(position_to_collocation, token_indices.size(), span_lengths);
+}
+
+std::shared_ptr<Batch> ScoringProcessor::process(const Batch& batch) {
+  std::unordered_map<int, Collocation> position_to_collocation;
+  // score of the last merge at each start position
+  std::unordered_map<int, double> position_to_score;
+  std::unordered_map<int, double> collocation_index_to_counter_local;
+  std::unordered_map<int, BatchScoreStats> collocation_index_to_score_stats_local;
+
+  // processed batch and output buffer are reused, the caller consumes them before the next call
+  if (processed_batch_ == nullptr) {
+    processed_batch_ = std::make_shared<Batch>(batch.delimiters);
+  } else {
+    processed_batch_->clear();
+  }
+  output_buffer_.clear();
+
+  for (const auto& document : batch.get_documents()) {
+    long num_copies = 1;
+    DocumentHash hash = { 0, 0 };
+    if (deduplicator_ != nullptr) {
+      hash = deduplicator_->get_hash(document.tokens);
+      num_copies = deduplicator_->get_num_copies(document.id, hash);
+    }
+
+    // repeated copies are counted with their first copy, only their output is needed
+    if (num_copies == 0 && !return_processed_batch_) {
+      continue;
+    }
+
+    if (num_copies == 0 && deduplicator_->get_segmentation(hash, &segmentation_)) {
+      int position = 0;
+      for (const auto& span : segmentation_) {
+        position_to_collocation.emplace(position, Collocation(span.first, span.second));
+        position += span.second;
+      }
+    } else {
+      segment_document(document, &position_to_collocation, &position_to_score);
+
+      if (num_copies != 1) {
+        segmentation_.clear();
+        for (int i = 0; i < document.tokens.size(); i += segmentation_.back().second) {
+          auto iter = position_to_collocation.find(i);
+          if (iter == position_to_collocation.end()) {
+            segmentation_.emplace_back(token_indices_[i], 1);
+          } else {
+            segmentation_.emplace_back(iter->second.collocation_index, iter->second.collocation_size);
+          }
+        }
+        deduplicator_->add_segmentation(hash, segmentation_);
+      }
+    }
 
     if (return_processed_batch_) {
-      add_processed_item(processed_batch, position_to_collocation, document);
+      if (output_format_ == OutputFormat::kBinary) {
+        serialize_binary(position_to_collocation, document);
+      } else if (return_indices_) {
+        serialize_indices(position_to_collocation, document, batch.delimiters[0]);
+      } else {
+        add_processed_item(position_to_collocation, document);
+      }
     }
 
-    for (const auto& index_collocation : position_to_collocation) {
-      collocation_index_to_counter_->increase(index_collocation.second.collocation_index, 1.0);
+    if (num_copies > 0) {
+      for (const auto& index_collocation : position_to_collocation) {
+        const auto& collocation = index_collocation.second;
+        collocation_index_to_counter_local[collocation.collocation_index] += num_copies;
+
+        if (collocation.collocation_size > 1) {
+          float score = position_to_score[index_collocation.first];
+          int64_t fixed_point_score = num_copies * ThreadSafeScoreStats::to_fixed_point(score);
+          auto iter = collocation_index_to_score_stats_local.find(collocation.collocation_index);
+
+          if (iter == collocation_index_to_score_stats_local.end()) {
+            collocation_index_to_score_stats_local.emplace(
+              collocation.collocation_index, BatchScoreStats{ score, num_copies * score, fixed_point_score });
+          } else {
+            iter->second.max_score = std::max(iter->second.max_score, score);
+            iter->second.sum_score += num_copies * score;
+            iter->second.fixed_point_sum_score += fixed_point_score;
+          }
+        }
+      }
     }
 
     position_to_collocation.clear();
+    position_to_score.clear();
   }
 
-  return return_processed_batch_ ? processed_batch : nullptr;
+  collocation_index_to_counter_->increase(collocation_index_to_counter_local);
+  collocation_index_to_score_stats_->add(collocation_index_to_score_stats_local);
+
+  return return_processed_batch_ && !is_serialized() ? processed_batch_ : nullptr;
 }
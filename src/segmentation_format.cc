@@ -0,0 +1,134 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <stdexcept>
+
+#include "include/segmentation_format.h"
+#include "include/utils.h"
+
+namespace {
+  const int kMaxVarintBytes = 10;
+}  // namespace
+
+OutputFormat SegmentationFormat::parse_output_format(const std::string& name) {
+  if (name.empty() || name == "text") {
+    return OutputFormat::kText;
+  }
+  if (name == "binary") {
+    return OutputFormat::kBinary;
+  }
+
+  throw std::runtime_error("Error: unknown output format: " + name);
+}
+
+void SegmentationFormat::append_varint(unsigned long value, std::string* output) {
+  while (value >= 0x80) {
+    *output += static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  *output += static_cast<char>(value);
+}
+
+void SegmentationFormat::append_document(long id, const std::vector<int>& span_lengths, std::string* output) {
+  // zigzag encoding keeps small negative ids short
+  unsigned long zigzag_id = (static_cast<unsigned long>(id) << 1) ^ static_cast<unsigned long>(id >> 63);
+
+  append_varint(zigzag_id, output);
+  append_varint(span_lengths.size(), output);
+  for (const auto& length : span_lengths) {
+    append_varint(length, output);
+  }
+}
+
+void SegmentationFormat::convert_to_text(const std::string& input_path,
+                                         const std::string& output_path,
+                                         char delimiter,
+                                         char esc_character)
+{
+  BinarySegmentationReader reader(input_path);
+
+  std::ofstream output_stream(output_path);
+  if (!output_stream.is_open()) {
+    throw std::runtime_error("Error: unable to open output file: " + output_path);
+  }
+
+  SegmentedDocument document;
+  std::string line;
+  while (reader.read(&document)) {
+    line.clear();
+    Utils::append_integer(document.id, &line);
+
+    for (const auto& span : document.spans) {
+      line += delimiter;
+      Utils::append_integer(span.begin, &line);
+      line += esc_character;
+      Utils::append_integer(span.length, &line);
+    }
+
+    line += '\n';
+    output_stream.write(line.data(), line.size());
+  }
+
+  output_stream.close();
+  if (output_stream.fail()) {
+    throw std::runtime_error("Error: unable to write output file: " + output_path);
+  }
+}
+
+BinarySegmentationReader::BinarySegmentationReader(const std::string& input_path)
+    : input_path_(input_path)
+    , input_stream_(input_path, std::ios::binary)
+{
+  if (!input_stream_.is_open()) {
+    throw std::runtime_error("Error: unable to open segmentation file: " + input_path);
+  }
+}
+
+bool BinarySegmentationReader::read(SegmentedDocument* document) {
+  unsigned long zigzag_id = 0;
+  if (!read_varint(&zigzag_id)) {
+    return false;
+  }
+
+  unsigned long num_spans = 0;
+  if (!read_varint(&num_spans)) {
+    throw std::runtime_error("Error: truncated segmentation file: " + input_path_);
+  }
+
+  document->id = static_cast<long>(zigzag_id >> 1) ^ -static_cast<long>(zigzag_id & 1);
+  document->spans.clear();
+
+  int begin = 0;
+  for (unsigned long i = 0; i < num_spans; ++i) {
+    unsigned long length = 0;
+    if (!read_varint(&length)) {
+      throw std::runtime_error("Error: truncated segmentation file: " + input_path_);
+    }
+
+    document->spans.emplace_back(begin, static_cast<int>(length));
+    begin += length;
+  }
+
+  return true;
+}
+
+bool BinarySegmentationReader::read_varint(unsigned long* value) {
+  auto buffer = input_stream_.rdbuf();
+  *value = 0;
+
+  for (int i = 0; i < kMaxVarintBytes; ++i) {
+    int byte = buffer->sbumpc();
+    if (byte == std::char_traits<char>::eof()) {
+      if (i > 0) {
+        throw std::runtime_error("Error: truncated segmentation file: " + input_path_);
+      }
+      return false;
+    }
+
+    *value |= static_cast<unsigned long>(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+
+  throw std::runtime_error("Error: invalid varint in segmentation file: " + input_path_);
+}
@@ -0,0 +1,67 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include "boost/thread/locks.hpp"
+
+#include "include/space_saving_counters.h"
+
+void SpaceSavingCounters::increase(const std::unordered_map<std::string, double>& key_to_value) {
+  boost::lock_guard<SpinLock> guard(lock_);
+  for (const auto& key_value : key_to_value) {
+    increase_unsafe(key_value.first, key_value.second);
+  }
+}
+
+std::vector<std::pair<std::string, SpaceSavingEntry>> SpaceSavingCounters::get_all() const {
+  boost::lock_guard<SpinLock> guard(lock_);
+
+  std::vector<std::pair<std::string, SpaceSavingEntry>> retval;
+  retval.reserve(key_to_entry_.size());
+  for (const auto& key_item : key_to_entry_) {
+    retval.push_back(std::make_pair(key_item.first, key_item.second.entry));
+  }
+
+  return retval;
+}
+
+double SpaceSavingCounters::total() const {
+  boost::lock_guard<SpinLock> guard(lock_);
+  return total_;
+}
+
+double SpaceSavingCounters::max_error() const {
+  boost::lock_guard<SpinLock> guard(lock_);
+  return key_to_entry_.size() < capacity_ ? 0.0 : count_to_key_.begin()->first;
+}
+
+size_t SpaceSavingCounters::size() const {
+  boost::lock_guard<SpinLock> guard(lock_);
+  return key_to_entry_.size();
+}
+
+void SpaceSavingCounters::increase_unsafe(const std::string& key, double value) {
+  total_ += value;
+
+  auto iter = key_to_entry_.find(key);
+  if (iter != key_to_entry_.end()) {
+    auto& item = iter->second;
+    item.entry.count += value;
+
+    count_to_key_.erase(item.count_iter);
+    item.count_iter = count_to_key_.emplace(item.entry.count, &(iter->first));
+    return;
+  }
+
+  SpaceSavingEntry entry = { value, 0.0 };
+  if (key_to_entry_.size() >= capacity_) {
+    // replace the key with the minimal count
+    auto min_iter = count_to_key_.begin();
+    entry = { min_iter->first + value, min_iter->first };
+
+    key_to_entry_.erase(key_to_entry_.find(*(min_iter->second)));
+    count_to_key_.erase(min_iter);
+  }
+
+  iter = key_to_entry_.emplace(key, Item()).first;
+  iter->second.entry = entry;
+  iter->second.count_iter = count_to_key_.emplace(entry.count, &(iter->first));
+}
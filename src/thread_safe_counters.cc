@@ -9,6 +9,10 @@
 
 const double* ThreadSafeCounters::get(int key) const {
   boost::lock_guard<SpinLock> guard(lock_);
+  return get_unsafe(key);
+}
+
+const double* ThreadSafeCounters::get_unsafe(int key) const {
   auto iter = index_to_counter_.find(key);
   if (iter != index_to_counter_.end()) {
     return &(iter->second);
@@ -39,11 +43,46 @@ void ThreadSafeCounters::increase(const std::unordered_map<int, double>& key_to_
   }
 }
 
+void ThreadSafeCounters::erase(const std::vector<int>& keys) {
+  boost::lock_guard<SpinLock> guard(lock_);
+  for (const auto& key : keys) {
+    index_to_counter_.erase(key);
+  }
+}
+
+void ThreadSafeCounters::remap_keys(const std::vector<int>& new_keys) {
+  boost::lock_guard<SpinLock> guard(lock_);
+
+  std::unordered_map<int, double> index_to_counter;
+  index_to_counter.reserve(index_to_counter_.size());
+  for (const auto& key_value : index_to_counter_) {
+    int key = key_value.first < new_keys.size() ? new_keys[key_value.first] : key_value.first;
+    index_to_counter.emplace(key, key_value.second);
+  }
+
+  index_to_counter_.swap(index_to_counter);
+}
+
+void ThreadSafeCounters::copy_from(const ThreadSafeCounters& other) {
+  boost::lock_guard<SpinLock> guard(lock_);
+  boost::lock_guard<SpinLock> other_guard(other.lock_);
+
+  index_to_counter_ = other.index_to_counter_;
+}
+
 size_t ThreadSafeCounters::size() const {
   boost::lock_guard<SpinLock> guard(lock_);
   return index_to_counter_.size();
 }
 
+size_t ThreadSafeCounters::get_memory_usage() const {
+  boost::lock_guard<SpinLock> guard(lock_);
+
+  // hash table node keeps the key, the value and the next pointer
+  size_t node_size = sizeof(void*) + sizeof(std::pair<int, double>);
+  return index_to_counter_.size() * node_size + index_to_counter_.bucket_count() * sizeof(void*);
+}
+
 bool ThreadSafeCounters::empty() const {
   boost::lock_guard<SpinLock> guard(lock_);
   return index_to_counter_.empty();
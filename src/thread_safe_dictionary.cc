@@ -1,5 +1,9 @@
 // Author: Murat Apishev (@mel-lain)
 
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
 #include "boost/thread/locks.hpp"
 
 #include "include/thread_safe_dictionary.h"
@@ -9,43 +13,153 @@ const int* ThreadSafeDictionary::get_index(const std::string& token) const {
   return get_index_unsafe(token);
 }
 
-const std::string* ThreadSafeDictionary::get_token(int index) const {
+boost::string_ref ThreadSafeDictionary::get_token(int index) const {
   boost::lock_guard<SpinLock> guard(lock_);
   return get_token_unsafe(index);
 }
 
-const int* ThreadSafeDictionary::get_index_unsafe(const std::string& token) const {
-    auto iter = token_to_index_.find(token);
-    if (iter != token_to_index_.end()) {
-        return &(iter->second);
+const int* ThreadSafeDictionary::get_index_unsafe(const std::string& token, uint32_t hash) const {
+  size_t mask = slots_.size() - 1;
+
+  for (size_t position = hash & mask; slots_[position].index >= 0; position = (position + 1) & mask) {
+    if (slots_[position].hash != hash) {
+      continue;
+    }
+
+    const auto& entry = entries_[slots_[position].index];
+    if (entry.size == token.size() &&
+        std::memcmp(chunks_[entry.chunk].data() + entry.position, token.data(), token.size()) == 0) {
+      return &(entry.index);
     }
+  }
+
+  return nullptr;
+}
+
+boost::string_ref ThreadSafeDictionary::get_token_unsafe(int index) const {
+  if (index >= 0 && index < entries_.size()) {
+    const auto& entry = entries_[index];
+    return boost::string_ref(chunks_[entry.chunk].data() + entry.position, entry.size);
+  }
+
+  return boost::string_ref();
+}
 
-    return nullptr;
+int ThreadSafeDictionary::add(const std::string& token) {
+  boost::lock_guard<SpinLock> guard(lock_);
+  return add_unsafe(token);
 }
 
-const std::string* ThreadSafeDictionary::get_token_unsafe(int index) const {
-    if (index < tokens_.size()) {
-        return &(tokens_[index]);
+int ThreadSafeDictionary::add_unsafe(const std::string& token) {
+  const int* index_ptr = get_index_unsafe(token);
+  if (index_ptr != nullptr) {
+    return *index_ptr;
+  }
+
+  // chunk is never reallocated, a token which doesn't fit into its capacity starts the next one
+  if (chunks_.empty() || chunks_.back().size() + token.size() > chunks_.back().capacity()) {
+    chunks_.emplace_back();
+    chunks_.back().reserve(token.size() > kChunkSize ? token.size() : kChunkSize);
+  }
+
+  auto& chunk = chunks_.back();
+  int index = entries_.size();
+  entries_.push_back({ static_cast<uint32_t>(chunks_.size() - 1),
+                       static_cast<uint32_t>(chunk.size()),
+                       static_cast<uint32_t>(token.size()),
+                       index });
+  chunk.insert(chunk.end(), token.begin(), token.end());
+
+  // the table is kept at most half full
+  if (2 * entries_.size() > slots_.size()) {
+    std::vector<Slot> old_slots(2 * slots_.size(), { 0, -1 });
+    old_slots.swap(slots_);
+
+    for (const auto& slot : old_slots) {
+      if (slot.index >= 0) {
+        add_slot(slot.hash, slot.index);
+      }
     }
+  }
+  add_slot(get_hash(token), index);
+  return index;
+}
 
-    return nullptr;
+void ThreadSafeDictionary::add_slot(uint32_t hash, int index) {
+  size_t mask = slots_.size() - 1;
+
+  size_t position = hash & mask;
+  while (slots_[position].index >= 0) {
+    position = (position + 1) & mask;
+  }
+  slots_[position] = { hash, index };
 }
 
-void ThreadSafeDictionary::add(const std::string& token) {
+std::vector<int> ThreadSafeDictionary::sort_tokens(int first_index, const std::function<bool(int, int)>& is_less) {
   boost::lock_guard<SpinLock> guard(lock_);
-  auto iter = token_to_index_.find(token);
-  if (iter == token_to_index_.end()) {
-    token_to_index_.emplace(std::make_pair(token, tokens_.size()));
-    tokens_.push_back(token);
+
+  std::vector<int> new_indices(entries_.size());
+  std::iota(new_indices.begin(), new_indices.end(), 0);
+  if (first_index >= entries_.size()) {
+    return new_indices;
   }
+
+  std::vector<Entry> sorted_entries(entries_.begin() + first_index, entries_.end());
+  std::sort(sorted_entries.begin(), sorted_entries.end(), [&](const Entry& first, const Entry& second) {
+    if (is_less(first.index, second.index)) {
+      return true;
+    }
+    if (is_less(second.index, first.index)) {
+      return false;
+    }
+
+    return boost::string_ref(chunks_[first.chunk].data() + first.position, first.size) <
+           boost::string_ref(chunks_[second.chunk].data() + second.position, second.size);
+  });
+
+  for (size_t i = 0; i < sorted_entries.size(); ++i) {
+    auto& entry = entries_[first_index + i];
+    entry = sorted_entries[i];
+    new_indices[entry.index] = first_index + i;
+    entry.index = first_index + i;
+  }
+
+  for (auto& slot : slots_) {
+    if (slot.index >= first_index) {
+      slot.index = new_indices[slot.index];
+    }
+  }
+
+  return new_indices;
+}
+
+void ThreadSafeDictionary::copy_from(const ThreadSafeDictionary& other) {
+  boost::lock_guard<SpinLock> guard(lock_);
+  boost::lock_guard<SpinLock> other_guard(other.lock_);
+
+  chunks_ = other.chunks_;
+  entries_ = other.entries_;
+  slots_ = other.slots_;
 }
 
 size_t ThreadSafeDictionary::size() const {
   boost::lock_guard<SpinLock> guard(lock_);
-  return token_to_index_.size();
+  return entries_.size();
+}
+
+size_t ThreadSafeDictionary::get_memory_usage() const {
+  boost::lock_guard<SpinLock> guard(lock_);
+
+  size_t memory_usage = chunks_.capacity() * sizeof(std::vector<char>) + entries_.size() * sizeof(Entry) +
+                        slots_.capacity() * sizeof(Slot);
+  for (const auto& chunk : chunks_) {
+    memory_usage += chunk.capacity();
+  }
+
+  return memory_usage;
 }
 
 bool ThreadSafeDictionary::empty() const {
   boost::lock_guard<SpinLock> guard(lock_);
-  return token_to_index_.empty();
+  return entries_.empty();
 }
@@ -0,0 +1,46 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <algorithm>
+
+#include "boost/thread/locks.hpp"
+
+#include "include/thread_safe_score_stats.h"
+
+void ThreadSafeScoreStats::add(const std::unordered_map<int, BatchScoreStats>& index_to_stats) {
+  boost::lock_guard<SpinLock> guard(lock_);
+  for (const auto& index_stats : index_to_stats) {
+    if (index_stats.first >= index_to_stats_.size()) {
+      index_to_stats_.resize(index_stats.first + 1, { 0.0f, 0.0f });
+      if (exact_sums_) {
+        index_to_fixed_point_sum_.resize(index_stats.first + 1, 0);
+      }
+    }
+
+    auto& stats = index_to_stats_[index_stats.first];
+    stats.max_score = std::max(stats.max_score, index_stats.second.max_score);
+    if (exact_sums_) {
+      index_to_fixed_point_sum_[index_stats.first] += index_stats.second.fixed_point_sum_score;
+    } else {
+      stats.sum_score += index_stats.second.sum_score;
+    }
+  }
+}
+
+ScoreStats ThreadSafeScoreStats::get(int index) const {
+  boost::lock_guard<SpinLock> guard(lock_);
+  if (index < 0 || index >= index_to_stats_.size()) {
+    return { 0.0f, 0.0f };
+  }
+
+  if (exact_sums_) {
+    return { index_to_stats_[index].max_score,
+             static_cast<float>(index_to_fixed_point_sum_[index] / kFixedPointScale) };
+  }
+
+  return index_to_stats_[index];
+}
+
+size_t ThreadSafeScoreStats::size() const {
+  boost::lock_guard<SpinLock> guard(lock_);
+  return index_to_stats_.size();
+}
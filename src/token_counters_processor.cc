@@ -1,5 +1,6 @@
 // Author: Murat Apishev (@mel-lain)
 
+#include <algorithm>
 #include <unordered_map>
 
 #include "boost/range/algorithm_ext/push_back.hpp"
@@ -9,16 +10,33 @@
 
 std::shared_ptr<Batch> TokenCountersProcessor::process(const Batch& batch) {
   std::unordered_map<int, double> index_to_counter_local;
+  std::unordered_map<int, double> index_to_df_local;
 
   for (const auto& document : batch.get_documents()) {
-    collocation_start_indices_->add_indices(
-      document.id, std::vector<int>(1, static_cast<int>(document.tokens.size())));
+    if (deduplicator_ != nullptr && !deduplicator_->add(document.id, document.tokens)) {
+      collocation_start_indices_->add_indices(document.id, std::vector<int>());
+    } else {
+      collocation_start_indices_->add_indices(
+        document.id, std::vector<int>(1, static_cast<int>(document.tokens.size())));
+    }
 
+    document_indices_.clear();
     for (const auto& token : document.tokens) {
       dictionary_->add(token);
       const int* index = dictionary_->get_index(token);
 
       ++index_to_counter_local[*index];
+      if (index_to_df_ != nullptr) {
+        document_indices_.push_back(*index);
+      }
+    }
+
+    if (index_to_df_ != nullptr) {
+      std::sort(document_indices_.begin(), document_indices_.end());
+      auto end = std::unique(document_indices_.begin(), document_indices_.end());
+      for (auto iter = document_indices_.begin(); iter != end; ++iter) {
+        ++index_to_df_local[*iter];
+      }
     }
   }
 
@@ -28,6 +46,10 @@ std::shared_ptr<Batch> TokenCountersProcessor::process(const Batch& batch) {
   }
 
   index_to_counter_->increase(index_to_counter_local);
+  if (index_to_df_ != nullptr) {
+    index_to_df_->increase(index_to_df_local);
+    *num_documents_ += batch.size();
+  }
 
   *total_collection_size_ += static_cast<long>(counter);
 
@@ -0,0 +1,43 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <fstream>
+#include <stdexcept>
+
+#include "include/token_mask.h"
+
+void TokenMask::mask(int index) {
+  if (index >= is_masked_.size()) {
+    is_masked_.resize(index + 1, false);
+  }
+
+  if (!is_masked_[index]) {
+    is_masked_[index] = true;
+    ++num_masked_;
+  }
+}
+
+std::vector<int> TokenMask::get_masked_indices() const {
+  std::vector<int> indices;
+  indices.reserve(num_masked_);
+  for (int index = 0; index < is_masked_.size(); ++index) {
+    if (is_masked_[index]) {
+      indices.push_back(index);
+    }
+  }
+
+  return indices;
+}
+
+std::vector<std::string> TokenMask::load_stop_words(const std::string& path) {
+  std::ifstream input_stream(path);
+  if (!input_stream.is_open()) {
+    throw std::runtime_error("Error: unable to open file with stop words: " + path);
+  }
+
+  std::vector<std::string> stop_words;
+  for (std::string word; input_stream >> word;) {
+    stop_words.push_back(word);
+  }
+
+  return stop_words;
+}
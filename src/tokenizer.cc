@@ -0,0 +1,206 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOPMINE_X86 1
+#endif
+
+#include "include/tokenizer.h"
+
+Tokenizer::Tokenizer(const std::string& delimiters, TokenizerKernel kernel)
+    : delimiters_(delimiters)
+    , kernel_(kernel)
+    , block_mask_(nullptr)
+{
+  std::memset(is_delimiter_, 0, sizeof(is_delimiter_));
+  for (const auto& c : delimiters_) {
+    is_delimiter_[static_cast<unsigned char>(c)] = true;
+  }
+
+  if (kernel_ == TokenizerKernel::kAuto) {
+    if (delimiters_.size() > kMaxSimdDelimiters) {
+      kernel_ = TokenizerKernel::kScalar;
+    } else if (is_kernel_supported(TokenizerKernel::kAvx2)) {
+      kernel_ = TokenizerKernel::kAvx2;
+    } else if (is_kernel_supported(TokenizerKernel::kSse2)) {
+      kernel_ = TokenizerKernel::kSse2;
+    } else {
+      kernel_ = TokenizerKernel::kScalar;
+    }
+  }
+
+  if (!is_kernel_supported(kernel_)) {
+    throw std::runtime_error("Error: requested tokenizer kernel is not supported by this CPU");
+  }
+
+  if (kernel_ != TokenizerKernel::kScalar && delimiters_.size() > kMaxSimdDelimiters) {
+    throw std::runtime_error("Error: too many delimiters for vectorized tokenizer: " + delimiters_);
+  }
+
+  switch (kernel_) {
+    case TokenizerKernel::kAvx2:
+      block_mask_ = &Tokenizer::block_mask_avx2;
+      break;
+
+    case TokenizerKernel::kSse2:
+      block_mask_ = &Tokenizer::block_mask_sse2;
+      break;
+
+    default:
+      block_mask_ = &Tokenizer::block_mask_scalar;
+      break;
+  }
+}
+
+void Tokenizer::split(const char* data, size_t size, std::vector<TokenSpan>* spans) const {
+  // carry is 1 if the last char of the previous block belongs to a token
+  uint64_t carry = 0;
+  int token_begin = 0;
+
+  for (size_t offset = 0; offset < size; offset += kBlockSize) {
+    uint64_t delimiters_mask = 0;
+    size_t block_size = size - offset;
+
+    if (block_size >= kBlockSize) {
+      delimiters_mask = block_mask_(data + offset, *this);
+    } else {
+      char block[kBlockSize] = { 0 };
+      std::memcpy(block, data + offset, block_size);
+
+      // chars after the end of line are treated as delimiters
+      delimiters_mask = block_mask_(block, *this) | (~0ULL << block_size);
+    }
+
+    uint64_t tokens_mask = ~delimiters_mask;
+    uint64_t shifted_tokens_mask = (tokens_mask << 1) | carry;
+
+    uint64_t events = (tokens_mask & ~shifted_tokens_mask) | (delimiters_mask & shifted_tokens_mask);
+    while (events != 0) {
+      int position = __builtin_ctzll(events);
+      events &= events - 1;
+
+      int index = static_cast<int>(offset) + position;
+      if ((tokens_mask >> position) & 1ULL) {
+        token_begin = index;
+      } else {
+        spans->emplace_back(token_begin, index - token_begin);
+      }
+    }
+
+    carry = tokens_mask >> (kBlockSize - 1);
+  }
+
+  if (carry != 0) {
+    spans->emplace_back(token_begin, static_cast<int>(size) - token_begin);
+  }
+}
+
+bool Tokenizer::parse_id(const char* data, size_t size, long* id) {
+  if (size == 0) {
+    return false;
+  }
+
+  size_t index = 0;
+  bool is_negative = (data[0] == '-');
+  if (data[0] == '-' || data[0] == '+') {
+    ++index;
+  }
+
+  if (index == size) {
+    return false;
+  }
+
+  unsigned long value = 0;
+  for (; index < size; ++index) {
+    unsigned digit = static_cast<unsigned char>(data[index]) - '0';
+    if (digit > 9) {
+      return false;
+    }
+
+    if (value > (static_cast<unsigned long>(LONG_MAX) - digit) / 10) {
+      return false;
+    }
+    value = value * 10 + digit;
+  }
+
+  *id = is_negative ? -static_cast<long>(value) : static_cast<long>(value);
+  return true;
+}
+
+bool Tokenizer::is_kernel_supported(TokenizerKernel kernel) {
+  switch (kernel) {
+    case TokenizerKernel::kAuto:
+    case TokenizerKernel::kScalar:
+      return true;
+
+#ifdef TOPMINE_X86
+    case TokenizerKernel::kSse2:
+      return __builtin_cpu_supports("sse2");
+
+    case TokenizerKernel::kAvx2:
+      return __builtin_cpu_supports("avx2");
+#endif
+
+    default:
+      return false;
+  }
+}
+
+uint64_t Tokenizer::block_mask_scalar(const char* block, const Tokenizer& tokenizer) {
+  uint64_t mask = 0;
+  for (int i = 0; i < kBlockSize; ++i) {
+    if (tokenizer.is_delimiter_[static_cast<unsigned char>(block[i])]) {
+      mask |= 1ULL << i;
+    }
+  }
+
+  return mask;
+}
+
+#ifdef TOPMINE_X86
+__attribute__((target("sse2")))
+uint64_t Tokenizer::block_mask_sse2(const char* block, const Tokenizer& tokenizer) {
+  uint64_t mask = 0;
+  for (int i = 0; i < kBlockSize; i += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+    __m128i matches = _mm_setzero_si128();
+
+    for (const auto& c : tokenizer.delimiters_) {
+      matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+    }
+
+    mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(matches))) << i;
+  }
+
+  return mask;
+}
+
+__attribute__((target("avx2")))
+uint64_t Tokenizer::block_mask_avx2(const char* block, const Tokenizer& tokenizer) {
+  uint64_t mask = 0;
+  for (int i = 0; i < kBlockSize; i += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+    __m256i matches = _mm256_setzero_si256();
+
+    for (const auto& c : tokenizer.delimiters_) {
+      matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c)));
+    }
+
+    mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(matches))) << i;
+  }
+
+  return mask;
+}
+#else
+uint64_t Tokenizer::block_mask_sse2(const char* block, const Tokenizer& tokenizer) {
+  return block_mask_scalar(block, tokenizer);
+}
+
+uint64_t Tokenizer::block_mask_avx2(const char* block, const Tokenizer& tokenizer) {
+  return block_mask_scalar(block, tokenizer);
+}
+#endif
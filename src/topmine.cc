@@ -2,11 +2,14 @@
 
 #include <iostream>
 
-#include <boost/filesystem.hpp>
 #include "boost/program_options.hpp"
 
+#include "include/collection_processor.h"
+#include "include/collocations_writer.h"
 #include "include/common.h"
+#include "include/huge_page_memory.h"
 #include "include/parameters.h"
+#include "include/segmentation_format.h"
 #include "include/topmine_impl.h"
 
 namespace po = boost::program_options;
@@ -18,7 +21,9 @@ bool parse_parameters(int argc, char* argv[], Parameters* parameters) {
 
     ("input-path",
       po::value(&parameters->input_path)->default_value(""),
-      (std::string("Path to txt file with sentences.\n\n") +
+      (std::string("Path to txt file with sentences (may be compressed with gzip or zstd).\n\n") +
+       std::string("Can also be a directory, a glob pattern of file names or '@<file with paths>', ") +
+       std::string("in this case files are distributed between threads.\n") +
        std::string("Each line is one sentence with tokens separated by any number of <delimiters> chars.\n") +
        std::string("First element in each line should be a long integer id of the sentence.\n") +
        std::string("The input file should not contain <esc_character>!\n") +
@@ -43,6 +48,22 @@ bool parse_parameters(int argc, char* argv[], Parameters* parameters) {
       po::value(&parameters->collocation_max_size)->default_value(2),
       "Max size of collocations to search for.\n")
 
+    ("collocation-sizes-per-pass",
+      po::value(&parameters->collocation_sizes_per_pass)->default_value(1),
+      (std::string("Number of collocation sizes counted during one pass through collection.\n\n") +
+       std::string("Values greater than 1 reduce the number of passes, but speculatively count ") +
+       std::string("more candidates, so dictionary uses more memory. The result does not depend on it.\n")).c_str())
+
+    ("heavy-hitters-memory-mb",
+      po::value(&parameters->heavy_hitters_memory_mb)->default_value(0),
+      (std::string("Memory limit (Mb) for approximate counting of collocations of each size.\n\n") +
+       std::string("If positive, collocations are counted by Space-Saving heavy hitters summary ") +
+       std::string("of bounded size instead of exact counters, error bounds are reported after each pass.\n")).c_str())
+
+    ("heavy-hitters-verify",
+      po::value(&parameters->heavy_hitters_verify)->default_value(0),
+      "Recount collocations kept by heavy hitters summary exactly with additional pass.\n")
+
     ("num-threads",
       po::value(&parameters->num_threads)->default_value(1),
       "Number of parallel threads.\n")
@@ -73,7 +94,148 @@ bool parse_parameters(int argc, char* argv[], Parameters* parameters) {
 
     ("esc-character",
       po::value(&parameters->esc_character)->default_value('|'),
-      "Escaped character for technical issues and output collocations representation.\n");
+      "Escaped character for technical issues and output collocations representation.\n")
+
+    ("num-decompression-threads",
+      po::value(&parameters->num_decompression_threads)->default_value(2),
+      "Number of threads to decompress frames of zstd input in parallel.\n")
+
+    ("num-parser-threads",
+      po::value(&parameters->num_parser_threads)->default_value(0),
+      (std::string("Number of threads to parse input documents.\n\n") +
+       std::string("If positive, plain text input file is read by a dedicated thread and parsed ") +
+       std::string("by this number of threads in parallel with processing, otherwise each ") +
+       std::string("processing thread reads and parses its own batches.\n")).c_str())
+
+    ("output-format",
+      po::value(&parameters->output_format)->default_value("text"),
+      (std::string("Format of file with resulting sentences: 'text' or 'binary'.\n\n") +
+       std::string("Binary format contains for each sentence varints of its id, number of n-grams ") +
+       std::string("and lengths of n-grams, it can be converted into text format with indices ") +
+       std::string("by 'convert' mode.\n")).c_str())
+
+    ("pin-threads",
+      po::value(&parameters->pin_threads)->default_value(0),
+      (std::string("Pin worker threads to CPUs.\n\n") +
+       std::string("Workers fill NUMA nodes one by one, workers reading input by themselves ") +
+       std::string("allocate batches in memory of their nodes.\n")).c_str())
+
+    ("numa-replicas",
+      po::value(&parameters->numa_replicas)->default_value(0),
+      (std::string("Replicate dictionary and counters on each NUMA node for the scoring pass, ") +
+       std::string("so workers read local memory. Requires 'pin-threads', uses memory for ") +
+       std::string("one more copy of the tables per node.\n")).c_str())
+
+    ("huge-pages",
+      po::value(&parameters->huge_pages)->default_value("none"),
+      (std::string("Huge pages for the table of collocation counters: 'none', 'transparent' or 'explicit'.\n\n") +
+       std::string("Transparent mode asks the kernel to back the table by huge pages (madvise), explicit ") +
+       std::string("mode takes them from the reserved pool (vm.nr_hugepages) and falls back to transparent ") +
+       std::string("mode if the pool is exhausted.\n")).c_str())
+
+    ("dedup",
+      po::value(&parameters->dedup)->default_value(0),
+      (std::string("Find repeated documents (equal sequences of tokens) on the first pass and process ") +
+       std::string("each of them once on the next passes, counting it with the number of its copies. ") +
+       std::string("Repeated copies reuse the transformation of the first one. Only for 'full' mode.\n")).c_str())
+
+    ("checkpoint-path",
+      po::value(&parameters->checkpoint_path)->default_value(""),
+      (std::string("Path to binary file for storing the state after each stage of counting ") +
+       std::string("(tokens and each group of collocation sizes), so the run can be resumed ") +
+       std::string("by 'resume-from'. Each checkpoint replaces the previous one. Only for 'full' mode.\n")).c_str())
+
+    ("resume-from",
+      po::value(&parameters->resume_from)->default_value(""),
+      (std::string("Path to checkpoint file to resume the run from: the finished stages of counting are ") +
+       std::string("skipped. Input, counting parameters, 'dedup', 'stop-words-path', 'min-unigram-df', ") +
+       std::string("'max-unigram-ratio', 'delimiters', 'esc-character', 'deterministic' and 'boundaries' should ") +
+       std::string("be the same as in the interrupted run.\n")).c_str())
+
+    ("memory-limit-mb",
+      po::value(&parameters->memory_limit_mb)->default_value(0),
+      (std::string("Budget (Mb) for counters of collocations of a counting pass: the table of the pass takes ") +
+       std::string("at most the given value minus memory of dictionary, counters and data cache (at least 1/64 ") +
+       std::string("of it), the rest is spilled as sorted runs into temporary files near the output file and ") +
+       std::string("merged at the end of the pass. It is not a bound of process memory: merged counts are added ") +
+       std::string("into dictionary and counters, which are kept in memory, so they grow beyond the value on ") +
+       std::string("large collections. Memory usage is printed after each pass.\n")).c_str())
+
+    ("deterministic",
+      po::value(&parameters->deterministic)->default_value(0),
+      (std::string("Make output independent of the number of threads and their timing: tokens are indexed ") +
+       std::string("by decreasing frequency, collocations of each counting stage by their hashes, documents ") +
+       std::string("are written in input order and sums of scores are exact. Can't be used with heavy hitters.\n")).c_str())
+
+    ("stop-words-path",
+      po::value(&parameters->stop_words_path)->default_value(""),
+      (std::string("Path to file with stop words separated by whitespaces or line breaks. Stop words are ") +
+       std::string("masked after counting of tokens: they are not parts of collocations and split documents ") +
+       std::string("into parts, but are kept in resulting sentences. Only for 'full' mode.\n")).c_str())
+
+    ("min-unigram-df",
+      po::value(&parameters->min_unigram_df)->default_value(0),
+      "Mask tokens contained in less than <min-unigram-df> documents, as stop words. Only for 'full' mode.\n")
+
+    ("max-unigram-ratio",
+      po::value(&parameters->max_unigram_ratio)->default_value(0.0),
+      (std::string("Mask tokens contained in more than <max-unigram-ratio> share of documents ") +
+       std::string("(no masking if 0), as stop words. Only for 'full' mode.\n")).c_str())
+
+    ("boundaries",
+      po::value(&parameters->boundaries)->default_value(""),
+      (std::string("Chars splitting documents into segments, e.g. punctuation '.,;:!?'. They separate tokens ") +
+       std::string("as <delimiters> and collocations never cross them, so there are less candidates ") +
+       std::string("and the merges of each segment are done separately. Can't be used with 'dedup'.\n")).c_str())
+
+    ("mode",
+      po::value(&parameters->mode)->default_value(kModeFull),
+      (std::string("Mode of launch: 'full', 'count', 'merge', 'score' or 'convert'.\n\n") +
+       std::string("'full' processes the whole collection in one process. Other modes split it ") +
+       std::string("into rounds for corpus shards processed by separate processes or nodes:\n") +
+       std::string("'count' counts collocations of the next size on the shard <input-path> using ") +
+       std::string("the merged counts <model-path> of the previous sizes (tokens if no model) and ") +
+       std::string("stores them into <counts-output-path>;\n") +
+       std::string("'merge' sums partial counts <input-path> of all shards, adds them to <model-path> ") +
+       std::string("and stores the result into <counts-output-path>, <threshold> is saved with it;\n") +
+       std::string("'score' extracts collocations from <input-path> using final merged counts <model-path>.\n") +
+       std::string("'convert' converts binary file <input-path> with resulting sentences into text ") +
+       std::string("format with indices <output-path>.\n")).c_str())
+
+    ("model-path",
+      po::value(&parameters->model_path)->default_value(""),
+      "Path to file with merged counts of the previous rounds (modes 'count', 'merge' and 'score').\n")
+
+    ("counts-output-path",
+      po::value(&parameters->counts_output_path)->default_value(""),
+      "Path to file for output counts (modes 'count' and 'merge').\n")
+
+    ("collocations-order",
+      po::value(&parameters->collocations_order)->default_value("none"),
+      (std::string("Order of collocations in output file: 'none', 'df', 'score' or 'lexicographic'.\n\n") +
+       std::string("'df' and 'score' sort collocations in descending order, 'score' is the max ") +
+       std::string("significance score of the merges which produced the collocation.\n")).c_str())
+
+    ("min-df",
+      po::value(&parameters->min_df)->default_value(0),
+      "Min df of collocation to be stored into output file.\n")
+
+    ("top-n",
+      po::value(&parameters->top_n)->default_value(0),
+      "Max number of first collocations in output file (all if 0), requires sorted order.\n")
+
+    ("collocations-stats",
+      po::value(&parameters->collocations_stats)->default_value(0),
+      (std::string("Store score statistics of collocations into output file.\n\n") +
+       std::string("Output line format becomes '<collocation> <df> <max_score> <mean_score> <frequency>', ") +
+       std::string("where scores are significance scores of the merges which produced the collocation ") +
+       std::string("and frequency is the raw number of its occurrences in collection.\n")).c_str())
+
+    ("sort-memory-mb",
+      po::value(&parameters->sort_memory_mb)->default_value(0),
+      (std::string("Memory limit (Mb) for sorting of output collocations.\n\n") +
+       std::string("If positive, sorted runs of collocations are spilled into temporary files ") +
+       std::string("near the output file and merged.\n")).c_str());
 
   po::variables_map variables_map;
   store(po::command_line_parser(argc, argv).options(all_options).run(), variables_map);
@@ -89,14 +251,33 @@ bool parse_parameters(int argc, char* argv[], Parameters* parameters) {
 }
 
 void check_parameters(const Parameters& parameters) {
-  if (!boost::filesystem::exists(parameters.input_path)) {
-    throw std::runtime_error("Error: input file does not exist: " + parameters.input_path);
-  }
+  // throws if there are no input files
+  CollectionProcessor::list_input_files(parameters.input_path);
 
   if (parameters.num_threads <= 0) {
     throw std::runtime_error("Error: num_threads should be a positive integer");
   }
 
+  if (parameters.num_decompression_threads <= 0) {
+    throw std::runtime_error("Error: num_decompression_threads should be a positive integer");
+  }
+
+  if (parameters.num_parser_threads < 0) {
+    throw std::runtime_error("Error: num_parser_threads should be a non-negative integer");
+  }
+
+  if (parameters.collocation_sizes_per_pass <= 0) {
+    throw std::runtime_error("Error: collocation_sizes_per_pass should be a positive integer");
+  }
+
+  if (parameters.heavy_hitters_memory_mb < 0) {
+    throw std::runtime_error("Error: heavy_hitters_memory_mb should be a non-negative integer");
+  }
+
+  if (parameters.heavy_hitters_memory_mb > 0 && parameters.collocation_sizes_per_pass > 1) {
+    throw std::runtime_error("Error: approximate counting supports only one collocation size per pass");
+  }
+
   if (parameters.collocation_max_size <= 0) {
     throw std::runtime_error("Error: collocation_max_size should be a positive integer");
   }
@@ -108,6 +289,89 @@ void check_parameters(const Parameters& parameters) {
   if (parameters.alpha < kEps) {
     throw std::runtime_error("Error: alpha should be a positive float");
   }
+
+  if (parameters.mode != kModeFull && parameters.mode != kModeCount && parameters.mode != kModeMerge &&
+      parameters.mode != kModeScore && parameters.mode != kModeConvert) {
+    throw std::runtime_error("Error: unknown mode: " + parameters.mode);
+  }
+
+  if ((parameters.mode == kModeCount || parameters.mode == kModeMerge) && parameters.counts_output_path.empty()) {
+    throw std::runtime_error("Error: counts_output_path should be set in count and merge modes");
+  }
+
+  if (parameters.mode == kModeConvert && parameters.output_path.empty()) {
+    throw std::runtime_error("Error: output_path should be set in convert mode");
+  }
+
+  if (parameters.numa_replicas && !parameters.pin_threads) {
+    throw std::runtime_error("Error: numa_replicas requires pin_threads");
+  }
+
+  // throws if format is unknown
+  SegmentationFormat::parse_output_format(parameters.output_format);
+
+  // throws if mode is unknown
+  HugePageMemory::parse_mode(parameters.huge_pages);
+
+  if (parameters.mode == kModeScore && parameters.model_path.empty()) {
+    throw std::runtime_error("Error: model_path should be set in score mode");
+  }
+
+  if (parameters.mode == kModeFull && !parameters.model_path.empty()) {
+    throw std::runtime_error("Error: model_path can't be used in full mode");
+  }
+
+  if (parameters.dedup && parameters.mode != kModeFull) {
+    throw std::runtime_error("Error: dedup can be used only in full mode");
+  }
+
+  if ((!parameters.checkpoint_path.empty() || !parameters.resume_from.empty()) && parameters.mode != kModeFull) {
+    throw std::runtime_error("Error: checkpoints can be used only in full mode");
+  }
+
+  // throws if order is unknown
+  auto collocations_order = CollocationsWriter::parse_order(parameters.collocations_order);
+
+  if (parameters.min_df < 0) {
+    throw std::runtime_error("Error: min_df should be a non-negative integer");
+  }
+
+  if (parameters.top_n < 0) {
+    throw std::runtime_error("Error: top_n should be a non-negative integer");
+  }
+
+  if (parameters.top_n > 0 && collocations_order == CollocationsOrder::kNone) {
+    throw std::runtime_error("Error: top_n requires sorted collocations order");
+  }
+
+  if (parameters.sort_memory_mb < 0) {
+    throw std::runtime_error("Error: sort_memory_mb should be a non-negative integer");
+  }
+
+  if (parameters.memory_limit_mb < 0) {
+    throw std::runtime_error("Error: memory_limit_mb should be a non-negative integer");
+  }
+
+  if (parameters.deterministic && parameters.heavy_hitters_memory_mb > 0) {
+    throw std::runtime_error("Error: deterministic mode can't be used with heavy hitters");
+  }
+
+  if (parameters.min_unigram_df < 0) {
+    throw std::runtime_error("Error: min_unigram_df should be a non-negative integer");
+  }
+
+  if (parameters.max_unigram_ratio < 0.0 || parameters.max_unigram_ratio > 1.0) {
+    throw std::runtime_error("Error: max_unigram_ratio should be a float from 0 to 1");
+  }
+
+  if (!parameters.boundaries.empty() && parameters.dedup) {
+    throw std::runtime_error("Error: boundaries can't be used with dedup");
+  }
+
+  if ((!parameters.stop_words_path.empty() || parameters.min_unigram_df > 0 || parameters.max_unigram_ratio > 0.0) &&
+      parameters.mode != kModeFull) {
+    throw std::runtime_error("Error: token filtering can be used only in full mode");
+  }
 }
 
 void print_parameters(const Parameters& parameters) {
@@ -142,8 +406,8 @@ void print_parameters(const Parameters& parameters) {
 }
 
 int main(int argc, char* argv[]) {
-  // read and check parameters
-  Parameters parameters;
+  // read and check parameters, the ones without command line options are value-initialized
+  Parameters parameters = Parameters();
   bool is_help_call = parse_parameters(argc, argv, &parameters);
   if (is_help_call) {
     return 0;
@@ -0,0 +1,393 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include <exception>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/thread/lock_guard.hpp"
+
+#include "include/common.h"
+#include "include/spinlock.h"
+#include "include/tokenizer.h"
+#include "include/topmine_model.h"
+
+#include "include/topmine_c_api.h"
+
+struct topmine_model {
+  topmine_model(const std::shared_ptr<TopmineModel>& _model, const std::string& _delimiters)
+      : model(_model)
+      , delimiters(_delimiters)
+      , id_to_index()
+      , large_id_to_index()
+      , lock()
+      , free_scoring_processors() { }
+
+  std::shared_ptr<TopmineModel> model;
+  // delimiters of text documents segmented by the model
+  std::string delimiters;
+  // indices in the dictionary of the ids present in the model (-1 for absent ones), so documents
+  // of ids are segmented without tokens, ids above twice the dictionary size are kept in the map
+  std::vector<int> id_to_index;
+  std::unordered_map<int32_t, int> large_id_to_index;
+  // scoring processors are reused by the calls of segmentation, each call takes its own one
+  mutable SpinLock lock;
+  mutable std::vector<std::shared_ptr<ScoringProcessor>> free_scoring_processors;
+};
+
+namespace {
+  thread_local std::string last_error;
+
+  // wraps C++ exceptions into the return codes of C API
+  template <typename Function>
+  int call(const Function& function) {
+    last_error.clear();
+    try {
+      function();
+      return 0;
+    } catch (const std::exception& error) {
+      last_error = error.what();
+    } catch (...) {
+      last_error = "Error: unknown exception";
+    }
+
+    return -1;
+  }
+
+  void check_not_null(const void* pointer, const char* name) {
+    if (pointer == nullptr) {
+      throw std::runtime_error(std::string("Error: ") + name + " should not be NULL");
+    }
+  }
+
+  Parameters get_parameters(const topmine_options* options, const std::string& input_path) {
+    check_not_null(options, "options");
+    check_not_null(options->delimiters, "delimiters");
+
+    if (options->collocation_max_size < 0 || options->num_threads <= 0 || options->batch_size <= 0) {
+      throw std::runtime_error("Error: collocation_max_size should be non-negative, "
+                               "num_threads and batch_size should be positive");
+    }
+
+    return {
+      input_path,                     // input_path
+      "",                             // output_path
+      "",                             // collocations_output_path
+      options->collocation_max_size,  // collocation_max_size
+      options->num_threads,           // num_threads
+      options->batch_size,            // batch_size
+      options->threshold,             // threshold
+      options->alpha,                 // alpha
+      false,                          // return_indices
+      false,                          // use_cache
+      options->delimiters,            // delimiters
+      options->esc_character,         // esc_character
+      2,                              // num_decompression_threads
+      0,                              // num_parser_threads
+      1,                              // collocation_sizes_per_pass
+      0,                              // heavy_hitters_memory_mb
+      false,                          // heavy_hitters_verify
+      kModeFull,                      // mode
+      "",                             // model_path
+      "",                             // counts_output_path
+      "none",                         // collocations_order
+      0,                              // min_df
+      0,                              // top_n
+      0,                              // sort_memory_mb
+      false,                          // collocations_stats
+      "text",                         // output_format
+      false,                          // pin_threads
+      false,                          // numa_replicas
+      "none",                         // huge_pages
+      false,                          // dedup
+      "",                             // checkpoint_path
+      "",                             // resume_from
+      0,                              // memory_limit_mb
+      false,                          // deterministic
+      "",                             // stop_words_path
+      0,                              // min_unigram_df
+      0.0,                            // max_unigram_ratio
+      "",                             // boundaries
+      true                            // quiet
+    };
+  }
+
+  // tokens of documents made of ids are their decimal strings
+  void fill_document(const int32_t* token_ids, int64_t begin, int64_t end, Document* document) {
+    document->tokens.resize(end - begin);
+    for (int64_t i = begin; i < end; ++i) {
+      document->tokens[i - begin] = std::to_string(token_ids[i]);
+    }
+  }
+
+  // ids are mapped to indices of their tokens once for all calls of segmentation, the vector
+  // is bounded by twice the dictionary size
+  topmine_model* create_model(const std::shared_ptr<TopmineModel>& model, const std::string& delimiters) {
+    std::unique_ptr<topmine_model> result(new topmine_model(model, delimiters));
+
+    const auto& dictionary = model->get_dictionary();
+    const int dictionary_size = static_cast<int>(dictionary->size());
+    const long max_id = 2 * static_cast<long>(dictionary_size);
+    for (int index = 0; index < dictionary_size; ++index) {
+      auto token = dictionary->get_token_unsafe(index);
+
+      long id = 0;
+      if (!Tokenizer::parse_id(token.data(), token.size(), &id) || id < 0 ||
+          id > std::numeric_limits<int32_t>::max() || std::to_string(id) != token) {
+        continue;
+      }
+
+      if (id < max_id) {
+        if (id >= static_cast<long>(result->id_to_index.size())) {
+          result->id_to_index.resize(id + 1, -1);
+        }
+        result->id_to_index[id] = index;
+      } else {
+        result->large_id_to_index[static_cast<int32_t>(id)] = index;
+      }
+    }
+
+    return result.release();
+  }
+
+  // index of token with the id in the dictionary of the model, -1 if it is absent
+  int get_token_index(const topmine_model& model, int32_t id) {
+    if (id >= 0 && id < static_cast<int64_t>(model.id_to_index.size())) {
+      return model.id_to_index[id];
+    }
+
+    auto iter = model.large_id_to_index.find(id);
+    return iter != model.large_id_to_index.end() ? iter->second : -1;
+  }
+
+  // takes a free scoring processor of the model for one call of segmentation and returns it back
+  class ScoringProcessorGuard : boost::noncopyable {
+   public:
+    explicit ScoringProcessorGuard(const topmine_model* model)
+        : model_(model)
+        , scoring_processor_()
+    {
+      boost::lock_guard<SpinLock> guard(model_->lock);
+      if (!model_->free_scoring_processors.empty()) {
+        scoring_processor_ = model_->free_scoring_processors.back();
+        model_->free_scoring_processors.pop_back();
+      }
+    }
+
+    ~ScoringProcessorGuard() {
+      if (scoring_processor_ != nullptr) {
+        boost::lock_guard<SpinLock> guard(model_->lock);
+        model_->free_scoring_processors.push_back(scoring_processor_);
+      }
+    }
+
+    ScoringProcessor* get() {
+      if (scoring_processor_ == nullptr) {
+        scoring_processor_ = model_->model->create_scoring_processor();
+      }
+      return scoring_processor_.get();
+    }
+
+   private:
+    const topmine_model* model_;
+    std::shared_ptr<ScoringProcessor> scoring_processor_;
+  };
+
+  void check_offsets(const int64_t* document_offsets, int64_t num_documents) {
+    check_not_null(document_offsets, "document_offsets");
+    if (num_documents < 0 || document_offsets[0] != 0) {
+      throw std::runtime_error("Error: num_documents should be non-negative and document_offsets should start with 0");
+    }
+
+    for (int64_t i = 0; i < num_documents; ++i) {
+      if (document_offsets[i + 1] < document_offsets[i]) {
+        throw std::runtime_error("Error: document_offsets should be non-decreasing");
+      }
+    }
+  }
+
+  void add_span_lengths(const std::vector<int>& lengths,
+                        int64_t capacity,
+                        int32_t* span_lengths,
+                        int64_t* num_spans)
+  {
+    if (*num_spans + static_cast<int64_t>(lengths.size()) > capacity) {
+      throw std::runtime_error("Error: span_lengths buffer is too small");
+    }
+
+    for (const auto& length : lengths) {
+      span_lengths[(*num_spans)++] = length;
+    }
+  }
+}  // namespace
+
+void topmine_options_init(topmine_options* options) {
+  options->collocation_max_size = 2;
+  options->threshold = 0;
+  options->alpha = 2 * kEps;
+  options->num_threads = 1;
+  options->batch_size = 100;
+  options->delimiters = " ";
+  options->esc_character = '|';
+}
+
+int topmine_train_file(const char* input_path, const topmine_options* options, topmine_model** model) {
+  return call([&]() {
+    check_not_null(input_path, "input_path");
+    check_not_null(model, "model");
+
+    auto parameters = get_parameters(options, input_path);
+    *model = create_model(TopmineModel::train(parameters, nullptr), parameters.delimiters);
+  });
+}
+
+int topmine_train_ids(const int32_t* token_ids,
+                      const int64_t* document_offsets,
+                      int64_t num_documents,
+                      const topmine_options* options,
+                      topmine_model** model)
+{
+  return call([&]() {
+    check_not_null(model, "model");
+    check_offsets(document_offsets, num_documents);
+    if (document_offsets[num_documents] > 0) {
+      check_not_null(token_ids, "token_ids");
+    }
+
+    auto parameters = get_parameters(options, "");
+
+    // documents are kept in memory as the data cache of all passes, empty ones aren't counted
+    std::vector<std::shared_ptr<Batch>> batches;
+    Document document;
+    for (int64_t i = 0; i < num_documents; ++i) {
+      if (document_offsets[i] == document_offsets[i + 1]) {
+        continue;
+      }
+
+      if (batches.empty() || batches.back()->size() == parameters.batch_size) {
+        batches.push_back(std::make_shared<Batch>(" "));
+      }
+
+      fill_document(token_ids, document_offsets[i], document_offsets[i + 1], &document);
+      batches.back()->add_document(i, document.tokens);
+    }
+
+    if (batches.empty()) {
+      throw std::runtime_error("Error: no tokens to train on");
+    }
+
+    *model = create_model(TopmineModel::train(parameters, &batches), parameters.delimiters);
+  });
+}
+
+int topmine_load_model(const char* path, const topmine_options* options, topmine_model** model) {
+  return call([&]() {
+    check_not_null(path, "path");
+    check_not_null(options, "options");
+    check_not_null(options->delimiters, "delimiters");
+    check_not_null(model, "model");
+
+    *model = create_model(TopmineModel::load(path, options->alpha, options->esc_character), options->delimiters);
+  });
+}
+
+int topmine_store_model(const topmine_model* model, const char* path) {
+  return call([&]() {
+    check_not_null(model, "model");
+    check_not_null(path, "path");
+
+    model->model->store(path);
+  });
+}
+
+int topmine_segment_ids(const topmine_model* model,
+                        const int32_t* token_ids,
+                        const int64_t* document_offsets,
+                        int64_t num_documents,
+                        int32_t* span_lengths,
+                        int64_t* span_offsets)
+{
+  return call([&]() {
+    check_not_null(model, "model");
+    check_offsets(document_offsets, num_documents);
+    check_not_null(span_offsets, "span_offsets");
+    if (document_offsets[num_documents] > 0) {
+      check_not_null(token_ids, "token_ids");
+      check_not_null(span_lengths, "span_lengths");
+    }
+
+    ScoringProcessorGuard scoring_processor(model);
+    std::vector<int> token_indices;
+    std::vector<int> lengths;
+
+    int64_t num_spans = 0;
+    span_offsets[0] = 0;
+    for (int64_t i = 0; i < num_documents; ++i) {
+      token_indices.clear();
+      for (int64_t j = document_offsets[i]; j < document_offsets[i + 1]; ++j) {
+        token_indices.push_back(get_token_index(*model, token_ids[j]));
+      }
+      scoring_processor.get()->segment_indices(token_indices, &lengths);
+
+      add_span_lengths(lengths, document_offsets[num_documents], span_lengths, &num_spans);
+      span_offsets[i + 1] = num_spans;
+    }
+  });
+}
+
+int topmine_segment_texts(const topmine_model* model,
+                          const char* const* documents,
+                          int64_t num_documents,
+                          int32_t* span_lengths,
+                          int64_t span_lengths_capacity,
+                          int64_t* span_offsets)
+{
+  return call([&]() {
+    check_not_null(model, "model");
+    check_not_null(span_offsets, "span_offsets");
+    if (num_documents < 0) {
+      throw std::runtime_error("Error: num_documents should be non-negative");
+    }
+    if (num_documents > 0) {
+      check_not_null(documents, "documents");
+    }
+
+    ScoringProcessorGuard scoring_processor(model);
+    Tokenizer tokenizer(model->delimiters);
+    std::vector<TokenSpan> token_spans;
+    Document document;
+    std::vector<int> lengths;
+
+    int64_t num_spans = 0;
+    span_offsets[0] = 0;
+    for (int64_t i = 0; i < num_documents; ++i) {
+      check_not_null(documents[i], "document");
+      std::string text(documents[i]);
+
+      token_spans.clear();
+      tokenizer.split(text.data(), text.size(), &token_spans);
+      document.tokens.clear();
+      for (const auto& span : token_spans) {
+        document.tokens.emplace_back(text, span.begin, span.length);
+      }
+      scoring_processor.get()->segment(document, &lengths);
+
+      if (!lengths.empty()) {
+        check_not_null(span_lengths, "span_lengths");
+      }
+      add_span_lengths(lengths, span_lengths_capacity, span_lengths, &num_spans);
+      span_offsets[i + 1] = num_spans;
+    }
+  });
+}
+
+void topmine_free_model(topmine_model* model) {
+  delete model;
+}
+
+const char* topmine_last_error(void) {
+  return last_error.c_str();
+}
@@ -1,18 +1,34 @@
 // Author: Murat Apishev (@mel-lain)
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "boost/filesystem.hpp"
+#include "boost/thread.hpp"
+
+#include "include/checkpoint.h"
 #include "include/collection_processor.h"
+#include "include/collocations_writer.h"
+#include "include/document_deduplicator.h"
 #include "include/heap.h"
+#include "include/huge_page_memory.h"
+#include "include/partial_counts.h"
+#include "include/phrase_counts_spiller.h"
+#include "include/segmentation_format.h"
+#include "include/space_saving_counters.h"
 #include "include/thread_safe_collocation_start_indices.h"
 #include "include/thread_safe_counters.h"
 #include "include/thread_safe_dictionary.h"
+#include "include/thread_safe_score_stats.h"
+#include "include/token_mask.h"
 #include "include/utils.h"
 
 #include "include/token_counters_processor.h"
@@ -22,50 +38,484 @@
 #include "include/topmine_impl.h"
 
 namespace {
-  void store_collocations(const std::string& collocations_output_path,
+  // counters of collocations spilled at once take at least this share of memory limit
+  const size_t kMinSpilledMemoryShare = 64;
+
+  // progress is printed into std::cout, quiet runs (e.g. training by the library) discard it
+  std::ostream* get_log(const Parameters& parameters) {
+    thread_local std::ostream null_stream(nullptr);
+    return parameters.quiet ? &null_stream : &std::cout;
+  }
+
+  void store_collocations(const Parameters& parameters,
+                          const std::shared_ptr<ThreadSafeCounters>& collocation_index_to_counter,
+                          const std::shared_ptr<ThreadSafeScoreStats>& collocation_index_to_score_stats,
                           const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
                           const std::shared_ptr<ThreadSafeDictionary>& dictionary)
   {
-    std::ofstream output_stream;
-    try {
-      if (!collocations_output_path.empty()) {
-        output_stream.open(collocations_output_path);
+    if (parameters.collocations_output_path.empty()) {
+      return;
+    }
 
-        for (const auto& index_counter : index_to_counter->get_all_unsafe()) {
-          output_stream << *(dictionary->get_token(index_counter.first)) << " "
-                        << index_counter.second << std::endl;
+    try {
+      auto order = CollocationsWriter::parse_order(parameters.collocations_order);
+      CollocationsWriter writer(parameters.collocations_output_path,
+                                order,
+                                parameters.min_df,
+                                parameters.top_n,
+                                parameters.collocations_stats,
+                                parameters.num_threads,
+                                parameters.sort_memory_mb);
+
+      auto add_collocation = [&](int index, double df) {
+        auto score_stats = collocation_index_to_score_stats->get(index);
+        const double* frequency_ptr = index_to_counter->get(index);
+
+        writer.add({ dictionary->get_token_unsafe(index).to_string(),
+                     df,
+                     score_stats.max_score,
+                     df > 0.0 ? score_stats.sum_score / df : 0.0,
+                     frequency_ptr != nullptr ? *frequency_ptr : 0.0 });
+      };
+
+      // the order of hash table depends on the order of batches, unordered output follows indices instead
+      if (parameters.deterministic && order == CollocationsOrder::kNone) {
+        for (int index = 0; index < dictionary->size(); ++index) {
+          const double* df_ptr = collocation_index_to_counter->get_unsafe(index);
+          if (df_ptr != nullptr) {
+            add_collocation(index, *df_ptr);
+          }
+        }
+      } else {
+        for (const auto& index_counter : collocation_index_to_counter->get_all_unsafe()) {
+          add_collocation(index_counter.first, index_counter.second);
         }
-
-        output_stream.close();
       }
+
+      writer.finish();
     } catch (std::exception& e) {
-      if (output_stream.is_open()) {
-        output_stream.close();
+      std::cerr << e.what() << std::endl;
+    }
+  }
+
+  // moves collocations from the approximate summary into dictionary (and counters, if they
+  // won't be recounted exactly). If the summary was not filled, the result equals exact counting
+  void add_heavy_hitters(const std::shared_ptr<SpaceSavingCounters>& heavy_hitters,
+                         const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                         const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                         int collocation_size,
+                         long threshold,
+                         bool add_counters,
+                         std::ostream* log)
+  {
+    std::unordered_map<int, double> index_to_counter_local;
+    int num_guaranteed = 0;
+
+    for (const auto& collocation_entry : heavy_hitters->get_all()) {
+      const auto& entry = collocation_entry.second;
+      if (entry.count - entry.error >= threshold) {
+        ++num_guaranteed;
+      }
+
+      dictionary->add(collocation_entry.first);
+      if (add_counters) {
+        index_to_counter_local[*(dictionary->get_index(collocation_entry.first))] = entry.count;
+      }
+    }
+
+    index_to_counter->increase(index_to_counter_local);
+
+    *log << "Heavy hitters of size " << collocation_size << ": "
+         << heavy_hitters->size() << " of " << heavy_hitters->capacity() << " counters used, "
+         << "total count " << heavy_hitters->total() << ", max count error " << heavy_hitters->max_error()
+         << " (bound total / capacity = " << heavy_hitters->total() / heavy_hitters->capacity() << "), "
+         << num_guaranteed << " guaranteed frequent" << std::endl;
+  }
+
+  // tokens of the first pass get indices in order of decreasing frequency, so the indices don't
+  // depend on the order in which threads added them and frequent tokens stay close in memory
+  // document frequencies of tokens (may be nullptr) are remapped with their counters
+  void sort_tokens(const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                   const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                   const std::shared_ptr<ThreadSafeCounters>& index_to_df)
+  {
+    std::vector<double> frequencies(dictionary->size(), 0.0);
+    for (const auto& index_counter : index_to_counter->get_all_unsafe()) {
+      frequencies[index_counter.first] = index_counter.second;
+    }
+
+    auto new_indices = dictionary->sort_tokens(0, [&](int index, int other_index) {
+      return frequencies[index] > frequencies[other_index];
+    });
+
+    index_to_counter->remap_keys(new_indices);
+    if (index_to_df != nullptr) {
+      index_to_df->remap_keys(new_indices);
+    }
+  }
+
+  bool is_token_filter(const Parameters& parameters) {
+    return !parameters.stop_words_path.empty() || parameters.min_unigram_df > 0 || parameters.max_unigram_ratio > 0.0;
+  }
+
+  // masks stop words and tokens contained in less than min_unigram_df documents or in more
+  // than max_unigram_ratio share of them, index_to_df may be nullptr if both are off
+  void fill_token_mask(const Parameters& parameters,
+                       const std::vector<std::string>& stop_words,
+                       const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                       const std::shared_ptr<ThreadSafeCounters>& index_to_df,
+                       long num_documents,
+                       const std::shared_ptr<TokenMask>& token_mask)
+  {
+    // stop words absent in collection are skipped
+    for (const auto& stop_word : stop_words) {
+      const int* index_ptr = dictionary->get_index(stop_word);
+      if (index_ptr != nullptr) {
+        token_mask->mask(*index_ptr);
+      }
+    }
+
+    if (index_to_df == nullptr) {
+      return;
+    }
+
+    double max_df = parameters.max_unigram_ratio > 0.0
+      ? parameters.max_unigram_ratio * static_cast<double>(num_documents) : static_cast<double>(num_documents);
+    for (const auto& index_df : index_to_df->get_all_unsafe()) {
+      if (index_df.second < parameters.min_unigram_df || index_df.second > max_df) {
+        token_mask->mask(index_df.first);
+      }
+    }
+  }
+
+  // sums partial counts of one collocation size from several shards and adds them to the model
+  // with counts of the previous sizes, the threshold of the merged model is applied by the next rounds
+  void merge_partial_counts(const Parameters& parameters) {
+    std::ostream* log = get_log(parameters);
+    auto dictionary = std::shared_ptr<ThreadSafeDictionary>(new ThreadSafeDictionary());
+    auto index_to_counter = std::shared_ptr<ThreadSafeCounters>(new ThreadSafeCounters());
+
+    PartialCountsHeader header = { 0, 0L, parameters.threshold };
+    if (!parameters.model_path.empty()) {
+      auto model_header = PartialCounts::load(parameters.model_path, dictionary, index_to_counter);
+      header.collocation_size = model_header.collocation_size;
+      header.total_collection_size = model_header.total_collection_size;
+    }
+
+    auto partial_paths = CollectionProcessor::list_input_files(parameters.input_path);
+
+    int partial_collocation_size = 0;
+    long partial_total_collection_size = 0L;
+    for (const auto& partial_path : partial_paths) {
+      auto partial_header = PartialCounts::load(partial_path, dictionary, index_to_counter);
+
+      if (partial_collocation_size > 0 && partial_collocation_size != partial_header.collocation_size) {
+        throw std::runtime_error("Error: partial counts of different collocation sizes: " + partial_path);
+      }
+
+      partial_collocation_size = partial_header.collocation_size;
+      partial_total_collection_size += partial_header.total_collection_size;
+    }
+
+    if (partial_collocation_size != header.collocation_size + 1) {
+      throw std::runtime_error("Error: partial counts of collocation size " + std::to_string(partial_collocation_size) +
+                               " can't be merged with model of collocation size " +
+                               std::to_string(header.collocation_size));
+    }
+
+    header.collocation_size = partial_collocation_size;
+    if (partial_collocation_size == 1) {
+      header.total_collection_size = partial_total_collection_size;
+    }
+
+    PartialCounts::store(parameters.counts_output_path, header, dictionary, index_to_counter, 0);
+
+    *log << "Merged counts of collocation size " << header.collocation_size << " from "
+         << partial_paths.size() << " shards, total dictionary size: " << dictionary->size()
+         << ", total collection size: " << header.total_collection_size << std::endl << std::endl;
+  }
+
+  // copies tables, which are frozen during scoring, into memory of each NUMA node (the copying
+  // thread runs on the node) and gives scoring processors the replicas of their nodes
+  void replicate_tables(const std::shared_ptr<CollectionProcessor>& collection_processor,
+                        const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                        const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                        const std::vector<std::shared_ptr<ScoringProcessor>>& scoring_processors,
+                        std::ostream* log)
+  {
+    const auto& numa_topology = collection_processor->get_numa_topology();
+    if (numa_topology.num_nodes() < 2) {
+      *log << "Single NUMA node, tables are not replicated" << std::endl << std::endl;
+      return;
+    }
+
+    std::vector<std::shared_ptr<ThreadSafeDictionary>> node_dictionaries;
+    std::vector<std::shared_ptr<ThreadSafeCounters>> node_counters;
+    for (int node = 0; node < numa_topology.num_nodes(); ++node) {
+      node_dictionaries.push_back(std::make_shared<ThreadSafeDictionary>());
+      node_counters.push_back(std::make_shared<ThreadSafeCounters>());
+    }
+
+    boost::thread_group threads;
+    for (int node = 0; node < numa_topology.num_nodes(); ++node) {
+      threads.create_thread([&, node]() {
+        NumaTopology::pin_current_thread(numa_topology.get_node_cpus(node)[0]);
+        node_dictionaries[node]->copy_from(*dictionary);
+        node_counters[node]->copy_from(*index_to_counter);
+      });
+    }
+    threads.join_all();
+
+    for (int thread_id = 0; thread_id < scoring_processors.size(); ++thread_id) {
+      int node = numa_topology.get_cpu_node(collection_processor->get_worker_cpu(thread_id));
+      scoring_processors[thread_id]->set_tables(node_dictionaries[node], node_counters[node]);
+    }
+
+    *log << "Tables are replicated on " << numa_topology.num_nodes() << " NUMA nodes" << std::endl << std::endl;
+  }
+
+  void print_queue_stats(const std::shared_ptr<CollectionProcessor>& collection_processor, std::ostream* log) {
+    for (const auto& name_stats : collection_processor->get_queue_stats()) {
+      const auto& stats = name_stats.second;
+      *log << "Queue '" << name_stats.first << "': capacity " << stats.capacity
+           << ", max depth " << stats.max_depth
+           << ", mean depth " << stats.mean_depth
+           << ", waits on full " << stats.num_full_waits
+           << ", waits on empty " << stats.num_empty_waits << std::endl;
+    }
+  }
+
+  void print_phrase_counters_memory(const std::shared_ptr<ConcurrentPhraseCounters>& phrase_counters,
+                                    const std::shared_ptr<PhraseCountsSpiller>& spiller,
+                                    std::ostream* log)
+  {
+    static const char* const kModeNames[] = { "none", "transparent", "explicit" };
+
+    *log << "Phrase counters table: " << phrase_counters->get_capacity() << " slots, "
+         << (phrase_counters->get_memory_usage() >> 20) << " Mb, huge pages: "
+         << kModeNames[static_cast<int>(phrase_counters->get_huge_pages_mode())];
+    if (spiller != nullptr) {
+      *log << ", spilled runs: " << spiller->get_num_runs();
+    }
+    *log << std::endl;
+  }
+
+  // memory of tables kept between passes, which is tracked by memory limit
+  size_t get_tables_memory_usage(const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                                 const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                                 const std::shared_ptr<CollectionProcessor>& collection_processor)
+  {
+    return dictionary->get_memory_usage() + index_to_counter->get_memory_usage() +
+           collection_processor->get_cache_memory_usage();
+  }
+
+  void print_memory_usage(const Parameters& parameters,
+                          const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                          const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                          const std::shared_ptr<CollectionProcessor>& collection_processor)
+  {
+    std::ostream* log = get_log(parameters);
+    size_t memory_usage = get_tables_memory_usage(dictionary, index_to_counter, collection_processor);
+
+    *log << "Memory usage: dictionary " << (dictionary->get_memory_usage() >> 20) << " Mb, counters "
+         << (index_to_counter->get_memory_usage() >> 20) << " Mb, cache "
+         << (collection_processor->get_cache_memory_usage() >> 20) << " Mb" << std::endl;
+
+    if (parameters.memory_limit_mb > 0 && memory_usage > (static_cast<size_t>(parameters.memory_limit_mb) << 20)) {
+      *log << "Warning: tables take " << (memory_usage >> 20) << " Mb, more than memory limit "
+           << parameters.memory_limit_mb << " Mb, counters of collocations will be spilled in runs of 1/"
+           << kMinSpilledMemoryShare << " of the limit"
+           << std::endl;
+    }
+  }
+
+  // keeps counters of collocations of the next pass within the rest of memory limit, runs are
+  // written near the output file. Returns nullptr if there is no limit
+  std::shared_ptr<PhraseCountsSpiller> create_spiller(const Parameters& parameters,
+                                                      size_t tables_memory_usage,
+                                                      const std::shared_ptr<ConcurrentPhraseCounters>& phrase_counters)
+  {
+    if (parameters.memory_limit_mb <= 0) {
+      return nullptr;
+    }
+
+    std::string path_prefix = "topmine";
+    for (const auto& path : { parameters.counts_output_path,
+                              parameters.collocations_output_path,
+                              parameters.output_path }) {
+      if (!path.empty()) {
+        path_prefix = path;
+        break;
       }
     }
+
+    // if the tables take (almost) all the limit, entries of at least a part of the limit are spilled
+    // into each run, otherwise every batch would be spilled into a tiny run
+    size_t memory_limit = static_cast<size_t>(parameters.memory_limit_mb) << 20;
+    size_t memory_budget = memory_limit > tables_memory_usage ? memory_limit - tables_memory_usage : 0;
+    memory_budget = std::max(memory_budget,
+                             phrase_counters->get_initial_memory_usage() + memory_limit / kMinSpilledMemoryShare);
+    return std::make_shared<PhraseCountsSpiller>(path_prefix, memory_budget);
+  }
+
+  long get_input_size(const std::string& input_path) {
+    long input_size = 0L;
+    for (const auto& path : CollectionProcessor::list_input_files(input_path)) {
+      input_size += static_cast<long>(boost::filesystem::file_size(path));
+    }
+    return input_size;
+  }
+
+  CheckpointHeader get_checkpoint_header(const Parameters& parameters,
+                                         int num_finished_stages,
+                                         long total_collection_size)
+  {
+    return { num_finished_stages,
+             total_collection_size,
+             parameters.collocation_max_size,
+             std::max(parameters.collocation_sizes_per_pass, 1),
+             parameters.heavy_hitters_memory_mb,
+             parameters.heavy_hitters_verify,
+             parameters.threshold,
+             parameters.dedup,
+             is_token_filter(parameters),
+             parameters.stop_words_path,
+             parameters.min_unigram_df,
+             parameters.max_unigram_ratio,
+             get_input_size(parameters.input_path),
+             parameters.delimiters,
+             parameters.esc_character,
+             parameters.deterministic,
+             parameters.boundaries };
+  }
+
+  // restores state of the counting stages, returns the number of finished ones
+  int load_checkpoint(const Parameters& parameters,
+                      const std::shared_ptr<ThreadSafeDictionary>& dictionary,
+                      const std::shared_ptr<ThreadSafeCounters>& index_to_counter,
+                      const std::shared_ptr<ThreadSafeCollocationStartIndices>& collocation_start_indices,
+                      const std::shared_ptr<DocumentDeduplicator>& deduplicator,
+                      const std::shared_ptr<TokenMask>& token_mask,
+                      const std::shared_ptr<std::atomic<long>>& total_collection_size)
+  {
+    auto header = Checkpoint::load(parameters.resume_from,
+                                   dictionary,
+                                   index_to_counter,
+                                   collocation_start_indices,
+                                   deduplicator,
+                                   token_mask);
+
+    auto expected_header = get_checkpoint_header(parameters, header.num_finished_stages, header.total_collection_size);
+    if (header.collocation_max_size != expected_header.collocation_max_size ||
+        header.collocation_sizes_per_pass != expected_header.collocation_sizes_per_pass ||
+        header.heavy_hitters_memory_mb != expected_header.heavy_hitters_memory_mb ||
+        header.heavy_hitters_verify != expected_header.heavy_hitters_verify ||
+        header.threshold != expected_header.threshold) {
+      throw std::runtime_error("Error: checkpoint was made with other counting parameters: " + parameters.resume_from);
+    }
+
+    if (header.delimiters != expected_header.delimiters ||
+        header.esc_character != expected_header.esc_character ||
+        header.deterministic != expected_header.deterministic ||
+        header.boundaries != expected_header.boundaries) {
+      throw std::runtime_error("Error: checkpoint was made with other delimiters, esc_character, deterministic or "
+                               "boundaries: " + parameters.resume_from);
+    }
+
+    if (header.stop_words_path != expected_header.stop_words_path ||
+        header.min_unigram_df != expected_header.min_unigram_df ||
+        header.max_unigram_ratio != expected_header.max_unigram_ratio) {
+      throw std::runtime_error("Error: checkpoint was made with other stop_words_path, min_unigram_df or "
+                               "max_unigram_ratio: " + parameters.resume_from);
+    }
+
+    if (header.input_size != expected_header.input_size) {
+      throw std::runtime_error("Error: checkpoint was made with other input: " + parameters.resume_from);
+    }
+
+    *total_collection_size = header.total_collection_size;
+
+    std::ostream* log = get_log(parameters);
+    *log << "Resumed from checkpoint " << parameters.resume_from << " after stage "
+         << header.num_finished_stages << ", dictionary size: " << dictionary->size() << std::endl << std::endl;
+    return header.num_finished_stages;
   }
 
   void print_elapsed_time(const std::chrono::time_point<std::chrono::system_clock>& time_start,
-                          const std::chrono::time_point<std::chrono::system_clock>& time_end)
+                          const std::chrono::time_point<std::chrono::system_clock>& time_end,
+                          std::ostream* log)
   {
-    std::cout << "Finish! Elapsed time: "
-              << std::chrono::duration_cast<std::chrono::seconds>(time_end - time_start).count()
-              << " sec." << std::endl << std::endl;
+    *log << "Finish! Elapsed time: "
+         << std::chrono::duration_cast<std::chrono::seconds>(time_end - time_start).count()
+         << " sec." << std::endl << std::endl;
   }
 }  // namespace
 
 void TopmineImpl::run_topmine(const Parameters& parameters) {
+  run_topmine(parameters, nullptr, nullptr);
+}
+
+CollocationCounts TopmineImpl::count_collocations(const Parameters& parameters,
+                                                  const std::vector<std::shared_ptr<Batch>>* batches)
+{
+  if (parameters.mode != kModeFull || !parameters.model_path.empty()) {
+    throw std::runtime_error("Error: collocations can be counted only in full mode without model");
+  }
+
+  CollocationCounts counts;
+  run_topmine(parameters, batches, &counts);
+  return counts;
+}
+
+void TopmineImpl::run_topmine(const Parameters& parameters,
+                              const std::vector<std::shared_ptr<Batch>>* batches,
+                              CollocationCounts* counts)
+{
+  if (parameters.mode == kModeMerge) {
+    merge_partial_counts(parameters);
+    return;
+  }
+
+  if (parameters.mode == kModeConvert) {
+    SegmentationFormat::convert_to_text(parameters.input_path,
+                                        parameters.output_path,
+                                        parameters.delimiters[0],
+                                        parameters.esc_character);
+    return;
+  }
+
   auto time_start = std::chrono::system_clock::now();
+  std::ostream* log = get_log(parameters);
 
   // declare shared data variables
   auto dictionary = std::shared_ptr<ThreadSafeDictionary>(new ThreadSafeDictionary());
   auto index_to_counter = std::shared_ptr<ThreadSafeCounters>(new ThreadSafeCounters());
   auto collocation_index_to_counter = std::shared_ptr<ThreadSafeCounters>(new ThreadSafeCounters());
+  auto collocation_index_to_score_stats = std::shared_ptr<ThreadSafeScoreStats>(new ThreadSafeScoreStats());
+  collocation_index_to_score_stats->set_exact_sums(parameters.deterministic);
 
   auto collocation_start_indices =
     std::shared_ptr<ThreadSafeCollocationStartIndices>(new ThreadSafeCollocationStartIndices());
 
   auto total_collection_size = std::make_shared<std::atomic<long>>(0L);
+  auto huge_pages_mode = HugePageMemory::parse_mode(parameters.huge_pages);
+
+  // counters of the previous counting rounds (count mode) or the final merged model (score mode)
+  long threshold = parameters.threshold;
+  int model_collocation_size = 0;
+  int model_dictionary_size = 0;
+
+  if (!parameters.model_path.empty()) {
+    auto header = PartialCounts::load(parameters.model_path, dictionary, index_to_counter);
+
+    *total_collection_size = header.total_collection_size;
+    threshold = header.threshold;
+    model_collocation_size = header.collocation_size;
+    model_dictionary_size = dictionary->size();
+
+    *log << "Loaded counts of collocations up to size " << model_collocation_size
+         << " from " << parameters.model_path << std::endl;
+  }
 
   // create smart pointers and raw ones for polymorphism
   std::vector<std::shared_ptr<TokenCountersProcessor>> token_counters_processors;
@@ -90,18 +540,20 @@ void TopmineImpl::run_topmine(const Parameters& parameters) {
       new CollocationsProcessor(dictionary,
                                 index_to_counter,
                                 collocation_start_indices,
-                                parameters.threshold,
+                                threshold,
                                 parameters.esc_character)));
 
     scoring_processors.push_back(std::shared_ptr<ScoringProcessor>(
       new ScoringProcessor(dictionary,
                            index_to_counter,
                            collocation_index_to_counter,
+                           collocation_index_to_score_stats,
                            total_collection_size,
                            parameters.alpha,
                            parameters.collocation_max_size,
                            output_path != nullptr,
                            parameters.return_indices,
+                           SegmentationFormat::parse_output_format(parameters.output_format),
                            parameters.esc_character)));
 
     token_counters_processors_ptr.push_back(token_counters_processors.back().get());
@@ -109,53 +561,279 @@ void TopmineImpl::run_topmine(const Parameters& parameters) {
     scoring_processors_ptr.push_back(scoring_processors.back().get());
   }
 
+  // repeated documents are found on the first pass, the next passes count each of them once
+  // with the weight equal to the number of its copies
+  auto deduplicator = parameters.dedup ? std::make_shared<DocumentDeduplicator>() : nullptr;
+  for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+    token_counters_processors[thread_id]->set_deduplicator(deduplicator);
+    collocations_processors[thread_id]->set_deduplicator(deduplicator);
+    scoring_processors[thread_id]->set_deduplicator(deduplicator);
+  }
+
+  // stop words and tokens out of the band of document frequencies are masked after the first pass,
+  // so the next passes don't count collocations with them. Stop words are read before the pass
+  auto token_mask = is_token_filter(parameters) ? std::make_shared<TokenMask>() : nullptr;
+  auto stop_words = parameters.stop_words_path.empty()
+    ? std::vector<std::string>() : TokenMask::load_stop_words(parameters.stop_words_path);
+
+  auto index_to_df = parameters.min_unigram_df > 0 || parameters.max_unigram_ratio > 0.0
+    ? std::make_shared<ThreadSafeCounters>() : nullptr;
+  auto num_documents = std::make_shared<std::atomic<long>>(0L);
+  for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+    token_counters_processors[thread_id]->set_document_frequencies(index_to_df, num_documents);
+    collocations_processors[thread_id]->set_token_mask(token_mask);
+  }
+
   auto collection_processor = std::shared_ptr<CollectionProcessor>(
     new CollectionProcessor(parameters.input_path,
                             output_path,
                             parameters.delimiters,
+                            parameters.boundaries,
                             parameters.batch_size,
-                            parameters.use_cache));
-
-  // first stage: collecting counters for collocations
-  std::cout << "================================================" << std::endl;
-  std::cout << "Run processing of token counters..." << std::endl;
+                            parameters.use_cache,
+                            parameters.num_decompression_threads,
+                            parameters.num_parser_threads,
+                            parameters.pin_threads,
+                            parameters.deterministic));
+  if (batches != nullptr) {
+    collection_processor->set_batches(*batches);
+  }
 
-  collection_processor->process(token_counters_processors_ptr);
+  if (parameters.mode == kModeCount) {
+    // one counting round on the shard: counts of the next collocation size are stored into file
+    int collocation_size = model_collocation_size + 1;
+    *log << "Run processing of counters for collocation size " << collocation_size << "..." << std::endl;
+
+    if (collocation_size == 1) {
+      collection_processor->process(token_counters_processors_ptr);
+    } else {
+      auto phrase_counters = std::make_shared<ConcurrentPhraseCounters>(2 * dictionary->size(), huge_pages_mode);
+      auto spiller = create_spiller(parameters,
+                                    get_tables_memory_usage(dictionary, index_to_counter, collection_processor),
+                                    phrase_counters);
+      for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+        collocations_processors[thread_id]->set_collocation_size(collocation_size);
+        collocations_processors[thread_id]->set_scan_all_positions(true);
+        collocations_processors[thread_id]->set_phrase_counters(phrase_counters);
+        collocations_processors[thread_id]->set_spiller(spiller);
+      }
+      collection_processor->process(collocations_processors_ptr);
+
+      print_phrase_counters_memory(phrase_counters, spiller, log);
+      CollocationsProcessor::flush_phrase_counters(phrase_counters,
+                                                   spiller,
+                                                   dictionary,
+                                                   index_to_counter,
+                                                   parameters.deterministic);
+    }
+    if (collocation_size == 1 && parameters.deterministic) {
+      sort_tokens(dictionary, index_to_counter, nullptr);
+    }
+    print_memory_usage(parameters, dictionary, index_to_counter, collection_processor);
+
+    PartialCounts::store(parameters.counts_output_path,
+                         { collocation_size, *total_collection_size, threshold },
+                         dictionary,
+                         index_to_counter,
+                         model_dictionary_size);
+
+    *log << "Stored " << dictionary->size() - model_dictionary_size << " counters into "
+         << parameters.counts_output_path << std::endl;
+    print_elapsed_time(time_start, std::chrono::system_clock::now(), log);
+    return;
+  }
 
   auto time_prev = std::chrono::system_clock::now();
-  print_elapsed_time(time_start, time_prev);
 
-  std::cout << "Total collection size: " << *total_collection_size << std::endl << std::endl;
-  std::cout << "Total dictionary size: " << dictionary->size() << std::endl << std::endl;
+  // first stage: collecting counters for collocations, counters are loaded from model in score mode
+  if (parameters.model_path.empty()) {
+    // counting stages finished by the resumed run are skipped, a checkpoint is stored after each executed one
+    int num_finished_stages = 0;
+    if (!parameters.resume_from.empty()) {
+      num_finished_stages = load_checkpoint(parameters,
+                                            dictionary,
+                                            index_to_counter,
+                                            collocation_start_indices,
+                                            deduplicator,
+                                            token_mask,
+                                            total_collection_size);
+    }
+
+    int num_stages = 0;
+    auto run_stage = [&](const std::function<void()>& stage_function) {
+      if (num_stages++ < num_finished_stages) {
+        return;
+      }
+
+      stage_function();
+      if (!parameters.checkpoint_path.empty()) {
+        Checkpoint::store(parameters.checkpoint_path,
+                          get_checkpoint_header(parameters, num_stages, *total_collection_size),
+                          dictionary,
+                          index_to_counter,
+                          collocation_start_indices,
+                          deduplicator,
+                          token_mask);
+        *log << "Stored checkpoint after stage " << num_stages << " into "
+             << parameters.checkpoint_path << std::endl << std::endl;
+      }
+    };
 
-  std::cout << "Run processing of collocation counters..." << std::endl;
-  for (int collocation_size = 2; collocation_size <= parameters.collocation_max_size; ++collocation_size) {
-    for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
-      collocations_processors[thread_id]->set_collocation_size(collocation_size);
+    run_stage([&]() {
+      *log << "================================================" << std::endl;
+      *log << "Run processing of token counters..." << std::endl;
+
+      collection_processor->process(token_counters_processors_ptr);
+      print_queue_stats(collection_processor, log);
+      if (parameters.deterministic) {
+        sort_tokens(dictionary, index_to_counter, index_to_df);
+      }
+
+      time_prev = std::chrono::system_clock::now();
+      print_elapsed_time(time_start, time_prev, log);
+
+      *log << "Total collection size: " << *total_collection_size << std::endl << std::endl;
+      *log << "Total dictionary size: " << dictionary->size() << std::endl;
+      print_memory_usage(parameters, dictionary, index_to_counter, collection_processor);
+      *log << std::endl;
+
+      if (deduplicator != nullptr) {
+        deduplicator->finish();
+        *log << "Unique documents: " << deduplicator->get_num_unique_documents() << " of "
+             << deduplicator->get_num_documents() << std::endl << std::endl;
+      }
+
+      if (token_mask != nullptr) {
+        fill_token_mask(parameters, stop_words, dictionary, index_to_df, *num_documents, token_mask);
+        *log << "Masked tokens: " << token_mask->size() << " of " << dictionary->size()
+             << std::endl << std::endl;
+      }
+
+      const auto& shard_num_documents = collection_processor->get_shard_num_documents();
+      if (!shard_num_documents.empty()) {
+        *log << "Number of input shards: " << shard_num_documents.size()
+             << ", documents per shard: min "
+             << *std::min_element(shard_num_documents.begin(), shard_num_documents.end())
+             << ", max " << *std::max_element(shard_num_documents.begin(), shard_num_documents.end())
+             << std::endl << std::endl;
+      }
+    });
+
+    *log << "Run processing of collocation counters..." << std::endl;
+    if (parameters.heavy_hitters_memory_mb > 0) {
+      // approximate counting with bounded memory, one size per pass
+      size_t capacity = (static_cast<size_t>(parameters.heavy_hitters_memory_mb) << 20) / SpaceSavingCounters::kEntrySize;
+
+      for (int collocation_size = 2; collocation_size <= parameters.collocation_max_size; ++collocation_size) {
+        run_stage([&]() {
+          auto heavy_hitters = std::make_shared<SpaceSavingCounters>(capacity);
+
+          for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+            collocations_processors[thread_id]->set_collocation_size(collocation_size);
+            collocations_processors[thread_id]->set_heavy_hitters(heavy_hitters);
+          }
+          collection_processor->process(collocations_processors_ptr);
+
+          add_heavy_hitters(heavy_hitters,
+                            dictionary,
+                            index_to_counter,
+                            collocation_size,
+                            threshold,
+                            !parameters.heavy_hitters_verify,
+                            log);
+
+          for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+            collocations_processors[thread_id]->set_heavy_hitters(nullptr);
+          }
+
+          if (parameters.heavy_hitters_verify) {
+            // exact counting of the candidates
+            for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+              collocations_processors[thread_id]->set_verification(true);
+            }
+            collection_processor->process(collocations_processors_ptr);
+
+            for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+              collocations_processors[thread_id]->set_verification(false);
+            }
+          }
+        });
+      }
+    } else {
+      int sizes_per_pass = std::max(parameters.collocation_sizes_per_pass, 1);
+
+      // the number of different pairs is at least the number of tokens
+      auto phrase_counters = std::make_shared<ConcurrentPhraseCounters>(2 * dictionary->size(), huge_pages_mode);
+      for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+        collocations_processors[thread_id]->set_phrase_counters(phrase_counters);
+      }
+
+      for (int first_size = 2; first_size <= parameters.collocation_max_size; first_size += sizes_per_pass) {
+        int last_size = std::min(first_size + sizes_per_pass - 1, parameters.collocation_max_size);
+
+        run_stage([&]() {
+          auto spiller = create_spiller(parameters,
+                                        get_tables_memory_usage(dictionary, index_to_counter, collection_processor),
+                                        phrase_counters);
+          for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+            collocations_processors[thread_id]->set_collocation_sizes(first_size, last_size);
+            collocations_processors[thread_id]->set_spiller(spiller);
+          }
+          collection_processor->process(collocations_processors_ptr);
+
+          print_phrase_counters_memory(phrase_counters, spiller, log);
+          CollocationsProcessor::flush_phrase_counters(phrase_counters,
+                                                       spiller,
+                                                       dictionary,
+                                                       index_to_counter,
+                                                       parameters.deterministic);
+
+          CollocationsProcessor::prune_speculative_collocations(dictionary,
+                                                                index_to_counter,
+                                                                first_size,
+                                                                last_size,
+                                                                threshold,
+                                                                parameters.esc_character);
+          print_memory_usage(parameters, dictionary, index_to_counter, collection_processor);
+        });
+      }
     }
-    collection_processor->process(collocations_processors_ptr);
+
+    print_elapsed_time(time_prev, std::chrono::system_clock::now(), log);
+    time_prev = std::chrono::system_clock::now();
   }
 
-  print_elapsed_time(time_prev, std::chrono::system_clock::now());
-  time_prev = std::chrono::system_clock::now();
+  if (counts != nullptr) {
+    *counts = { { parameters.collocation_max_size, *total_collection_size, threshold }, dictionary, index_to_counter };
+    return;
+  }
 
   // second stage: extract collocations with significance scores and transform documents
-  std::cout << "Run processing of collocation significance scores and documents transformation..." << std::endl;
+  if (parameters.numa_replicas) {
+    replicate_tables(collection_processor, dictionary, index_to_counter, scoring_processors, log);
+  }
+
+  *log << "Run processing of collocation significance scores and documents transformation..." << std::endl;
 
   collection_processor->process(scoring_processors_ptr);
+  print_queue_stats(collection_processor, log);
 
-  print_elapsed_time(time_prev, std::chrono::system_clock::now());
+  print_elapsed_time(time_prev, std::chrono::system_clock::now(), log);
 
-  std::cout << "Collocation index to counter size: " << collocation_index_to_counter->size() << std::endl << std::endl;
+  *log << "Collocation index to counter size: " << collocation_index_to_counter->size() << std::endl << std::endl;
 
-  std::cout << "Run storing of collocations into file..." << std::endl;
+  *log << "Run storing of collocations into file..." << std::endl;
 
-  store_collocations(parameters.collocations_output_path, collocation_index_to_counter, dictionary);
+  store_collocations(parameters,
+                     collocation_index_to_counter,
+                     collocation_index_to_score_stats,
+                     index_to_counter,
+                     dictionary);
 
-  std::cout << std::endl << "TopMine finished collection processing!" << std::endl;
-  print_elapsed_time(time_start, std::chrono::system_clock::now());
+  *log << std::endl << "TopMine finished collection processing!" << std::endl;
+  print_elapsed_time(time_start, std::chrono::system_clock::now(), log);
 
-  std::cout << "Max memory usage: " << Utils::get_peak_memory_usage_kb() / 1024
-            << " (Kb if MAC OS or Mb if Linux)" << std::endl << std::endl;
-  std::cout << "================================================" << std::endl;
+  *log << "Max memory usage: " << Utils::get_peak_memory_usage_kb() / 1024
+       << " (Kb if MAC OS or Mb if Linux)" << std::endl << std::endl;
+  *log << "================================================" << std::endl;
 }
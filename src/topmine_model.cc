@@ -0,0 +1,39 @@
+// Author: Murat Apishev (@mel-lain)
+
+#include "include/segmentation_format.h"
+
+#include "include/topmine_model.h"
+
+std::shared_ptr<TopmineModel> TopmineModel::train(const Parameters& parameters,
+                                                  const std::vector<std::shared_ptr<Batch>>* batches)
+{
+  auto counts = TopmineImpl::count_collocations(parameters, batches);
+  return std::make_shared<TopmineModel>(counts, parameters.alpha, parameters.esc_character);
+}
+
+std::shared_ptr<TopmineModel> TopmineModel::load(const std::string& path, float alpha, char esc_character) {
+  CollocationCounts counts;
+  counts.dictionary = std::make_shared<ThreadSafeDictionary>();
+  counts.index_to_counter = std::make_shared<ThreadSafeCounters>();
+  counts.header = PartialCounts::load(path, counts.dictionary, counts.index_to_counter);
+
+  return std::make_shared<TopmineModel>(counts, alpha, esc_character);
+}
+
+void TopmineModel::store(const std::string& path) const {
+  PartialCounts::store(path, counts_.header, counts_.dictionary, counts_.index_to_counter, 0);
+}
+
+std::shared_ptr<ScoringProcessor> TopmineModel::create_scoring_processor() const {
+  return std::make_shared<ScoringProcessor>(counts_.dictionary,
+                                            counts_.index_to_counter,
+                                            nullptr,
+                                            nullptr,
+                                            total_collection_size_,
+                                            alpha_,
+                                            counts_.header.collocation_size,
+                                            false,
+                                            false,
+                                            OutputFormat::kText,
+                                            esc_character_);
+}
@@ -29,6 +29,33 @@ std::string Utils::join_strings(const std::vector<std::string>& strings, char se
   return join_strings(strings, 0, strings.size(), separator);
 }
 
+void Utils::append_integer(long value, std::string* output) {
+  char digits[24];
+  char* end = digits + sizeof(digits);
+  char* begin = end;
+
+  unsigned long abs_value = value < 0 ? 0UL - static_cast<unsigned long>(value) : static_cast<unsigned long>(value);
+  do {
+    *(--begin) = static_cast<char>('0' + abs_value % 10);
+    abs_value /= 10;
+  } while (abs_value > 0);
+
+  if (value < 0) {
+    *(--begin) = '-';
+  }
+
+  output->append(begin, end - begin);
+}
+
+size_t Utils::get_heap_memory(const std::string& value) {
+  const char* object_begin = reinterpret_cast<const char*>(&value);
+  if (value.data() >= object_begin && value.data() < object_begin + sizeof(value)) {
+    return 0;
+  }
+
+  return value.capacity() + 1;
+}
+
 long Utils::get_peak_memory_usage_kb() {
   rusage info;
   if (!getrusage(RUSAGE_SELF, &info)) {
@@ -1,16 +1,52 @@
 // Author: Murat Apishev (@mel-lain)
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <utility>
 
 #include "boost/algorithm/string.hpp"
 #include "boost/filesystem.hpp"
+#include "boost/thread.hpp"
+#include "boost/iostreams/copy.hpp"
+#include "boost/iostreams/device/array.hpp"
+#include "boost/iostreams/filter/gzip.hpp"
+#include "boost/iostreams/filter/zstd.hpp"
+#include "boost/iostreams/filtering_stream.hpp"
 
 #include "gtest/gtest.h"
 
 #include "include/batch.h"
+#include "include/batch_pool.h"
+#include "include/bounded_queue.h"
+#include "include/checkpoint.h"
+#include "include/collection_processor.h"
+#include "include/collocations_processor.h"
+#include "include/collocations_writer.h"
+#include "include/concurrent_phrase_counters.h"
+#include "include/document_deduplicator.h"
+#include "include/huge_page_memory.h"
+#include "include/numa_topology.h"
+#include "include/pair_scores.h"
+#include "include/parameters.h"
+#include "include/phrase_counts_spiller.h"
+#include "include/segmentation_format.h"
+#include "include/space_saving_counters.h"
+#include "include/thread_safe_dictionary.h"
+#include "include/token_mask.h"
+#include "include/tokenizer.h"
+#include "include/topmine_c_api.h"
 #include "include/topmine_impl.h"
 #include "include/utils.h"
 
@@ -29,6 +65,14 @@ std::pair<std::string, std::string> prepare_paths() {
   return std::make_pair(output_path.string(), collocations_output_path.string());
 }
 
+template <typename Compressor>
+void write_compressed(const std::string& data, std::ofstream* output_stream) {
+  boost::iostreams::filtering_ostream compressed_stream;
+  compressed_stream.push(Compressor());
+  compressed_stream.push(*output_stream);
+  boost::iostreams::copy(boost::iostreams::array_source(data.data(), data.size()), compressed_stream);
+}
+
 void check_results(const std::pair<std::string, std::string>& output_paths, bool return_indices) {
   Batch batch(" \t");
   std::ifstream result_stream(output_paths.first);
@@ -239,3 +283,1837 @@ TEST(TopmineTests, ReturnIndicesTest) {
 
   check_results(output_paths, return_indices);
 }
+
+TEST(TopmineTests, TokenizerTest) {
+  const std::string delimiters = " \t";
+  std::vector<std::string> lines = {
+    "",
+    "   ",
+    "42",
+    "1 a",
+    "\t1\t\ta  b\t",
+    "17 " + std::string(70, 'x') + "  y " + std::string(63, ' ') + "z",
+    std::string(64, 'q') + " " + std::string(128, 'w')
+  };
+
+  for (auto kernel : { TokenizerKernel::kScalar, TokenizerKernel::kSse2, TokenizerKernel::kAvx2 }) {
+    if (!Tokenizer::is_kernel_supported(kernel)) {
+      continue;
+    }
+
+    Tokenizer tokenizer(delimiters, kernel);
+    for (const auto& line : lines) {
+      std::vector<std::string> expected;
+      boost::split(expected, line, boost::is_any_of(delimiters));
+      expected.erase(std::remove(expected.begin(), expected.end(), ""), expected.end());
+
+      std::vector<TokenSpan> spans;
+      tokenizer.split(line.data(), line.size(), &spans);
+
+      ASSERT_EQ(spans.size(), expected.size());
+      for (int i = 0; i < spans.size(); ++i) {
+        ASSERT_EQ(line.substr(spans[i].begin, spans[i].length), expected[i]);
+      }
+    }
+  }
+
+  long id = 0L;
+  ASSERT_TRUE(Tokenizer::parse_id("-123", 4, &id));
+  ASSERT_EQ(id, -123L);
+  ASSERT_FALSE(Tokenizer::parse_id("12a", 3, &id));
+  ASSERT_FALSE(Tokenizer::parse_id("-", 1, &id));
+
+  Batch batch(delimiters);
+  batch.add_document("7\tфы  вапр");
+  ASSERT_EQ(batch.get_documents()[0].id, 7L);
+  ASSERT_EQ(Utils::join_strings(batch.get_documents()[0].tokens, ' '), "фы вапр");
+
+  ASSERT_THROW(batch.add_document("7"), std::runtime_error);
+  ASSERT_THROW(batch.add_document(" 7 a"), std::runtime_error);
+}
+
+TEST(TopmineTests, CompressedInputTest) {
+  auto output_paths = prepare_paths();
+
+  std::ifstream input_stream(kInputPath);
+  std::string data((std::istreambuf_iterator<char>(input_stream)), std::istreambuf_iterator<char>());
+
+  boost::filesystem::path gzip_path("topmine_test_dir");
+  gzip_path.append("test_data.txt.gz");
+
+  std::ofstream gzip_stream(gzip_path.string(), std::ios::binary);
+  write_compressed<boost::iostreams::gzip_compressor>(data, &gzip_stream);
+  gzip_stream.close();
+
+  // three zstd frames with a skippable frame between them, documents cross frame boundaries
+  boost::filesystem::path zstd_path("topmine_test_dir");
+  zstd_path.append("test_data.txt.zst");
+
+  std::ofstream zstd_stream(zstd_path.string(), std::ios::binary);
+  write_compressed<boost::iostreams::zstd_compressor>(data.substr(0, data.size() / 3), &zstd_stream);
+  zstd_stream.write("\x50\x2A\x4D\x18\x03\x00\x00\x00" "abc", 11);
+  write_compressed<boost::iostreams::zstd_compressor>(data.substr(data.size() / 3, data.size() / 3), &zstd_stream);
+  write_compressed<boost::iostreams::zstd_compressor>(data.substr(2 * (data.size() / 3)), &zstd_stream);
+  zstd_stream.close();
+
+  for (const auto& input_path : { gzip_path.string(), zstd_path.string() }) {
+    bool return_indices = false;
+    Parameters parameters = {
+      input_path,           // input_path
+      output_paths.first,   // output_path
+      output_paths.second,  // collocations_output_path
+      4,                    // collocation_max_size
+      3,                    // num_threads
+      2,                    // batch_size
+      3,                    // threshold
+      0.01,                 // alpha
+      return_indices,       // return_indices
+      true,                 // use_cache
+      " \t",                // delimiters
+      '|',                  // esc_character
+      2                     // num_decompression_threads
+    };
+
+    TopmineImpl::run_topmine(parameters);
+
+    check_results(output_paths, return_indices);
+  }
+}
+
+TEST(TopmineTests, ShardedInputTest) {
+  auto output_paths = prepare_paths();
+
+  boost::filesystem::path shards_path("topmine_test_dir");
+  shards_path.append("shards");
+  boost::filesystem::remove_all(shards_path);
+  boost::filesystem::create_directory(shards_path);
+
+  std::ifstream input_stream(kInputPath);
+  std::vector<std::string> shard_paths;
+  std::vector<std::string> shard_data(3);
+
+  std::string str;
+  for (int i = 0; std::getline(input_stream, str); ++i) {
+    shard_data[i % shard_data.size()] += str + "\n";
+  }
+
+  for (int i = 0; i < shard_data.size(); ++i) {
+    auto shard_path = shards_path;
+    shard_path.append("shard_" + std::to_string(i) + (i == 0 ? ".txt.gz" : ".txt"));
+    shard_paths.push_back(shard_path.string());
+
+    std::ofstream shard_stream(shard_path.string(), std::ios::binary);
+    if (i == 0) {
+      write_compressed<boost::iostreams::gzip_compressor>(shard_data[i], &shard_stream);
+    } else {
+      shard_stream << shard_data[i];
+    }
+  }
+
+  boost::filesystem::path list_path("topmine_test_dir");
+  list_path.append("shards_list.txt");
+
+  std::ofstream list_stream(list_path.string());
+  for (const auto& shard_path : shard_paths) {
+    list_stream << shard_path << std::endl;
+  }
+  list_stream.close();
+
+  std::vector<std::string> input_paths = {
+    shards_path.string(),
+    shards_path.string() + "/shard_*",
+    "@" + list_path.string()
+  };
+
+  for (const auto& input_path : input_paths) {
+    ASSERT_EQ(CollectionProcessor::list_input_files(input_path), shard_paths);
+
+    bool return_indices = false;
+    Parameters parameters = {
+      input_path,           // input_path
+      output_paths.first,   // output_path
+      output_paths.second,  // collocations_output_path
+      4,                    // collocation_max_size
+      2,                    // num_threads
+      2,                    // batch_size
+      3,                    // threshold
+      0.01,                 // alpha
+      return_indices,       // return_indices
+      false,                // use_cache
+      " \t",                // delimiters
+      '|',                  // esc_character
+      1                     // num_decompression_threads
+    };
+
+    TopmineImpl::run_topmine(parameters);
+
+    check_results(output_paths, return_indices);
+  }
+}
+
+TEST(TopmineTests, BoundedQueueTest) {
+  const int kNumProducers = 4;
+  const int kNumConsumers = 4;
+  const long kNumItems = 20000;
+
+  BoundedQueue<long> queue(6);
+  std::atomic<long> sum(0L);
+  std::atomic<int> num_active_producers(kNumProducers);
+
+  boost::thread_group threads;
+  for (int i = 0; i < kNumProducers; ++i) {
+    threads.create_thread([&queue, &num_active_producers, i]() {
+      for (long item = i; item < kNumItems; item += kNumProducers) {
+        queue.push(item);
+      }
+
+      if (--num_active_producers == 0) {
+        queue.close();
+      }
+    });
+  }
+
+  for (int i = 0; i < kNumConsumers; ++i) {
+    threads.create_thread([&queue, &sum]() {
+      long item = 0L;
+      while (queue.pop(&item)) {
+        sum += item;
+      }
+    });
+  }
+
+  threads.join_all();
+
+  ASSERT_EQ(sum, kNumItems * (kNumItems - 1) / 2);
+  ASSERT_LE(queue.get_stats().max_depth, 6);
+  ASSERT_FALSE(queue.push(0L));
+}
+
+TEST(TopmineTests, PipelineTest) {
+  auto output_paths = prepare_paths();
+
+  bool return_indices = true;
+  Parameters parameters = {
+    kInputPath,           // input_path
+    output_paths.first,   // output_path
+    output_paths.second,  // collocations_output_path
+    4,                    // collocation_max_size
+    3,                    // num_threads
+    1,                    // batch_size
+    3,                    // threshold
+    0.01,                 // alpha
+    return_indices,       // return_indices
+    false,                // use_cache
+    " \t",                // delimiters
+    '|',                  // esc_character
+    1,                    // num_decompression_threads
+    2                     // num_parser_threads
+  };
+
+  TopmineImpl::run_topmine(parameters);
+
+  check_results(output_paths, return_indices);
+}
+
+TEST(TopmineTests, MultiSizePassTest) {
+  auto output_paths = prepare_paths();
+
+  for (int sizes_per_pass : { 2, 3 }) {
+    bool return_indices = false;
+    Parameters parameters = {
+      kInputPath,           // input_path
+      output_paths.first,   // output_path
+      output_paths.second,  // collocations_output_path
+      4,                    // collocation_max_size
+      2,                    // num_threads
+      2,                    // batch_size
+      3,                    // threshold
+      0.01,                 // alpha
+      return_indices,       // return_indices
+      false,                // use_cache
+      " \t",                // delimiters
+      '|',                  // esc_character
+      1,                    // num_decompression_threads
+      0,                    // num_parser_threads
+      sizes_per_pass        // collocation_sizes_per_pass
+    };
+
+    TopmineImpl::run_topmine(parameters);
+
+    check_results(output_paths, return_indices);
+  }
+}
+
+TEST(TopmineTests, HeavyHittersTest) {
+  SpaceSavingCounters heavy_hitters(2);
+  heavy_hitters.increase({ { "a", 5.0 } });
+  heavy_hitters.increase({ { "b", 3.0 } });
+  heavy_hitters.increase({ { "c", 1.0 } });
+
+  std::unordered_map<std::string, SpaceSavingEntry> entries;
+  for (const auto& key_entry : heavy_hitters.get_all()) {
+    entries.emplace(key_entry.first, key_entry.second);
+  }
+
+  ASSERT_EQ(entries.size(), 2);
+  ASSERT_EQ(entries["a"].count, 5.0);
+  ASSERT_EQ(entries["c"].count, 4.0);
+  ASSERT_EQ(entries["c"].error, 3.0);
+  ASSERT_EQ(heavy_hitters.total(), 9.0);
+  ASSERT_EQ(heavy_hitters.max_error(), 4.0);
+
+  auto output_paths = prepare_paths();
+
+  for (bool verify : { false, true }) {
+    bool return_indices = false;
+    Parameters parameters = {
+      kInputPath,           // input_path
+      output_paths.first,   // output_path
+      output_paths.second,  // collocations_output_path
+      4,                    // collocation_max_size
+      2,                    // num_threads
+      2,                    // batch_size
+      3,                    // threshold
+      0.01,                 // alpha
+      return_indices,       // return_indices
+      false,                // use_cache
+      " \t",                // delimiters
+      '|',                  // esc_character
+      1,                    // num_decompression_threads
+      0,                    // num_parser_threads
+      1,                    // collocation_sizes_per_pass
+      1,                    // heavy_hitters_memory_mb
+      verify                // heavy_hitters_verify
+    };
+
+    TopmineImpl::run_topmine(parameters);
+
+    check_results(output_paths, return_indices);
+  }
+}
+
+TEST(TopmineTests, SplitMergeTest) {
+  auto output_paths = prepare_paths();
+
+  boost::filesystem::path shards_path("topmine_test_dir");
+  shards_path.append("split_merge");
+  boost::filesystem::remove_all(shards_path);
+  boost::filesystem::create_directory(shards_path);
+
+  std::ifstream input_stream(kInputPath);
+  std::vector<std::string> shard_data(2);
+
+  std::string str;
+  for (int i = 0; std::getline(input_stream, str); ++i) {
+    shard_data[i % shard_data.size()] += str + "\n";
+  }
+
+  auto get_path = [&](const std::string& name) {
+    auto path = shards_path;
+    path.append(name);
+    return path.string();
+  };
+
+  for (int i = 0; i < shard_data.size(); ++i) {
+    std::ofstream shard_stream(get_path("shard_" + std::to_string(i) + ".txt"));
+    shard_stream << shard_data[i];
+  }
+
+  bool return_indices = false;
+  auto get_parameters = [&](const std::string& input_path,
+                            const std::string& mode,
+                            const std::string& model_path,
+                            const std::string& counts_output_path) {
+    Parameters parameters = {
+      input_path,           // input_path
+      output_paths.first,   // output_path
+      output_paths.second,  // collocations_output_path
+      4,                    // collocation_max_size
+      2,                    // num_threads
+      2,                    // batch_size
+      3,                    // threshold
+      0.01,                 // alpha
+      return_indices,       // return_indices
+      false,                // use_cache
+      " \t",                // delimiters
+      '|',                  // esc_character
+      1,                    // num_decompression_threads
+      0,                    // num_parser_threads
+      1,                    // collocation_sizes_per_pass
+      0,                    // heavy_hitters_memory_mb
+      false,                // heavy_hitters_verify
+      mode,                 // mode
+      model_path,           // model_path
+      counts_output_path    // counts_output_path
+    };
+    return parameters;
+  };
+
+  // one round of counting on shards and merging per collocation size
+  std::string model_path;
+  for (int collocation_size = 1; collocation_size <= 4; ++collocation_size) {
+    for (int i = 0; i < shard_data.size(); ++i) {
+      TopmineImpl::run_topmine(get_parameters(get_path("shard_" + std::to_string(i) + ".txt"),
+                                              kModeCount,
+                                              model_path,
+                                              get_path("partial_" + std::to_string(i) + ".txt")));
+    }
+
+    auto merged_path = get_path("model_" + std::to_string(collocation_size) + ".txt");
+    TopmineImpl::run_topmine(get_parameters(get_path("partial_*"), kModeMerge, model_path, merged_path));
+    model_path = merged_path;
+  }
+
+  TopmineImpl::run_topmine(get_parameters(kInputPath, kModeScore, model_path, ""));
+
+  check_results(output_paths, return_indices);
+
+  // partial counts of a wrong collocation size can't be merged
+  ASSERT_THROW(TopmineImpl::run_topmine(get_parameters(get_path("partial_*"),
+                                                       kModeMerge,
+                                                       "",
+                                                       get_path("model_wrong.txt"))),
+               std::runtime_error);
+}
+
+TEST(TopmineTests, SortedOutputTest) {
+  boost::filesystem::path writer_path("topmine_test_dir");
+  writer_path.append("sorted_collocations.txt");
+
+  // sorting with spilled runs gives the same result as in-memory sorting
+  std::vector<std::vector<std::string>> results;
+  for (int memory_limit_mb : { 0, 1 }) {
+    CollocationsWriter writer(writer_path.string(), CollocationsOrder::kDf, 2.0, 20000, false, 4, memory_limit_mb);
+    for (int i = 0; i < 50000; ++i) {
+      writer.add({ "collocation|" + std::to_string(i), static_cast<double>((i * 7919) % 101), 0.0, 0.0, 0.0 });
+    }
+    writer.finish();
+
+    std::ifstream result_stream(writer_path.string());
+    std::vector<std::string> lines;
+    for (std::string str; std::getline(result_stream, str);) {
+      lines.push_back(str);
+    }
+    results.push_back(lines);
+  }
+
+  ASSERT_EQ(results[0].size(), 20000);
+  ASSERT_EQ(results[0], results[1]);
+  ASSERT_EQ(results[0][0], "collocation|10031 100");
+  ASSERT_FALSE(boost::filesystem::exists(writer_path.string() + ".run_0"));
+
+  auto output_paths = prepare_paths();
+
+  bool return_indices = false;
+  Parameters parameters = {
+    kInputPath,           // input_path
+    output_paths.first,   // output_path
+    output_paths.second,  // collocations_output_path
+    4,                    // collocation_max_size
+    2,                    // num_threads
+    2,                    // batch_size
+    3,                    // threshold
+    0.01,                 // alpha
+    return_indices,       // return_indices
+    false,                // use_cache
+    " \t",                // delimiters
+    '|',                  // esc_character
+    1,                    // num_decompression_threads
+    0,                    // num_parser_threads
+    1,                    // collocation_sizes_per_pass
+    0,                    // heavy_hitters_memory_mb
+    false,                // heavy_hitters_verify
+    kModeFull,            // mode
+    "",                   // model_path
+    "",                   // counts_output_path
+    "df",                 // collocations_order
+    3,                    // min_df
+    2                     // top_n
+  };
+
+  TopmineImpl::run_topmine(parameters);
+
+  std::ifstream collocations_stream(output_paths.second);
+  std::vector<std::string> lines;
+  for (std::string str; std::getline(collocations_stream, str);) {
+    lines.push_back(str);
+  }
+
+  std::vector<std::string> expected_lines = { "метод|опорных|векторов 4", "а|ты 3" };
+  ASSERT_EQ(lines, expected_lines);
+}
+
+TEST(TopmineTests, CollocationsStatsTest) {
+  auto output_paths = prepare_paths();
+
+  bool return_indices = false;
+  Parameters parameters = {
+    kInputPath,           // input_path
+    output_paths.first,   // output_path
+    output_paths.second,  // collocations_output_path
+    4,                    // collocation_max_size
+    2,                    // num_threads
+    2,                    // batch_size
+    3,                    // threshold
+    0.01,                 // alpha
+    return_indices,       // return_indices
+    false,                // use_cache
+    " \t",                // delimiters
+    '|',                  // esc_character
+    1,                    // num_decompression_threads
+    0,                    // num_parser_threads
+    1,                    // collocation_sizes_per_pass
+    0,                    // heavy_hitters_memory_mb
+    false,                // heavy_hitters_verify
+    kModeFull,            // mode
+    "",                   // model_path
+    "",                   // counts_output_path
+    "score",              // collocations_order
+    0,                    // min_df
+    0,                    // top_n
+    0,                    // sort_memory_mb
+    true                  // collocations_stats
+  };
+
+  TopmineImpl::run_topmine(parameters);
+
+  std::ifstream collocations_stream(output_paths.second);
+  std::vector<double> max_scores;
+  for (std::string str; std::getline(collocations_stream, str);) {
+    std::vector<std::string> parts;
+    boost::split(parts, str, boost::is_any_of(" "));
+    ASSERT_EQ(parts.size(), 5);
+
+    double max_score = std::stod(parts[2]);
+    double mean_score = std::stod(parts[3]);
+    double frequency = std::stod(parts[4]);
+
+    if (parts[0].find('|') == std::string::npos) {
+      ASSERT_EQ(max_score, 0.0);
+    } else {
+      ASSERT_GE(max_score, parameters.alpha);
+      ASSERT_LE(mean_score, max_score + 1e-6);
+      ASSERT_GE(frequency, std::stod(parts[1]));
+    }
+
+    max_scores.push_back(max_score);
+  }
+
+  ASSERT_EQ(max_scores.size(), 5);
+  ASSERT_TRUE(std::is_sorted(max_scores.rbegin(), max_scores.rend()));
+}
+
+TEST(TopmineTests, BatchPoolTest) {
+  BatchPool batch_pool(" ", "", 2);
+
+  auto batch = batch_pool.acquire();
+  batch->add_document("1 метод опорных векторов");
+  batch->add_document("2 ядра");
+  auto batch_ptr = batch.get();
+
+  batch_pool.release(batch);
+  batch = batch_pool.acquire();
+
+  // the recycled batch is empty and keeps its storage
+  ASSERT_EQ(batch.get(), batch_ptr);
+  ASSERT_EQ(batch->size(), 0);
+  ASSERT_TRUE(batch->get_documents().empty());
+
+  batch->add_document("3 а ты");
+  batch->add_document(4L, { "rbf" });
+
+  ASSERT_EQ(batch->size(), 2);
+  ASSERT_EQ(batch->get_documents()[0].id, 3L);
+  ASSERT_EQ(Utils::join_strings(batch->get_documents()[0].tokens, ' '), "а ты");
+  ASSERT_EQ(batch->get_documents()[1].id, 4L);
+  ASSERT_EQ(Utils::join_strings(batch->get_documents()[1].tokens, ' '), "rbf");
+
+  ASSERT_NE(batch_pool.acquire().get(), batch_ptr);
+}
+
+TEST(TopmineTests, AppendIntegerTest) {
+  std::string output = "id";
+  for (long value : { 0L, 7L, -15L, 1234567890123L, std::numeric_limits<long>::min() }) {
+    output += ' ';
+    Utils::append_integer(value, &output);
+  }
+
+  ASSERT_EQ(output, "id 0 7 -15 1234567890123 " + std::to_string(std::numeric_limits<long>::min()));
+}
+
+TEST(TopmineTests, BinaryOutputTest) {
+  auto output_paths = prepare_paths();
+  auto binary_output_path = output_paths.first + ".bin";
+
+  Parameters parameters = {
+    kInputPath,           // input_path
+    binary_output_path,   // output_path
+    output_paths.second,  // collocations_output_path
+    4,                    // collocation_max_size
+    2,                    // num_threads
+    2,                    // batch_size
+    3,                    // threshold
+    0.01,                 // alpha
+    false,                // return_indices
+    false,                // use_cache
+    " \t",                // delimiters
+    '|',                  // esc_character
+    1,                    // num_decompression_threads
+    0,                    // num_parser_threads
+    1,                    // collocation_sizes_per_pass
+    0,                    // heavy_hitters_memory_mb
+    false,                // heavy_hitters_verify
+    kModeFull,            // mode
+    "",                   // model_path
+    "",                   // counts_output_path
+    "",                   // collocations_order
+    0,                    // min_df
+    0,                    // top_n
+    0,                    // sort_memory_mb
+    false,                // collocations_stats
+    "binary"              // output_format
+  };
+
+  TopmineImpl::run_topmine(parameters);
+
+  BinarySegmentationReader reader(binary_output_path);
+  SegmentedDocument document;
+  int num_documents = 0;
+  while (reader.read(&document)) {
+    ASSERT_FALSE(document.spans.empty());
+    ASSERT_EQ(document.spans[0].begin, 0);
+    ++num_documents;
+  }
+  ASSERT_EQ(num_documents, 7);
+
+  parameters.input_path = binary_output_path;
+  parameters.output_path = output_paths.first;
+  parameters.mode = kModeConvert;
+
+  TopmineImpl::run_topmine(parameters);
+
+  check_results(output_paths, true);
+
+  std::string encoded;
+  SegmentationFormat::append_document(-300L, { 1, 200 }, &encoded);
+  ASSERT_EQ(encoded, std::string("\xd7\x04\x02\x01\xc8\x01"));
+}
+
+TEST(TopmineTests, PinThreadsTest) {
+  std::vector<int> expected_cpus = { 0, 1, 2, 3, 8, 10, 11 };
+  ASSERT_EQ(NumaTopology::parse_cpu_list("0-3,8,10-11"), expected_cpus);
+
+  NumaTopology numa_topology;
+  ASSERT_GE(numa_topology.num_nodes(), 1);
+
+  int cpu = numa_topology.get_worker_cpu(1);
+  ASSERT_GE(cpu, 0);
+
+  // affinity is checked in a separate thread to keep the test process unpinned
+  std::vector<int> thread_cpus;
+  boost::thread thread([&]() {
+    if (NumaTopology::pin_current_thread(cpu)) {
+      thread_cpus = NumaTopology::get_current_thread_cpus();
+    }
+  });
+  thread.join();
+
+  ASSERT_EQ(thread_cpus, std::vector<int>(1, cpu));
+
+  auto output_paths = prepare_paths();
+
+  bool return_indices = false;
+  Parameters parameters = {
+    kInputPath,           // input_path
+    output_paths.first,   // output_path
+    output_paths.second,  // collocations_output_path
+    4,                    // collocation_max_size
+    2,                    // num_threads
+    2,                    // batch_size
+    3,                    // threshold
+    0.01,                 // alpha
+    return_indices,       // return_indices
+    false,                // use_cache
+    " \t",                // delimiters
+    '|',                  // esc_character
+    1,                    // num_decompression_threads
+    0,                    // num_parser_threads
+    1,                    // collocation_sizes_per_pass
+    0,                    // heavy_hitters_memory_mb
+    false,                // heavy_hitters_verify
+    kModeFull,            // mode
+    "",                   // model_path
+    "",                   // counts_output_path
+    "",                   // collocations_order
+    0,                    // min_df
+    0,                    // top_n
+    0,                    // sort_memory_mb
+    false,                // collocations_stats
+    "",                   // output_format
+    true,                 // pin_threads
+    true                  // numa_replicas
+  };
+
+  TopmineImpl::run_topmine(parameters);
+
+  check_results(output_paths, return_indices);
+}
+
+TEST(TopmineTests, ConcurrentPhraseCountersTest) {
+  ConcurrentPhraseCounters phrase_counters(16, HugePagesMode::kNone);
+
+  // threads insert the same keys concurrently while the table grows
+  const int kNumThreads = 4;
+  const int kNumKeys = 20000;
+  boost::thread_group threads;
+  for (int thread_id = 0; thread_id < kNumThreads; ++thread_id) {
+    threads.create_thread([&, thread_id]() {
+      for (int i = 0; i < kNumKeys; ++i) {
+        phrase_counters.increase("key|" + std::to_string((i * 7 + thread_id) % kNumKeys), thread_id + 1);
+      }
+    });
+  }
+  threads.join_all();
+
+  std::unordered_map<std::string, long> key_to_count;
+  phrase_counters.for_each([&](const std::string& key, long count) {
+    key_to_count[key] += count;
+  });
+
+  ASSERT_EQ(key_to_count.size(), kNumKeys);
+  for (const auto& key_count : key_to_count) {
+    ASSERT_EQ(key_count.second, kNumThreads * (kNumThreads + 1) / 2);
+  }
+
+  // compaction moves all entries into one table, entries of the same key are merged
+  phrase_counters.compact_if_needed();
+  ASSERT_EQ(phrase_counters.size(), kNumKeys);
+  ASSERT_GE(phrase_counters.get_capacity(), 2 * kNumKeys);
+
+  std::unordered_map<std::string, long> compacted_key_to_count;
+  phrase_counters.for_each([&](const std::string& key, long count) {
+    ASSERT_TRUE(compacted_key_to_count.emplace(key, count).second);
+  });
+  ASSERT_EQ(compacted_key_to_count, key_to_count);
+
+  // counting goes on in the compacted table, concurrently with compaction between batches
+  boost::thread_group compacting_threads;
+  for (int thread_id = 0; thread_id < kNumThreads; ++thread_id) {
+    compacting_threads.create_thread([&, thread_id]() {
+      for (int i = 0; i < kNumKeys; i += 100) {
+        {
+          boost::shared_lock<boost::shared_mutex> lock(phrase_counters.get_mutex());
+          for (int j = i; j < i + 100; ++j) {
+            phrase_counters.increase("new|" + std::to_string((j * 7 + thread_id) % kNumKeys), 1);
+          }
+        }
+        phrase_counters.compact_if_needed();
+      }
+    });
+  }
+  compacting_threads.join_all();
+  phrase_counters.compact_if_needed();
+
+  ASSERT_EQ(phrase_counters.size(), 2 * kNumKeys);
+  phrase_counters.for_each([&](const std::string& key, long count) {
+    ASSERT_EQ(count, key[0] == 'n' ? kNumThreads : kNumThreads * (kNumThreads + 1) / 2);
+  });
+
+  phrase_counters.clear();
+  phrase_counters.increase("key", 2);
+
+  int num_entries = 0;
+  phrase_counters.for_each([&](const std::string& key, long count) {
+    ASSERT_EQ(key, "key");
+    ASSERT_EQ(count, 2);
+    ++num_entries;
+  });
+  ASSERT_EQ(num_entries, 1);
+}
+
+TEST(TopmineTests, HugePageMemoryTest) {
+  ASSERT_EQ(HugePageMemory::parse_mode(""), HugePagesMode::kNone);
+  ASSERT_EQ(HugePageMemory::parse_mode("transparent"), HugePagesMode::kTransparent);
+  ASSERT_EQ(HugePageMemory::parse_mode("explicit"), HugePagesMode::kExplicit);
+  ASSERT_THROW(HugePageMemory::parse_mode("huge"), std::runtime_error);
+
+  // small regions always use normal pages
+  HugePageMemory small_memory(4096, HugePagesMode::kExplicit);
+  ASSERT_EQ(small_memory.get_mode(), HugePagesMode::kNone);
+
+  // explicit mode falls back if the pool is empty, memory is usable in any case
+  for (auto mode : { HugePagesMode::kNone, HugePagesMode::kTransparent, HugePagesMode::kExplicit }) {
+    const size_t size = HugePageMemory::kHugePageSize + 12345;
+    HugePageMemory memory(size, mode);
+    ASSERT_EQ(memory.size(), size);
+
+    char* data = static_cast<char*>(memory.data());
+    for (size_t i = 0; i < size; i += 4096) {
+      ASSERT_EQ(data[i], 0);
+      data[i] = 1;
+    }
+    ASSERT_EQ(data[size - 1], 0);
+
+    if (memory.get_mode() != HugePagesMode::kNone) {
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(data) % HugePageMemory::kHugePageSize, 0);
+    }
+  }
+
+  // the table works the same way with huge pages
+  ConcurrentPhraseCounters phrase_counters(1 << 20, HugePagesMode::kTransparent);
+  for (int i = 0; i < 1000; ++i) {
+    phrase_counters.increase("key|" + std::to_string(i % 10), 1);
+  }
+
+  long total_count = 0;
+  phrase_counters.for_each([&](const std::string& /*key*/, long count) {
+    ASSERT_EQ(count, 100);
+    total_count += count;
+  });
+  ASSERT_EQ(total_count, 1000);
+}
+
+TEST(TopmineTests, DedupTest) {
+  auto output_paths = prepare_paths();
+
+  boost::filesystem::path input_path("topmine_test_dir");
+  input_path.append("dedup_input.txt");
+
+  // each document is repeated with another id, some copies differ only in delimiters
+  std::ifstream input_stream(kInputPath);
+  std::ofstream repeated_stream(input_path.string());
+  int num_documents = 0;
+  for (std::string str; std::getline(input_stream, str); ++num_documents) {
+    repeated_stream << str << '\n';
+
+    std::string copy = str.substr(str.find(' ') + 1);
+    if (num_documents % 2 == 1) {
+      boost::replace_all(copy, " ", " \t ");
+    }
+    repeated_stream << 1000 + num_documents << ' ' << copy << '\n';
+  }
+  repeated_stream.close();
+
+  bool return_indices = true;
+  auto run_and_read = [&](bool dedup) {
+    Parameters parameters = {
+      input_path.string(),  // input_path
+      output_paths.first,   // output_path
+      output_paths.second,  // collocations_output_path
+      4,                    // collocation_max_size
+      2,                    // num_threads
+      2,                    // batch_size
+      6,                    // threshold
+      0.01,                 // alpha
+      return_indices,       // return_indices
+      false,                // use_cache
+      " \t",                // delimiters
+      '|',                  // esc_character
+      1,                    // num_decompression_threads
+      0,                    // num_parser_threads
+      1,                    // collocation_sizes_per_pass
+      0,                    // heavy_hitters_memory_mb
+      false,                // heavy_hitters_verify
+      kModeFull,            // mode
+      "",                   // model_path
+      "",                   // counts_output_path
+      "lexicographic",      // collocations_order
+      0,                    // min_df
+      0,                    // top_n
+      0,                    // sort_memory_mb
+      true,                 // collocations_stats
+      "",                   // output_format
+      false,                // pin_threads
+      false,                // numa_replicas
+      "",                   // huge_pages
+      dedup                 // dedup
+    };
+
+    TopmineImpl::run_topmine(parameters);
+
+    std::vector<std::string> lines;
+    for (const auto& path : { output_paths.first, output_paths.second }) {
+      std::ifstream result_stream(path);
+      std::vector<std::string> path_lines;
+      for (std::string str; std::getline(result_stream, str);) {
+        path_lines.push_back(str);
+      }
+
+      // documents are written in random order by several threads
+      std::sort(path_lines.begin(), path_lines.end());
+      lines.insert(lines.end(), path_lines.begin(), path_lines.end());
+    }
+    return lines;
+  };
+
+  // counting of unique documents with weights gives the same result as counting of all copies
+  auto lines = run_and_read(false);
+  ASSERT_GT(lines.size(), 2 * num_documents);
+  ASSERT_EQ(run_and_read(true), lines);
+
+  DocumentDeduplicator deduplicator;
+  ASSERT_TRUE(deduplicator.add(1, { "a", "b" }));
+  ASSERT_TRUE(deduplicator.add(2, { "ab" }));
+  ASSERT_FALSE(deduplicator.add(3, { "a", "b" }));
+  ASSERT_FALSE(deduplicator.add(4, { "a", "b" }));
+  deduplicator.finish();
+
+  ASSERT_EQ(deduplicator.get_num_documents(), 4);
+  ASSERT_EQ(deduplicator.get_num_unique_documents(), 2);
+  ASSERT_EQ(deduplicator.get_num_copies(1), 3);
+  ASSERT_EQ(deduplicator.get_num_copies(2), 1);
+
+  auto hash = deduplicator.get_hash({ "a", "b" });
+  ASSERT_EQ(deduplicator.get_num_copies(3, hash), 0);
+  ASSERT_EQ(deduplicator.get_num_copies(1, hash), 3);
+
+  // documents with colliding first hashes are copies only if their second hashes are equal too
+  DocumentDeduplicator colliding_deduplicator([](const std::vector<std::string>&) { return 42ULL; });
+  ASSERT_TRUE(colliding_deduplicator.add(1, { "a", "b" }));
+  ASSERT_TRUE(colliding_deduplicator.add(2, { "c" }));
+  ASSERT_TRUE(colliding_deduplicator.add(3, { "ab" }));
+  ASSERT_FALSE(colliding_deduplicator.add(4, { "a", "b" }));
+  colliding_deduplicator.finish();
+
+  ASSERT_EQ(colliding_deduplicator.get_num_unique_documents(), 3);
+  ASSERT_EQ(colliding_deduplicator.get_num_copies(1), 2);
+  ASSERT_EQ(colliding_deduplicator.get_num_copies(2), 1);
+
+  auto colliding_hash = colliding_deduplicator.get_hash({ "c" });
+  ASSERT_EQ(colliding_hash.first, colliding_deduplicator.get_hash({ "a", "b" }).first);
+  ASSERT_EQ(colliding_deduplicator.get_num_copies(2, colliding_hash), 1);
+  ASSERT_EQ(colliding_deduplicator.get_num_copies(4, colliding_deduplicator.get_hash({ "a", "b" })), 0);
+
+  // segmentation of a repeated document isn't reused by a colliding one
+  DocumentDeduplicator::Segmentation segmentation;
+  colliding_deduplicator.add_segmentation(colliding_deduplicator.get_hash({ "a", "b" }), { { 5, 2 } });
+  ASSERT_FALSE(colliding_deduplicator.get_segmentation(colliding_hash, &segmentation));
+  ASSERT_TRUE(colliding_deduplicator.get_segmentation(colliding_deduplicator.get_hash({ "a", "b" }), &segmentation));
+  ASSERT_EQ(segmentation, DocumentDeduplicator::Segmentation({ { 5, 2 } }));
+}
+
+TEST(TopmineTests, CheckpointTest) {
+  auto output_paths = prepare_paths();
+
+  boost::filesystem::path checkpoint_path("topmine_test_dir");
+  checkpoint_path.append("checkpoint.bin");
+  boost::filesystem::remove(checkpoint_path);
+
+  bool return_indices = false;
+  auto get_parameters = [&](const std::string& checkpoint_path, const std::string& resume_from, int threshold) {
+    Parameters parameters = {
+      kInputPath,           // input_path
+      output_paths.first,   // output_path
+      output_paths.second,  // collocations_output_path
+      4,                    // collocation_max_size
+      2,                    // num_threads
+      2,                    // batch_size
+      threshold,            // threshold
+      0.01,                 // alpha
+      return_indices,       // return_indices
+      false,                // use_cache
+      " \t",                // delimiters
+      '|',                  // esc_character
+      1,                    // num_decompression_threads
+      0,                    // num_parser_threads
+      1,                    // collocation_sizes_per_pass
+      0,                    // heavy_hitters_memory_mb
+      false,                // heavy_hitters_verify
+      kModeFull,            // mode
+      "",                   // model_path
+      "",                   // counts_output_path
+      "",                   // collocations_order
+      0,                    // min_df
+      0,                    // top_n
+      0,                    // sort_memory_mb
+      false,                // collocations_stats
+      "",                   // output_format
+      false,                // pin_threads
+      false,                // numa_replicas
+      "",                   // huge_pages
+      true,                 // dedup
+      checkpoint_path,      // checkpoint_path
+      resume_from           // resume_from
+    };
+    return parameters;
+  };
+
+  TopmineImpl::run_topmine(get_parameters(checkpoint_path.string(), "", 3));
+  check_results(output_paths, return_indices);
+  ASSERT_TRUE(boost::filesystem::exists(checkpoint_path));
+  ASSERT_FALSE(boost::filesystem::exists(checkpoint_path.string() + ".tmp"));
+
+  // all counting stages are restored from checkpoint, so only scoring is done
+  boost::filesystem::remove(output_paths.first);
+  boost::filesystem::remove(output_paths.second);
+  TopmineImpl::run_topmine(get_parameters("", checkpoint_path.string(), 3));
+  check_results(output_paths, return_indices);
+
+  ASSERT_THROW(TopmineImpl::run_topmine(get_parameters("", checkpoint_path.string(), 4)), std::runtime_error);
+
+  // counts of other tokenization aren't mixed with the checkpoint
+  auto other_delimiters_parameters = get_parameters("", checkpoint_path.string(), 3);
+  other_delimiters_parameters.delimiters = " ";
+  ASSERT_THROW(TopmineImpl::run_topmine(other_delimiters_parameters), std::runtime_error);
+
+  auto deterministic_parameters = get_parameters("", checkpoint_path.string(), 3);
+  deterministic_parameters.deterministic = true;
+  ASSERT_THROW(TopmineImpl::run_topmine(deterministic_parameters), std::runtime_error);
+
+  auto boundaries_parameters = get_parameters("", checkpoint_path.string(), 3);
+  boundaries_parameters.boundaries = ".";
+  ASSERT_THROW(TopmineImpl::run_topmine(boundaries_parameters), std::runtime_error);
+
+  // checkpoint of other collection isn't resumed
+  boost::filesystem::path other_input_path("topmine_test_dir");
+  other_input_path.append("checkpoint_other_input.txt");
+  boost::filesystem::copy_file(kInputPath, other_input_path, boost::filesystem::copy_option::overwrite_if_exists);
+  std::ofstream other_input_stream(other_input_path.string(), std::ios::app);
+  other_input_stream << "100 другой документ" << std::endl;
+  other_input_stream.close();
+
+  auto other_input_parameters = get_parameters("", checkpoint_path.string(), 3);
+  other_input_parameters.input_path = other_input_path.string();
+  ASSERT_THROW(TopmineImpl::run_topmine(other_input_parameters), std::runtime_error);
+
+  // state of counting stages is restored exactly
+  auto dictionary = std::make_shared<ThreadSafeDictionary>();
+  auto index_to_counter = std::make_shared<ThreadSafeCounters>();
+  auto collocation_start_indices = std::make_shared<ThreadSafeCollocationStartIndices>();
+  auto deduplicator = std::make_shared<DocumentDeduplicator>();
+
+  dictionary->add("a");
+  dictionary->add("b|c");
+  index_to_counter->increase(1, 2.5);
+  collocation_start_indices->add_indices(7, { 0, 3, 4 });
+  collocation_start_indices->add_indices(8, { });
+  deduplicator->add(7, { "a", "b" });
+  deduplicator->add(8, { "a", "b" });
+  deduplicator->finish();
+  auto token_mask = std::make_shared<TokenMask>();
+  token_mask->mask(0);
+
+  CheckpointHeader header = { 2, 100, 4, 1, 0, false, 3, true, true, "stop_words.txt", 2, 0.5, 1000, " \t", '|',
+                              false, ".," };
+  Checkpoint::store(checkpoint_path.string(),
+                    header,
+                    dictionary,
+                    index_to_counter,
+                    collocation_start_indices,
+                    deduplicator,
+                    token_mask);
+
+  auto loaded_dictionary = std::make_shared<ThreadSafeDictionary>();
+  auto loaded_index_to_counter = std::make_shared<ThreadSafeCounters>();
+  auto loaded_collocation_start_indices = std::make_shared<ThreadSafeCollocationStartIndices>();
+  auto loaded_deduplicator = std::make_shared<DocumentDeduplicator>();
+  auto loaded_token_mask = std::make_shared<TokenMask>();
+
+  auto loaded_header = Checkpoint::load(checkpoint_path.string(),
+                                        loaded_dictionary,
+                                        loaded_index_to_counter,
+                                        loaded_collocation_start_indices,
+                                        loaded_deduplicator,
+                                        loaded_token_mask);
+
+  ASSERT_EQ(loaded_header.num_finished_stages, 2);
+  ASSERT_EQ(loaded_header.total_collection_size, 100);
+  ASSERT_EQ(loaded_header.stop_words_path, "stop_words.txt");
+  ASSERT_EQ(loaded_header.min_unigram_df, 2);
+  ASSERT_EQ(loaded_header.max_unigram_ratio, 0.5);
+  ASSERT_EQ(loaded_header.input_size, 1000);
+  ASSERT_EQ(loaded_header.delimiters, " \t");
+  ASSERT_EQ(loaded_header.esc_character, '|');
+  ASSERT_EQ(loaded_header.boundaries, ".,");
+  ASSERT_EQ(*(loaded_dictionary->get_index("b|c")), 1);
+  ASSERT_EQ(*(loaded_index_to_counter->get(1)), 2.5);
+  ASSERT_EQ(loaded_index_to_counter->size(), 1);
+  ASSERT_EQ(loaded_collocation_start_indices->get_indices(7), std::vector<int>({ 0, 3, 4 }));
+  ASSERT_TRUE(loaded_collocation_start_indices->get_indices(8).empty());
+  ASSERT_EQ(loaded_deduplicator->get_num_copies(7), 2);
+  ASSERT_EQ(loaded_deduplicator->get_num_documents(), 2);
+  ASSERT_EQ(loaded_deduplicator->get_num_repeated_documents(), 1);
+  ASSERT_EQ(loaded_token_mask->get_masked_indices(), std::vector<int>({ 0 }));
+
+  ASSERT_THROW(Checkpoint::load(checkpoint_path.string(),
+                                std::make_shared<ThreadSafeDictionary>(),
+                                std::make_shared<ThreadSafeCounters>(),
+                                std::make_shared<ThreadSafeCollocationStartIndices>(),
+                                nullptr,
+                                nullptr),
+               std::runtime_error);
+}
+
+TEST(TopmineTests, MemoryLimitTest) {
+  auto output_paths = prepare_paths();
+
+  bool return_indices = false;
+  Parameters parameters = {
+    kInputPath,           // input_path
+    output_paths.first,   // output_path
+    output_paths.second,  // collocations_output_path
+    4,                    // collocation_max_size
+    2,                    // num_threads
+    2,                    // batch_size
+    3,                    // threshold
+    0.01,                 // alpha
+    return_indices,       // return_indices
+    true,                 // use_cache
+    " \t",                // delimiters
+    '|',                  // esc_character
+    1,                    // num_decompression_threads
+    0,                    // num_parser_threads
+    2,                    // collocation_sizes_per_pass
+    0,                    // heavy_hitters_memory_mb
+    false,                // heavy_hitters_verify
+    kModeFull,            // mode
+    "",                   // model_path
+    "",                   // counts_output_path
+    "",                   // collocations_order
+    0,                    // min_df
+    0,                    // top_n
+    0,                    // sort_memory_mb
+    false,                // collocations_stats
+    "",                   // output_format
+    false,                // pin_threads
+    false,                // numa_replicas
+    "",                   // huge_pages
+    false,                // dedup
+    "",                   // checkpoint_path
+    "",                   // resume_from
+    1                     // memory_limit_mb
+  };
+
+  TopmineImpl::run_topmine(parameters);
+  check_results(output_paths, return_indices);
+
+  // counters are spilled after each increase with zero budget, merged counts are the same
+  boost::filesystem::path path_prefix("topmine_test_dir");
+  path_prefix.append("spill_test");
+
+  ConcurrentPhraseCounters phrase_counters(16, HugePagesMode::kNone);
+  PhraseCountsSpiller spiller(path_prefix.string(), 0);
+
+  const int kNumKeys = 100;
+  for (int i = 0; i < 3 * kNumKeys; ++i) {
+    phrase_counters.increase("key|" + std::to_string(i % kNumKeys), i % 3 + 1);
+    if (i % 7 == 0) {
+      spiller.spill_if_needed(&phrase_counters);
+    }
+  }
+  ASSERT_GT(spiller.get_num_runs(), 1);
+  ASSERT_TRUE(boost::filesystem::exists(path_prefix.string() + ".counts_run_0"));
+
+  std::string prev_key;
+  int num_keys = 0;
+  spiller.merge(&phrase_counters, [&](const std::string& key, long count) {
+    ASSERT_LT(prev_key, key);
+    ASSERT_EQ(count, 6);
+    prev_key = key;
+    ++num_keys;
+  });
+
+  ASSERT_EQ(num_keys, kNumKeys);
+  ASSERT_EQ(spiller.get_num_runs(), 0);
+  ASSERT_EQ(phrase_counters.size(), 0);
+  ASSERT_FALSE(boost::filesystem::exists(path_prefix.string() + ".counts_run_0"));
+
+  // runs which can't be opened at once are merged by levels
+  PhraseCountsSpiller levels_spiller(path_prefix.string(), 0, 3);
+  for (int i = 0; i < 3 * kNumKeys; ++i) {
+    phrase_counters.increase("key|" + std::to_string(i % kNumKeys), i % 3 + 1);
+    levels_spiller.spill_if_needed(&phrase_counters);
+  }
+  ASSERT_EQ(levels_spiller.get_num_runs(), 3 * kNumKeys);
+  ASSERT_EQ(phrase_counters.get_memory_usage(), phrase_counters.get_initial_memory_usage());
+
+  num_keys = 0;
+  levels_spiller.merge(&phrase_counters, [&](const std::string& /*key*/, long count) {
+    ASSERT_EQ(count, 6);
+    ++num_keys;
+  });
+  ASSERT_EQ(num_keys, kNumKeys);
+
+  for (boost::filesystem::directory_iterator iter(path_prefix.parent_path()), end; iter != end; ++iter) {
+    ASSERT_EQ(iter->path().filename().string().find("spill_test.counts_run_"), std::string::npos);
+  }
+
+  // grown table is shrunk by spilling, so its memory doesn't stay above the budget
+  for (int i = 0; i < 10 * kNumKeys; ++i) {
+    phrase_counters.increase("key|" + std::to_string(i), 1);
+  }
+  phrase_counters.compact_if_needed();
+  ASSERT_GT(phrase_counters.get_capacity(), 1024);
+
+  levels_spiller.spill_if_needed(&phrase_counters);
+  ASSERT_EQ(phrase_counters.get_capacity(), 1024);
+  ASSERT_EQ(phrase_counters.get_memory_usage(), phrase_counters.get_initial_memory_usage());
+  levels_spiller.merge(&phrase_counters, [](const std::string& /*key*/, long /*count*/) { });
+
+  // collocations flushed after spilling are the same as without it
+  std::map<std::string, double> flushed_counts[2];
+  for (bool spill : { false, true }) {
+    auto flushed_phrase_counters = std::make_shared<ConcurrentPhraseCounters>(16, HugePagesMode::kNone);
+    auto flushed_spiller = spill ? std::make_shared<PhraseCountsSpiller>(path_prefix.string(), 0) : nullptr;
+    for (int i = 0; i < 3 * kNumKeys; ++i) {
+      flushed_phrase_counters->increase("key|" + std::to_string(i % kNumKeys), i % 3 + 1);
+      if (flushed_spiller != nullptr && i % 7 == 0) {
+        flushed_spiller->spill_if_needed(flushed_phrase_counters.get());
+      }
+    }
+
+    auto flushed_dictionary = std::make_shared<ThreadSafeDictionary>();
+    auto flushed_index_to_counter = std::make_shared<ThreadSafeCounters>();
+    CollocationsProcessor::flush_phrase_counters(flushed_phrase_counters,
+                                                 flushed_spiller,
+                                                 flushed_dictionary,
+                                                 flushed_index_to_counter,
+                                                 false);
+    for (const auto& index_counter : flushed_index_to_counter->get_all_unsafe()) {
+      flushed_counts[spill][flushed_dictionary->get_token(index_counter.first).to_string()] = index_counter.second;
+    }
+  }
+  ASSERT_EQ(flushed_counts[0].size(), kNumKeys);
+  ASSERT_EQ(flushed_counts[0], flushed_counts[1]);
+
+  // lost or truncated runs are errors instead of missing counts
+  for (bool truncate : { false, true }) {
+    PhraseCountsSpiller failing_spiller(path_prefix.string(), 0);
+    phrase_counters.increase("key|0", 1);
+    failing_spiller.spill_if_needed(&phrase_counters);
+    phrase_counters.increase("key|1", 1);
+    failing_spiller.spill_if_needed(&phrase_counters);
+    ASSERT_EQ(failing_spiller.get_num_runs(), 2);
+
+    std::string run_path = path_prefix.string() + ".counts_run_1";
+    if (truncate) {
+      boost::filesystem::resize_file(run_path, boost::filesystem::file_size(run_path) - 1);
+    } else {
+      boost::filesystem::remove(run_path);
+    }
+    ASSERT_THROW(failing_spiller.merge(&phrase_counters, [](const std::string& /*key*/, long /*count*/) { }),
+                 std::runtime_error);
+    phrase_counters.clear();
+  }
+
+  ThreadSafeDictionary dictionary;
+  size_t empty_memory_usage = dictionary.get_memory_usage();
+  dictionary.add(std::string(100, 'a'));
+  ASSERT_GT(dictionary.get_memory_usage(), empty_memory_usage + 200);
+}
+
+namespace {
+  // frequencies of tokens and pairs of a collection, a third of pairs are never met
+  void generate_frequencies(int num_pairs, std::vector<double>* token_frequencies, std::vector<double>* pair_frequencies) {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> distribution(0, 1000);
+
+    for (int i = 0; i <= num_pairs; ++i) {
+      token_frequencies->push_back(1 + distribution(generator));
+    }
+    for (int i = 0; i < num_pairs; ++i) {
+      pair_frequencies->push_back(i % 3 == 0 ? 0.0 : distribution(generator) / 10);
+    }
+  }
+}  // namespace
+
+TEST(TopmineTests, PairScoresTest) {
+  // odd number of pairs checks the scalar tail of vectorized versions
+  const int kNumPairs = 1001;
+  std::vector<double> token_frequencies;
+  std::vector<double> pair_frequencies;
+  generate_frequencies(kNumPairs, &token_frequencies, &pair_frequencies);
+
+  std::vector<double> scores(kNumPairs);
+  std::vector<double> scalar_scores(kNumPairs);
+  PairScores::compute(token_frequencies.data(), pair_frequencies.data(), kNumPairs, 1e5, scores.data());
+  PairScores::compute_scalar(token_frequencies.data(), pair_frequencies.data(), kNumPairs, 1e5, scalar_scores.data());
+
+  for (int i = 0; i < kNumPairs; ++i) {
+    ASSERT_EQ(scores[i], scalar_scores[i]);
+    ASSERT_EQ(scores[i], PairScores::compute_score(token_frequencies[i], token_frequencies[i + 1], pair_frequencies[i], 1e5));
+  }
+  ASSERT_EQ(scores[0], 0.0);
+
+  std::string version = PairScores::get_version();
+  ASSERT_TRUE(version == "avx" || version == "sse2" || version == "scalar");
+}
+
+// microbenchmark, is run with --gtest_also_run_disabled_tests
+TEST(TopmineTests, DISABLED_PairScoresBenchmark) {
+  // short documents of ten tokens and long ones of thousand tokens, the same number of pairs
+  const long kTotalNumPairs = 1L << 25;
+  for (int num_pairs : { 9, 999 }) {
+    std::vector<double> token_frequencies;
+    std::vector<double> pair_frequencies;
+    generate_frequencies(num_pairs, &token_frequencies, &pair_frequencies);
+    std::vector<double> scores(num_pairs);
+
+    auto measure = [&](const std::function<void()>& function) {
+      auto time_start = std::chrono::steady_clock::now();
+      for (long i = 0; i < kTotalNumPairs / num_pairs; ++i) {
+        function();
+      }
+      std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - time_start;
+      return duration.count() / kTotalNumPairs;
+    };
+
+    // the previous path: each pair is scored separately
+    double per_pair_time = measure([&]() {
+      for (int i = 0; i < num_pairs; ++i) {
+        scores[i] = PairScores::compute_score(token_frequencies[i], token_frequencies[i + 1], pair_frequencies[i], 1e5);
+      }
+    });
+    double scalar_time = measure([&]() {
+      PairScores::compute_scalar(token_frequencies.data(), pair_frequencies.data(), num_pairs, 1e5, scores.data());
+    });
+    double vectorized_time = measure([&]() {
+      PairScores::compute(token_frequencies.data(), pair_frequencies.data(), num_pairs, 1e5, scores.data());
+    });
+
+    std::cout << "Pair scores of documents with " << num_pairs << " pairs, ns per pair: per pair "
+              << per_pair_time << ", scalar " << scalar_time << ", "
+              << PairScores::get_version() << " " << vectorized_time << std::endl;
+  }
+}
+
+TEST(TopmineTests, PairsOnlyTest) {
+  auto output_paths = prepare_paths();
+
+  Parameters parameters = {
+    kInputPath,           // input_path
+    output_paths.first,   // output_path
+    output_paths.second,  // collocations_output_path
+    2,                    // collocation_max_size
+    1,                    // num_threads
+    2,                    // batch_size
+    3,                    // threshold
+    0.01,                 // alpha
+    false,                // return_indices
+    false,                // use_cache
+    " \t",                // delimiters
+    '|'                   // esc_character
+  };
+
+  TopmineImpl::run_topmine(parameters);
+
+  std::vector<std::string> documents;
+  std::ifstream result_stream(output_paths.first);
+  for (std::string str; std::getline(result_stream, str);) {
+    documents.push_back(str);
+  }
+  ASSERT_EQ(documents.size(), 7);
+  ASSERT_EQ(documents[1], "2 ты работаешь лучше чем метод|опорных векторов|ща");
+  ASSERT_EQ(documents[2], "3 мой лучше|метод опорных|векторов лучше твоего");
+
+  // pairs overlapping with merged ones on the left are counted too, but are not written
+  std::unordered_map<std::string, int> collocation_to_df;
+  std::ifstream collocations_stream(output_paths.second);
+  for (std::string str; std::getline(collocations_stream, str);) {
+    std::vector<std::string> parts;
+    boost::split(parts, str, boost::is_any_of(" "));
+    collocation_to_df[parts[0]] = std::stoi(parts[1]);
+  }
+
+  ASSERT_EQ(collocation_to_df.size(), 8);
+  ASSERT_EQ(collocation_to_df["метод|опорных"], 7);
+  ASSERT_EQ(collocation_to_df["опорных|векторов"], 7);
+  ASSERT_EQ(collocation_to_df["векторов|ща"], 3);
+  ASSERT_EQ(collocation_to_df["а|ты"], 3);
+  ASSERT_EQ(collocation_to_df["лучше|метод"], 1);
+}
+
+TEST(TopmineTests, DeterministicTest) {
+  auto output_paths = prepare_paths();
+
+  // many small batches of a larger collection, so threads finish them in different orders,
+  // ids of the copies of the test documents are prefixed with the number of copy
+  boost::filesystem::path input_path("topmine_test_dir");
+  input_path.append("deterministic_input.txt");
+
+  std::ofstream input_stream(input_path.string());
+  for (int i = 1; i <= 50; ++i) {
+    std::ifstream test_data_stream(kInputPath);
+    for (std::string str; std::getline(test_data_stream, str);) {
+      input_stream << i << str << '\n';
+    }
+  }
+  input_stream.close();
+
+  auto read_file = [](const std::string& path) {
+    std::ifstream stream(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  };
+
+  for (const std::string output_format : { "", "binary" }) {
+    std::string expected_output;
+    std::string expected_collocations;
+
+    for (int num_threads : { 1, 3 }) {
+      for (int num_parser_threads : { 0, 2 }) {
+        // batches of the next passes come from the cache in the order of processing
+        bool use_cache = num_parser_threads > 0;
+        Parameters parameters = {
+          input_path.string(),  // input_path
+          output_paths.first,   // output_path
+          output_paths.second,  // collocations_output_path
+          4,                    // collocation_max_size
+          num_threads,          // num_threads
+          2,                    // batch_size
+          3,                    // threshold
+          0.01,                 // alpha
+          false,                // return_indices
+          use_cache,            // use_cache
+          " \t",                // delimiters
+          '|',                  // esc_character
+          1,                    // num_decompression_threads
+          num_parser_threads,   // num_parser_threads
+          1,                    // collocation_sizes_per_pass
+          0,                    // heavy_hitters_memory_mb
+          false,                // heavy_hitters_verify
+          kModeFull,            // mode
+          "",                   // model_path
+          "",                   // counts_output_path
+          "",                   // collocations_order
+          0,                    // min_df
+          0,                    // top_n
+          0,                    // sort_memory_mb
+          true,                 // collocations_stats
+          output_format,        // output_format
+          false,                // pin_threads
+          false,                // numa_replicas
+          "",                   // huge_pages
+          false,                // dedup
+          "",                   // checkpoint_path
+          "",                   // resume_from
+          0,                    // memory_limit_mb
+          true                  // deterministic
+        };
+
+        TopmineImpl::run_topmine(parameters);
+
+        auto output = read_file(output_paths.first);
+        auto collocations = read_file(output_paths.second);
+        ASSERT_FALSE(output.empty());
+        ASSERT_FALSE(collocations.empty());
+
+        // documents are written in input order
+        if (output_format.empty()) {
+          std::istringstream output_stream(output);
+          long prev_id = 0;
+          for (std::string str; std::getline(output_stream, str);) {
+            long id = std::stol(str.substr(0, str.find(' ')));
+            ASSERT_LT(prev_id, id);
+            prev_id = id;
+          }
+        }
+
+        if (expected_output.empty()) {
+          expected_output = output;
+          expected_collocations = collocations;
+        } else {
+          ASSERT_EQ(output, expected_output);
+          ASSERT_EQ(collocations, expected_collocations);
+        }
+      }
+    }
+  }
+
+  // tokens are ordered by length, then lexicographically
+  ThreadSafeDictionary dictionary;
+  for (const auto& token : { "b", "dd", "c", "a", "e" }) {
+    dictionary.add(token);
+  }
+  auto new_indices = dictionary.sort_tokens(1, [&](int index, int other_index) {
+    return dictionary.get_token_unsafe(index).size() < dictionary.get_token_unsafe(other_index).size();
+  });
+  ASSERT_EQ(new_indices, std::vector<int>({ 0, 4, 2, 1, 3 }));
+  ASSERT_EQ(dictionary.get_token(1), "a");
+  ASSERT_EQ(*dictionary.get_index("dd"), 4);
+  ASSERT_EQ(*dictionary.get_index("b"), 0);
+}
+
+TEST(TopmineTests, TokenMaskTest) {
+  auto output_paths = prepare_paths();
+
+  boost::filesystem::path stop_words_path("topmine_test_dir");
+  stop_words_path.append("stop_words.txt");
+  std::ofstream stop_words_stream(stop_words_path.string());
+  stop_words_stream << "ты\n\nнеизвестное   rbf\n";
+  stop_words_stream.close();
+
+  boost::filesystem::path checkpoint_path("topmine_test_dir");
+  checkpoint_path.append("token_mask_checkpoint.bin");
+  boost::filesystem::remove(checkpoint_path);
+
+  auto get_parameters = [&](const std::string& stop_words_path,
+                            float max_unigram_ratio,
+                            const std::string& checkpoint_path,
+                            const std::string& resume_from) {
+    Parameters parameters = {
+      kInputPath,           // input_path
+      output_paths.first,   // output_path
+      output_paths.second,  // collocations_output_path
+      4,                    // collocation_max_size
+      2,                    // num_threads
+      2,                    // batch_size
+      3,                    // threshold
+      0.01,                 // alpha
+      false,                // return_indices
+      false,                // use_cache
+      " \t",                // delimiters
+      '|',                  // esc_character
+      1,                    // num_decompression_threads
+      0,                    // num_parser_threads
+      1,                    // collocation_sizes_per_pass
+      0,                    // heavy_hitters_memory_mb
+      false,                // heavy_hitters_verify
+      kModeFull,            // mode
+      "",                   // model_path
+      "",                   // counts_output_path
+      "",                   // collocations_order
+      0,                    // min_df
+      0,                    // top_n
+      0,                    // sort_memory_mb
+      false,                // collocations_stats
+      "",                   // output_format
+      false,                // pin_threads
+      false,                // numa_replicas
+      "",                   // huge_pages
+      false,                // dedup
+      checkpoint_path,      // checkpoint_path
+      resume_from,          // resume_from
+      0,                    // memory_limit_mb
+      false,                // deterministic
+      stop_words_path,      // stop_words_path
+      0,                    // min_unigram_df
+      max_unigram_ratio     // max_unigram_ratio
+    };
+    return parameters;
+  };
+
+  auto read_lines = [](const std::string& path) {
+    std::ifstream stream(path);
+    std::vector<std::string> lines;
+    for (std::string str; std::getline(stream, str);) {
+      lines.push_back(str);
+    }
+
+    // documents are written in random order by several threads
+    std::sort(lines.begin(), lines.end());
+    return lines;
+  };
+
+  // stop word splits 'а|ты', the other collocations are the same as without masking
+  TopmineImpl::run_topmine(get_parameters(stop_words_path.string(), 0.0, checkpoint_path.string(), ""));
+  auto documents = read_lines(output_paths.first);
+  auto collocations = read_lines(output_paths.second);
+
+  ASSERT_EQ(documents.size(), 7);
+  ASSERT_EQ(documents[4], "5 а ты метод|опорных|векторов выучил");
+  ASSERT_EQ(documents[6], "7 а ты используешь rbf ядра когда используешь метод|опорных|векторов|ща");
+  ASSERT_EQ(collocations, std::vector<std::string>({ "лучше 2",
+                                                     "метод|опорных|векторов 4",
+                                                     "метод|опорных|векторов|ща 3",
+                                                     "опорных 1" }));
+
+  // the mask is restored from checkpoint with the other state of counting
+  TopmineImpl::run_topmine(get_parameters(stop_words_path.string(), 0.0, "", checkpoint_path.string()));
+  ASSERT_EQ(read_lines(output_paths.first), documents);
+  ASSERT_EQ(read_lines(output_paths.second), collocations);
+  ASSERT_THROW(TopmineImpl::run_topmine(get_parameters("", 0.0, "", checkpoint_path.string())), std::runtime_error);
+  ASSERT_THROW(TopmineImpl::run_topmine(get_parameters(stop_words_path.string(), 0.9, "", checkpoint_path.string())),
+               std::runtime_error);
+
+  // tokens of all documents are masked, so only 'а|ты' is left
+  TopmineImpl::run_topmine(get_parameters("", 0.9, "", ""));
+  ASSERT_EQ(read_lines(output_paths.second), std::vector<std::string>({ "а|ты 3" }));
+
+  TokenMask token_mask;
+  token_mask.mask(5);
+  token_mask.mask(2);
+  token_mask.mask(5);
+  ASSERT_EQ(token_mask.size(), 2);
+  ASSERT_EQ(token_mask.get_masked_indices(), std::vector<int>({ 2, 5 }));
+  ASSERT_TRUE(token_mask.is_masked(2));
+  ASSERT_FALSE(token_mask.is_masked(3));
+  ASSERT_FALSE(token_mask.is_masked(100));
+  ASSERT_EQ(TokenMask::load_stop_words(stop_words_path.string()),
+            std::vector<std::string>({ "ты", "неизвестное", "rbf" }));
+}
+
+TEST(TopmineTests, BoundariesTest) {
+  auto output_paths = prepare_paths();
+
+  // documents split by boundaries give the same collocations as their segments given as separate documents
+  boost::filesystem::path input_path("topmine_test_dir");
+  input_path.append("boundaries_input.txt");
+  boost::filesystem::path segments_input_path("topmine_test_dir");
+  segments_input_path.append("boundaries_segments_input.txt");
+
+  std::ofstream input_stream(input_path.string());
+  std::ofstream segments_input_stream(segments_input_path.string());
+  std::ifstream test_data_stream(kInputPath);
+  for (std::string str; std::getline(test_data_stream, str);) {
+    long id = std::stol(str.substr(0, str.find(' ')));
+    std::vector<std::string> tokens;
+    boost::split(tokens, str.substr(str.find(' ') + 1), boost::is_any_of(" "));
+
+    // segments end after each third token of odd documents
+    input_stream << id;
+    segments_input_stream << id * 100;
+    for (int i = 0; i < tokens.size(); ++i) {
+      bool is_segment_start = id % 2 == 1 && i > 0 && i % 3 == 0;
+      input_stream << (is_segment_start ? (i % 2 == 0 ? ", " : " .") : " ") << tokens[i];
+      segments_input_stream << (is_segment_start ? "\n" + std::to_string(id * 100 + i) : "") << ' ' << tokens[i];
+    }
+    input_stream << '\n';
+    segments_input_stream << '\n';
+  }
+  input_stream.close();
+  segments_input_stream.close();
+
+  auto run_and_read = [&](const std::string& input_path, const std::string& boundaries, int collocation_max_size) {
+    Parameters parameters = {
+      input_path,            // input_path
+      output_paths.first,    // output_path
+      output_paths.second,   // collocations_output_path
+      collocation_max_size,  // collocation_max_size
+      2,                     // num_threads
+      2,                     // batch_size
+      2,                     // threshold
+      0.01,                  // alpha
+      false,                 // return_indices
+      false,                 // use_cache
+      " ",                   // delimiters
+      '|',                   // esc_character
+      1,                     // num_decompression_threads
+      0,                     // num_parser_threads
+      1,                     // collocation_sizes_per_pass
+      0,                     // heavy_hitters_memory_mb
+      false,                 // heavy_hitters_verify
+      kModeFull,             // mode
+      "",                    // model_path
+      "",                    // counts_output_path
+      "lexicographic",       // collocations_order
+      0,                     // min_df
+      0,                     // top_n
+      0,                     // sort_memory_mb
+      true,                  // collocations_stats
+      "",                    // output_format
+      false,                 // pin_threads
+      false,                 // numa_replicas
+      "",                    // huge_pages
+      false,                 // dedup
+      "",                    // checkpoint_path
+      "",                    // resume_from
+      0,                     // memory_limit_mb
+      false,                 // deterministic
+      "",                    // stop_words_path
+      0,                     // min_unigram_df
+      0.0,                   // max_unigram_ratio
+      boundaries             // boundaries
+    };
+
+    TopmineImpl::run_topmine(parameters);
+
+    std::ifstream collocations_stream(output_paths.second);
+    std::vector<std::string> collocations;
+    for (std::string str; std::getline(collocations_stream, str);) {
+      collocations.push_back(str);
+    }
+    return collocations;
+  };
+
+  for (int collocation_max_size : { 2, 4 }) {
+    auto collocations = run_and_read(input_path.string(), ".,", collocation_max_size);
+    ASSERT_FALSE(collocations.empty());
+    ASSERT_EQ(collocations, run_and_read(segments_input_path.string(), "", collocation_max_size));
+
+    // without boundaries punctuation stays in tokens, so the result differs
+    ASSERT_NE(collocations, run_and_read(input_path.string(), "", collocation_max_size));
+  }
+
+  Batch batch(" ", ".,");
+  batch.add_document("5 а ты, метод опорных .векторов");
+  batch.add_document("6 a,b .. c");
+  const auto& document = batch.get_documents()[0];
+  ASSERT_EQ(Utils::join_strings(document.tokens, ' '), "а ты метод опорных векторов");
+  ASSERT_EQ(document.segment_starts, std::vector<int>({ 2, 4 }));
+  ASSERT_EQ(document.get_segment_end(0), 2);
+  ASSERT_EQ(document.get_segment_end(2), 4);
+  ASSERT_EQ(document.get_segment_end(4), 5);
+  ASSERT_EQ(batch.get_documents()[1].segment_starts, std::vector<int>({ 1, 2 }));
+
+  // segments of recycled documents are cleared
+  batch.clear();
+  batch.add_document("7 a b");
+  ASSERT_TRUE(batch.get_documents()[0].segment_starts.empty());
+}
+
+TEST(TopmineTests, CApiTest) {
+  auto output_paths = prepare_paths();
+
+  // segmentation of the command line tool is the reference for models trained through C API
+  Parameters parameters = {
+    kInputPath,           // input_path
+    output_paths.first,   // output_path
+    output_paths.second,  // collocations_output_path
+    3,                    // collocation_max_size
+    2,                    // num_threads
+    2,                    // batch_size
+    2,                    // threshold
+    0.01,                 // alpha
+    true,                 // return_indices
+    false,                // use_cache
+    " ",                  // delimiters
+    '|',                  // esc_character
+    1,                    // num_decompression_threads
+    0,                    // num_parser_threads
+    1,                    // collocation_sizes_per_pass
+    0,                    // heavy_hitters_memory_mb
+    false,                // heavy_hitters_verify
+    kModeFull,            // mode
+    "",                   // model_path
+    "",                   // counts_output_path
+    "none",               // collocations_order
+    0,                    // min_df
+    0,                    // top_n
+    0,                    // sort_memory_mb
+    false,                // collocations_stats
+    "",                   // output_format
+    false,                // pin_threads
+    false,                // numa_replicas
+    "",                   // huge_pages
+    false,                // dedup
+    "",                   // checkpoint_path
+    "",                   // resume_from
+    0,                    // memory_limit_mb
+    false,                // deterministic
+    "",                   // stop_words_path
+    0,                    // min_unigram_df
+    0.0,                  // max_unigram_ratio
+    ""                    // boundaries
+  };
+
+  TopmineImpl::run_topmine(parameters);
+
+  std::unordered_map<long, std::vector<int32_t>> id_to_span_lengths;
+  std::ifstream output_stream(output_paths.first);
+  for (std::string str; std::getline(output_stream, str);) {
+    std::vector<std::string> fields;
+    boost::split(fields, str, boost::is_any_of(" "));
+    for (int i = 1; i < fields.size(); ++i) {
+      id_to_span_lengths[std::stol(fields[0])].push_back(std::stoi(fields[i].substr(fields[i].find('|') + 1)));
+    }
+  }
+
+  // the same documents as texts and as ids of their tokens
+  std::vector<long> ids;
+  std::vector<std::string> texts;
+  std::vector<int32_t> token_ids;
+  std::vector<int64_t> document_offsets({ 0 });
+  std::unordered_map<std::string, int32_t> token_to_id;
+
+  std::ifstream input_stream(kInputPath);
+  for (std::string str; std::getline(input_stream, str);) {
+    ids.push_back(std::stol(str.substr(0, str.find(' '))));
+    texts.push_back(str.substr(str.find(' ') + 1));
+
+    std::vector<std::string> tokens;
+    boost::split(tokens, texts.back(), boost::is_any_of(" "));
+    for (const auto& token : tokens) {
+      token_ids.push_back(token_to_id.emplace(token, token_to_id.size()).first->second);
+    }
+    document_offsets.push_back(token_ids.size());
+  }
+
+  std::vector<const char*> documents;
+  for (const auto& text : texts) {
+    documents.push_back(text.c_str());
+  }
+
+  topmine_options options;
+  topmine_options_init(&options);
+  options.collocation_max_size = 3;
+  options.threshold = 2;
+  options.alpha = 0.01;
+  options.num_threads = 2;
+  options.batch_size = 2;
+
+  topmine_model* text_model = nullptr;
+  topmine_model* ids_model = nullptr;
+  ASSERT_EQ(topmine_train_file(kInputPath.c_str(), &options, &text_model), 0) << topmine_last_error();
+  ASSERT_EQ(topmine_train_ids(token_ids.data(), document_offsets.data(), ids.size(), &options, &ids_model), 0)
+    << topmine_last_error();
+
+  // spans of document i are span_lengths[span_offsets[i]] ... span_lengths[span_offsets[i + 1] - 1]
+  auto check_span_lengths = [&](const std::vector<int32_t>& span_lengths, const std::vector<int64_t>& span_offsets) {
+    for (int i = 0; i < ids.size(); ++i) {
+      std::vector<int32_t> document_span_lengths(span_lengths.begin() + span_offsets[i],
+                                                 span_lengths.begin() + span_offsets[i + 1]);
+      ASSERT_EQ(document_span_lengths, id_to_span_lengths[ids[i]]);
+    }
+  };
+
+  std::vector<int32_t> span_lengths(token_ids.size());
+  std::vector<int64_t> span_offsets(ids.size() + 1);
+  ASSERT_EQ(topmine_segment_texts(text_model, documents.data(), documents.size(),
+                                  span_lengths.data(), span_lengths.size(), span_offsets.data()), 0);
+  check_span_lengths(span_lengths, span_offsets);
+
+  ASSERT_EQ(topmine_segment_ids(ids_model, token_ids.data(), document_offsets.data(), ids.size(),
+                                span_lengths.data(), span_offsets.data()), 0);
+  check_span_lengths(span_lengths, span_offsets);
+
+  // ids absent in the model stay single-token spans
+  std::vector<int32_t> unknown_ids({ token_ids[0], 1000000, -5 });
+  std::vector<int64_t> unknown_offsets({ 0, 3 });
+  ASSERT_EQ(topmine_segment_ids(ids_model, unknown_ids.data(), unknown_offsets.data(), 1,
+                                span_lengths.data(), span_offsets.data()), 0);
+  ASSERT_EQ(std::vector<int32_t>(span_lengths.begin(), span_lengths.begin() + span_offsets[1]),
+            std::vector<int32_t>({ 1, 1, 1 }));
+
+  // ids above twice the dictionary size are mapped to tokens too
+  std::vector<int32_t> large_token_ids;
+  for (const auto& id : token_ids) {
+    large_token_ids.push_back(id + (1 << 30));
+  }
+
+  topmine_model* large_ids_model = nullptr;
+  ASSERT_EQ(topmine_train_ids(large_token_ids.data(), document_offsets.data(), ids.size(), &options, &large_ids_model),
+            0) << topmine_last_error();
+  ASSERT_EQ(topmine_segment_ids(large_ids_model, large_token_ids.data(), document_offsets.data(), ids.size(),
+                                span_lengths.data(), span_offsets.data()), 0);
+  check_span_lengths(span_lengths, span_offsets);
+  topmine_free_model(large_ids_model);
+
+  // stored model gives the same segmentation, absent tokens stay single-token spans
+  boost::filesystem::path model_path("topmine_test_dir");
+  model_path.append("c_api_model.txt");
+  ASSERT_EQ(topmine_store_model(text_model, model_path.string().c_str()), 0);
+
+  topmine_model* loaded_model = nullptr;
+  ASSERT_EQ(topmine_load_model(model_path.string().c_str(), &options, &loaded_model), 0) << topmine_last_error();
+  ASSERT_EQ(topmine_segment_texts(loaded_model, documents.data(), documents.size(),
+                                  span_lengths.data(), span_lengths.size(), span_offsets.data()), 0);
+  check_span_lengths(span_lengths, span_offsets);
+
+  const char* unknown_document = "метод опорных векторов неизвестный токен";
+  ASSERT_EQ(topmine_segment_texts(loaded_model, &unknown_document, 1, span_lengths.data(), 5, span_offsets.data()), 0);
+  ASSERT_EQ(std::vector<int32_t>(span_lengths.begin(), span_lengths.begin() + span_offsets[1]),
+            std::vector<int32_t>({ 3, 1, 1 }));
+
+  // errors are returned as codes with messages
+  ASSERT_EQ(topmine_segment_texts(loaded_model, &unknown_document, 1, span_lengths.data(), 2, span_offsets.data()), -1);
+  ASSERT_EQ(std::string(topmine_last_error()), "Error: span_lengths buffer is too small");
+
+  topmine_model* absent_model = nullptr;
+  ASSERT_EQ(topmine_load_model("topmine_test_dir/absent_model.txt", &options, &absent_model), -1);
+  ASSERT_FALSE(std::string(topmine_last_error()).empty());
+  ASSERT_EQ(absent_model, nullptr);
+
+  topmine_free_model(text_model);
+  topmine_free_model(ids_model);
+  topmine_free_model(loaded_model);
+}